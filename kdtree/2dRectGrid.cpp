@@ -3,6 +3,7 @@
 
 #include "generate.hpp"
 #include "kdtree.hpp"
+#include "flat_kdtree.hpp"
 #include "knn_search.hpp"
 
 using dtype = float;
@@ -51,8 +52,25 @@ int main(){
     std::cout << "found after " << nDepths << " queries at distance: " << compare<dtype,dim>(queryPoint,data[queryKey.m_id]);
     std::cout << std::endl;
 
+    search_stats stats;
+    queryKey = nn_search<dtype,dim>(root,queryPoint,stats);
+    std::cout << "NN of point " << queryPoint << " is point " << data[queryKey.m_id] << " - ";
+    std::cout << "found after visiting " << stats.m_nodes_visited << " nodes and " << stats.m_points_visited << " points at distance: ";
+    std::cout << compare<dtype,dim>(queryPoint,data[queryKey.m_id]) << std::endl;
+
     destroy_kdtree(root);
 
+    flat_kdtree<dtype,dim> flat = build_flat_kdtree<dtype,dim>( data );
+    queryKey = ann_search<dtype,dim>(flat,queryPoint,nDepths);
+    std::cout << "ANN of point " << queryPoint << " in flat kd-tree is point " << data[queryKey.m_id] << " - ";
+    std::cout << "found after " << nDepths << " queries at distance: " << compare<dtype,dim>(queryPoint,data[queryKey.m_id]);
+    std::cout << std::endl;
+
+    queryKey = nn_search<dtype,dim>(flat,queryPoint,stats);
+    std::cout << "NN of point " << queryPoint << " in flat kd-tree is point " << data[queryKey.m_id] << " - ";
+    std::cout << "found after visiting " << stats.m_nodes_visited << " nodes and " << stats.m_points_visited << " points at distance: ";
+    std::cout << compare<dtype,dim>(queryPoint,data[queryKey.m_id]) << std::endl;
+
     int k = 10;
     std::vector<Point<dtype,dim>> knn = knn_search<dtype,dim>( queryPoint, k, data );
     std::cout << std::endl;
@@ -63,5 +81,11 @@ int main(){
         ++pos;
     }
 
+    std::vector<neighbor<dtype>> neighbors = knn_query<dtype,dim>( flat, queryPoint, k );
+    std::cout << std::endl;
+    std::cout << "the " << k << "-nn of point " << queryPoint << " in flat kd-tree are:" << std::endl;
+    for( size_t i(0); i < neighbors.size(); ++i )
+        std::cout << i << ": " << data[neighbors[i].m_id] << " -> " << neighbors[i].m_distance << "\n";
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <array>
+
+#include "kdtree.hpp"
+#include "parallel.hpp"
+#include "space_filling_curve.hpp"
+#include "timer.hpp"
+
+/**
+ * @brief Result of a batched k-nearest-neighbour search: the ids and distances of the k nearest neighbours of
+ * every query, stored row-major (row q holds the neighbours of query q sorted by distance). Rows of queries with
+ * fewer than k points in the tree are padded with id = max size_t and distance = infinity.
+ */
+template<typename T>
+struct knn_batch_result {
+    size_t              m_num_queries = 0;
+    size_t              m_k           = 0;
+    std::vector<size_t> m_ids;
+    std::vector<T>      m_distances;
+    double              m_seconds     = 0;
+
+    size_t getID( size_t query, size_t j )       const { return m_ids[query * m_k + j]; }
+    T      getDistance( size_t query, size_t j ) const { return m_distances[query * m_k + j]; }
+    double queries_per_second()                  const { return m_seconds > 0 ? m_num_queries / m_seconds : 0; }
+};
+
+/**
+ * @brief Runs knn_query for a batch of query points on num_threads threads (0 = all cores). Tree is anything
+ * knn_query accepts: a node_t<T,N> const* root or a flat_kdtree<T,N>. The tree is only read, so the threads share
+ * it without synchronisation. Queries are handed out in small chunks through an atomic counter for load balance.
+ *
+ * @param order process the queries along a space-filling curve (see curve_order), so that consecutive queries of
+ * a thread touch the same tree nodes; the results are still stored in the order of the input queries.
+ * @param metric distance metric policy, see metrics.hpp.
+ */
+template<typename T, int N, typename Tree, typename Metric = euclidean_metric<T,N>>
+knn_batch_result<T> knn_batch( Tree const& tree, std::array<T,N> const* queries, size_t numQueries, size_t k,
+    int num_threads = 0, curve_type order = curve_type::none, Metric const& metric = Metric() ){
+
+    knn_batch_result<T> result;
+    result.m_num_queries = numQueries;
+    result.m_k = k;
+    result.m_ids.assign(numQueries * k, std::numeric_limits<size_t>::max());
+    result.m_distances.assign(numQueries * k, std::numeric_limits<T>::infinity());
+
+    timer t;
+
+    num_threads = resolve_num_threads(num_threads);
+    std::vector<size_t> permutation;
+    if( order != curve_type::none )
+        permutation = curve_order<T,N>(queries, numQueries, order, num_threads);
+
+    const size_t chunk = 256;
+    std::atomic<size_t> next(0);
+
+    parallel_for_chunks( 0, size_t(num_threads), num_threads, [&]( size_t, size_t, size_t ){
+        std::vector<neighbor<T>> neighbors;
+        neighbors.reserve(k);
+        for( size_t begin = next.fetch_add(chunk); begin < numQueries; begin = next.fetch_add(chunk) ){
+            size_t end = std::min(begin + chunk, numQueries);
+            for( size_t i(begin); i < end; ++i ){
+                size_t query = permutation.empty() ? i : permutation[i];
+                search_stats stats;
+                knn_query<T,N>(tree, queries[query], k, neighbors, stats, metric);
+                for( size_t j(0); j < neighbors.size(); ++j ){
+                    result.m_ids[query * k + j] = neighbors[j].m_id;
+                    result.m_distances[query * k + j] = neighbors[j].m_distance;
+                }
+            }
+        }
+    });
+
+    result.m_seconds = t.seconds();
+    return result;
+}
+
+template<typename T, int N, typename Tree, typename Metric = euclidean_metric<T,N>>
+knn_batch_result<T> knn_batch( Tree const& tree, std::vector<std::array<T,N>> const& queries, size_t k,
+    int num_threads = 0, curve_type order = curve_type::none, Metric const& metric = Metric() ){
+    return knn_batch<T,N>(tree, queries.data(), queries.size(), k, num_threads, order, metric);
+}
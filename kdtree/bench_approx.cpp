@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+/**
+ * @brief Runs all queries with the given epsilon and leaf budget and prints the mean latency, the recall against
+ * the exact neighbours (the fraction of returned neighbours not farther than the exact k-th one, which does not
+ * depend on how ties are broken) and the mean and worst achieved epsilon.
+ */
+void run_approx( flat_kdtree<dtype,dim> const& tree, std::vector<std::array<dtype,dim>> const& queries,
+    std::vector<std::vector<neighbor<dtype>>> const& exact, size_t k, dtype epsilon, size_t maxLeaves ){
+
+    std::vector<std::vector<neighbor<dtype>>> results( queries.size() );
+    std::vector<approx_knn_info<dtype>> infos( queries.size() );
+
+    timer t;
+    for( size_t i(0); i < queries.size(); ++i )
+        infos[i] = approx_knn_query<dtype,dim>(tree, queries[i], k, results[i], epsilon, maxLeaves);
+    double seconds = t.seconds();
+
+    size_t hits = 0, total = 0;
+    double sumEpsilon = 0, maxEpsilon = 0;
+    for( size_t i(0); i < queries.size(); ++i ){
+        for( neighbor<dtype> const& e : results[i] )
+            hits += e.m_distance <= exact[i].back().m_distance;
+        total += exact[i].size();
+        sumEpsilon += infos[i].m_epsilon;
+        maxEpsilon = std::max<double>( maxEpsilon, infos[i].m_epsilon );
+    }
+
+    std::cout << std::setw(10) << epsilon;
+    if( maxLeaves == std::numeric_limits<size_t>::max() )
+        std::cout << std::setw(10) << "-";
+    else
+        std::cout << std::setw(10) << maxLeaves;
+    std::cout << std::setw(16) << seconds / queries.size() * 1e6 << std::setw(12) << double(hits) / total
+              << std::setw(16) << sumEpsilon / queries.size() << std::setw(16) << maxEpsilon << std::endl;
+}
+
+void run_dataset( std::string const& name, std::vector<std::array<dtype,dim>> const& data,
+    std::vector<std::array<dtype,dim>> const& queries, size_t k ){
+
+    flat_kdtree<dtype,dim> tree = build_flat_kdtree<dtype,dim>( data );
+
+    std::vector<std::vector<neighbor<dtype>>> exact( queries.size() );
+    timer t;
+    for( size_t i(0); i < queries.size(); ++i )
+        knn_query<dtype,dim>(tree, queries[i], k, exact[i]);
+    double seconds = t.seconds();
+
+    std::cout << std::endl << name << ": " << data.size() << " points, " << queries.size() << " queries, k = " << k
+              << ", exact knn_query " << seconds / queries.size() * 1e6 << " us" << std::endl;
+    std::cout << std::setw(10) << "epsilon" << std::setw(10) << "leaves" << std::setw(16) << "latency [us]"
+              << std::setw(12) << "recall" << std::setw(16) << "mean epsilon" << std::setw(16) << "max epsilon"
+              << std::endl;
+
+    const size_t unlimited = std::numeric_limits<size_t>::max();
+    for( dtype epsilon : { dtype(0), dtype(0.1), dtype(0.5), dtype(1), dtype(2) } )
+        run_approx( tree, queries, exact, k, epsilon, unlimited );
+    for( size_t maxLeaves : { 1, 2, 4, 8, 16 } )
+        run_approx( tree, queries, exact, k, dtype(0), maxLeaves );
+}
+
+// usage: ./bench_approx [num_points=1e6] [num_queries=10000] [k=8]
+// Recall versus latency of approx_knn_query with an epsilon bound or a budget of leaves, against exact kNN, on
+// random (generate_random) and gridded (generate_2d_dense) data.
+int main( int argc, char *argv[] ){
+    size_t numData    = argc > 1 ? std::atof(argv[1]) : 1e6;
+    size_t numQueries = argc > 2 ? std::atoi(argv[2]) : 10000;
+    size_t k          = argc > 3 ? std::atoi(argv[3]) : 8;
+
+    std::vector<std::array<dtype,dim>> data, queries;
+    generate_random<dtype,dim>(numData, data);
+    generate_random<dtype,dim>(numQueries, queries);
+    run_dataset( "random", data, queries, k );
+
+    // a square grid with the same number of points, queried at random positions inside it.
+    size_t n = static_cast<size_t>( std::sqrt( double(numData) ) );
+    generate_2d_dense<dtype>(data, n, n, 1, 1, 0, 0);
+    for( std::array<dtype,dim> & q : queries )
+        for( int d(0); d < dim; ++d )
+            q[d] = n / 2 + q[d] * n / 60;
+    run_dataset( "grid", data, queries, k );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_arena [max_points=1e6]
+// Build and teardown times of trees from build_kdtree with nodes allocated one by one (new / destroy_kdtree) and
+// with nodes allocated in a node_arena that is cleared in one go.
+int main( int argc, char *argv[] ){
+    size_t maxPoints = argc > 1 ? std::atof(argv[1]) : 1e6;
+
+    std::vector<std::string> rows;
+    for( size_t numData(10000); numData <= maxPoints; numData *= 10 ){
+        std::vector<std::array<dtype,dim>> data;
+        generate_random<dtype,dim>(numData, data);
+
+        timer t;
+        node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+        double build = t.seconds();
+        t.reset();
+        destroy_kdtree(root);
+        double destroy = t.seconds();
+
+        node_arena<dtype,dim> arena;
+        t.reset();
+        root = build_kdtree<dtype,dim>( data, &arena );
+        double arenaBuild = t.seconds();
+        t.reset();
+        arena.clear();
+        double arenaDestroy = t.seconds();
+
+        std::ostringstream row;
+        row << std::setw(10) << numData << std::setw(14) << build << std::setw(14) << destroy
+            << std::setw(14) << arenaBuild << std::setw(14) << arenaDestroy
+            << std::setw(12) << ( build + destroy ) / ( arenaBuild + arenaDestroy );
+        rows.push_back( row.str() );
+    }
+
+    std::cout << std::endl << std::setw(10) << "points" << std::setw(14) << "new [s]" << std::setw(14) << "delete [s]"
+              << std::setw(14) << "arena [s]" << std::setw(14) << "clear [s]" << std::setw(12) << "speedup" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+#include "batch_search.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_batch [grid_size=1001] [k=8] [max_threads=0 (all)]
+// Queries every node of a second, shifted grid against a flat kd-tree of the first grid, and a batch of random
+// queries of the same size, with and without Morton reordering of the queries.
+int main( int argc, char *argv[] ){
+    size_t n          = argc > 1 ? std::atoi(argv[1]) : 1001;
+    size_t k          = argc > 2 ? std::atoi(argv[2]) : 8;
+    int    maxThreads = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+
+    std::vector<std::array<dtype,dim>> data, gridQueries, randomQueries;
+    generate_2d_dense<dtype>(data, n, n, 1, 1, 0, 0);
+    generate_2d_dense<dtype>(gridQueries, n-1, n-1, 1, 1, 0.5, 0.5);
+    generate_random<dtype,dim>(gridQueries.size(), randomQueries);
+    for( std::array<dtype,dim> & q : randomQueries )
+        for( int i(0); i < dim; ++i )
+            q[i] = n / 2 + q[i] * n / 60;
+
+    flat_kdtree<dtype,dim> tree = build_flat_kdtree<dtype,dim>( data, 16, 0 );
+
+    std::cout << gridQueries.size() << " queries, k = " << k << std::endl;
+    std::cout << std::setw(10) << "threads" << std::setw(18) << "grid [q/s]" << std::setw(18) << "grid+morton"
+              << std::setw(18) << "random [q/s]" << std::setw(18) << "random+morton" << std::endl;
+
+    for( int threads(1); threads <= maxThreads; threads *= 2 ){
+        std::cout << std::setw(10) << threads;
+        std::cout << std::setw(18) << knn_batch<dtype,dim>(tree, gridQueries, k, threads, curve_type::none).queries_per_second();
+        std::cout << std::setw(18) << knn_batch<dtype,dim>(tree, gridQueries, k, threads, curve_type::morton).queries_per_second();
+        std::cout << std::setw(18) << knn_batch<dtype,dim>(tree, randomQueries, k, threads, curve_type::none).queries_per_second();
+        std::cout << std::setw(18) << knn_batch<dtype,dim>(tree, randomQueries, k, threads, curve_type::morton).queries_per_second();
+        std::cout << std::endl;
+        if( threads < maxThreads && threads * 2 > maxThreads )
+            threads = maxThreads / 2;
+    }
+
+    return EXIT_SUCCESS;
+}
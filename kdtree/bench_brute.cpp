@@ -0,0 +1,96 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+#include "batch_search.hpp"
+#include "knn_search.hpp"
+
+using dtype = float;
+
+// knn_search before knn_brute_force: a copy of the dataset with the distance of every point, fully sorted.
+template<int N>
+std::vector<Point<dtype,N>> sorting_knn_search( Point<dtype,N> queryPoint, int k, std::vector<Point<dtype,N>> vec ){
+    for( size_t i = 0; i < vec.size(); ++i )
+        vec[i].distance = squared_distance<dtype,N>(vec[i].coord, queryPoint.coord);
+    std::sort(vec.begin(), vec.end(), comparison<dtype,N>);
+
+    std::vector<Point<dtype,N>> knn;
+    for( int i(0); i < k && i < static_cast<int>(vec.size()); ++i ){
+        knn.push_back(vec[i]);
+        knn.back().distance = std::sqrt(knn.back().distance);
+    }
+    return knn;
+}
+
+template<int N>
+void run( size_t numData, size_t numQueries, size_t k, int threads, std::vector<std::string> & rows ){
+    std::vector<std::array<dtype,N>> data, queries;
+    generate_random<dtype,N>(numData, data);
+    generate_random<dtype,N>(numQueries, queries);
+
+    auto row = [&]( std::string const& name, double queriesPerSecond, std::string const& same ){
+        std::ostringstream r;
+        r << std::setw(4) << N << std::setw(20) << name << std::setw(16) << queriesPerSecond
+          << std::setw(20) << queriesPerSecond * numData << std::setw(8) << same;
+        rows.push_back( r.str() );
+    };
+
+    flat_kdtree<dtype,N> tree = build_flat_kdtree<dtype,N>(data, 16, threads);
+    knn_batch_result<dtype> reference = knn_batch<dtype,N>(tree, queries, k, threads);
+    row( "flat kd-tree", reference.queries_per_second(), "-" );
+
+    // the old and the single-query brute force are timed on a sample of the queries.
+    std::vector<Point<dtype,N>> points( data.begin(), data.end() );
+    const size_t sample = std::min<size_t>( numQueries, 10 );
+    timer t;
+    for( size_t i(0); i < sample; ++i )
+        sorting_knn_search<N>( Point<dtype,N>(queries[i]), k, points );
+    row( "copy + sort", sample / t.seconds(), "-" );
+
+    const size_t heapSample = std::min<size_t>( numQueries, 100 );
+    bool same = true;
+    t.reset();
+    for( size_t i(0); i < heapSample; ++i ){
+        std::vector<Point<dtype,N>> knn = knn_search<dtype,N>( queries[i], k, data );
+        for( size_t j(0); j < knn.size(); ++j )
+            same = same && knn[j].distance == reference.getDistance(i, j);
+    }
+    row( "knn_search", heapSample / t.seconds(), same ? "yes" : "NO" );
+
+    for( int n : { 1, threads } ){
+        knn_batch_result<dtype> brute = knn_brute_force<dtype,N>(data, queries, k, n);
+        same = brute.m_ids == reference.m_ids && brute.m_distances == reference.m_distances;
+        row( "tiled " + std::to_string(n) + " thr", brute.queries_per_second(), same ? "yes" : "NO" );
+        if( threads == 1 )
+            break;
+    }
+}
+
+// usage: ./bench_brute [num_points=1e6] [num_queries=1000] [k=8] [threads=0 (all)]
+// Brute-force kNN of random points in 2D and 3D: the former knn_search (copy of the dataset and full sort, on a
+// sample of 10 queries), the single-query knn_search (on a sample of 100 queries) and the tiled knn_brute_force
+// on one and on all threads, with a flat kd-tree for scale. Throughput is in queries and in point comparisons
+// per second; "same" tells whether the results equal those of the kd-tree (distances only for knn_search).
+int main( int argc, char *argv[] ){
+    size_t numData    = argc > 1 ? std::atof(argv[1]) : 1e6;
+    size_t numQueries = argc > 2 ? std::atof(argv[2]) : 1000;
+    size_t k          = argc > 3 ? std::atoi(argv[3]) : 8;
+    int    threads    = resolve_num_threads( argc > 4 ? std::atoi(argv[4]) : 0 );
+
+    std::vector<std::string> rows;
+    run<2>( numData, numQueries, k, threads, rows );
+    run<3>( numData, numQueries, k, threads, rows );
+
+    std::cout << numData << " points, " << numQueries << " queries, k = " << k << ", " << threads << " threads" << std::endl;
+    std::cout << std::setw(4) << "N" << std::setw(20) << "search" << std::setw(16) << "queries/s"
+              << std::setw(20) << "comparisons/s" << std::setw(8) << "same" << std::endl;
+    for( std::string const& r : rows )
+        std::cout << r << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "flat_kdtree.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_build [max_points=1e7] [max_points_legacy=1e6] [num_threads=0 (all)]
+// The legacy build_kdtree needs ~0.5 KB per point, so it is only run up to max_points_legacy.
+int main( int argc, char *argv[] ){
+    size_t maxPoints       = argc > 1 ? std::atof(argv[1]) : 1e7;
+    size_t maxPointsLegacy = argc > 2 ? std::atof(argv[2]) : 1e6;
+    int    numThreads      = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+
+    std::cout << std::setw(10) << "N" << std::setw(20) << "build_kdtree [s]" << std::setw(25) << "build_flat_kdtree [s]"
+              << std::setw(20) << numThreads << " threads [s]" << std::setw(12) << "identical" << std::endl;
+
+    for( size_t numData(10000); numData <= maxPoints; numData *= 10 ){
+        std::vector<std::array<dtype,dim>> data;
+        generate_random<dtype,dim>(numData, data);
+
+        double legacy = -1;
+        if( numData <= maxPointsLegacy ){
+            timer t;
+            node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+            legacy = t.seconds();
+            destroy_kdtree(root);
+        }
+
+        timer t;
+        flat_kdtree<dtype,dim> tree = build_flat_kdtree<dtype,dim>( data );
+        double flat = t.seconds();
+
+        t.reset();
+        flat_kdtree<dtype,dim> parallelTree = build_flat_kdtree<dtype,dim>( data, 16, numThreads );
+        double parallel = t.seconds();
+
+        bool identical = tree.m_ids == parallelTree.m_ids;
+        for( size_t i(0); i < tree.numNodes(); ++i )
+            identical = identical && tree.getNode(i).m_split_dim == parallelTree.getNode(i).m_split_dim
+                                  && tree.getNode(i).m_split_value == parallelTree.getNode(i).m_split_value;
+
+        std::cout << std::setw(10) << numData;
+        if( legacy < 0 )
+            std::cout << std::setw(20) << "-";
+        else
+            std::cout << std::setw(20) << legacy;
+        std::cout << std::setw(25) << flat << std::setw(32) << parallel;
+        std::cout << std::setw(12) << ( identical ? "yes" : "NO" ) << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
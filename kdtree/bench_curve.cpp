@@ -0,0 +1,139 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+#include "batch_search.hpp"
+#include "space_filling_curve.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+const char * curve_name( curve_type curve ){
+    return curve == curve_type::morton ? "morton" : curve == curve_type::hilbert ? "hilbert" : "input";
+}
+
+// the Morton keys of morton_order before the batched, vectorised curve_codes: one point and one bit at a time.
+uint64_t bitwise_morton_code( std::array<dtype,dim> const& point, curve_bounds<dtype,dim> const& bounds ){
+    uint64_t code = 0;
+    for( int b(curve_bits_per_dim<dim>() - 1); b >= 0; --b )
+        for( int d(0); d < dim; ++d )
+            code = ( code << 1 ) | ( ( bounds.quantize(point[d], d) >> b ) & 1 );
+    return code;
+}
+
+// prints one row of the query tables: throughput and, where the hardware counter is available, misses per query.
+template<typename Tree>
+void query_row( std::string const& tree_name, Tree const& tree, std::vector<std::array<dtype,dim>> const& queries,
+    size_t k, int threads, curve_type order, cache_miss_counter & misses ){
+
+    misses.start();
+    knn_batch_result<dtype> result = knn_batch<dtype,dim>(tree, queries, k, threads, order);
+    uint64_t count = misses.stop();
+
+    std::cout << std::setw(10) << tree_name << std::setw(10) << curve_name(order) << std::setw(10) << threads
+              << std::setw(16) << result.queries_per_second();
+    if( misses.available() )
+        std::cout << std::setw(18) << double(count) / queries.size();
+    else
+        std::cout << std::setw(18) << "n/a";
+    std::cout << std::endl;
+}
+
+// usage: ./bench_curve [num_points=4e6] [k=8] [threads=0 (all)]
+// Space-filling-curve keys and orders of random points: key computation (bitwise vs batched), sorting (std::sort
+// vs radix sort), kNN batches on a flat kd-tree and a node_t tree with the queries in input, Morton and Hilbert
+// order, and a node_t tree grown by insertions of the points in input and in Hilbert order. Cache misses come from
+// the hardware counters and are reported as n/a where those are not available.
+int main( int argc, char *argv[] ){
+    size_t numData = argc > 1 ? std::atof(argv[1]) : 4e6;
+    size_t k       = argc > 2 ? std::atoi(argv[2]) : 8;
+    int    threads = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+
+    std::vector<std::array<dtype,dim>> data, queries;
+    generate_random<dtype,dim>(numData, data);
+    generate_random<dtype,dim>(numData, queries);
+
+    cache_miss_counter misses;
+    if( !misses.available() )
+        std::cout << "hardware cache-miss counter not available, misses are reported as n/a" << std::endl;
+
+    // keys and sorting.
+    curve_bounds<dtype,dim> bounds = compute_curve_bounds<dtype,dim>(data.data(), data.size());
+    std::vector<uint64_t> codes(numData);
+    timer t;
+    for( size_t i(0); i < numData; ++i )
+        codes[i] = bitwise_morton_code(data[i], bounds);
+    double bitwise = t.seconds();
+
+    t.reset();
+    curve_codes<dtype,dim>(data.data(), numData, bounds, curve_type::morton, codes.data());
+    double morton = t.seconds();
+
+    t.reset();
+    curve_codes<dtype,dim>(data.data(), numData, bounds, curve_type::hilbert, codes.data());
+    double hilbert = t.seconds();
+
+    std::vector<size_t> order(numData);
+    std::iota(order.begin(), order.end(), 0);
+    t.reset();
+    std::sort(order.begin(), order.end(), [&codes]( size_t a, size_t b ){ return codes[a] < codes[b]; });
+    double stdSort = t.seconds();
+
+    std::vector<double> radix;
+    for( int n(1); n <= threads; n *= 2 ){
+        std::vector<uint64_t> keys(codes);
+        std::iota(order.begin(), order.end(), 0);
+        t.reset();
+        radix_sort_by_key(keys, order, n);
+        radix.push_back( t.seconds() );
+    }
+
+    std::cout << numData << " points, keys [s]: bitwise morton " << bitwise << ", morton " << morton << ", hilbert "
+              << hilbert << std::endl;
+    std::cout << "sort [s]: std::sort " << stdSort;
+    for( size_t i(0); i < radix.size(); ++i )
+        std::cout << ", radix " << (1 << i) << " thr " << radix[i];
+    std::cout << std::endl;
+
+    // query batches.
+    flat_kdtree<dtype,dim> flat = build_flat_kdtree<dtype,dim>( data, 16, 0 );
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+
+    std::vector<size_t> hilbertOrder = curve_order<dtype,dim>( data, curve_type::hilbert, threads );
+    std::vector<std::array<dtype,dim>> curveData = reorder_points<dtype,dim>( data.data(), hilbertOrder );
+    node_t<dtype,dim> *grownInput = nullptr, *grownCurve = nullptr;
+    t.reset();
+    for( size_t i(0); i < numData; ++i )
+        grownInput = insert_into_kdtree<dtype,dim>( grownInput, key<dtype,dim>{ i, data[i] } );
+    double growInput = t.seconds();
+    t.reset();
+    for( size_t i(0); i < numData; ++i )
+        grownCurve = insert_into_kdtree<dtype,dim>( grownCurve, key<dtype,dim>{ hilbertOrder[i], curveData[i] } );
+    double growCurve = t.seconds();
+
+    std::cout << std::endl << "k = " << k << "; node_t trees grown by insertions in input order ("
+              << growInput << " s) and in Hilbert order (" << growCurve << " s)" << std::endl;
+    std::cout << std::setw(10) << "tree" << std::setw(10) << "queries" << std::setw(10) << "threads"
+              << std::setw(16) << "queries/s" << std::setw(18) << "misses/query" << std::endl;
+    for( int n : { 1, threads } ){
+        for( curve_type order : { curve_type::none, curve_type::morton, curve_type::hilbert } )
+            query_row( "flat", flat, queries, k, n, order, misses );
+        for( curve_type order : { curve_type::none, curve_type::morton, curve_type::hilbert } )
+            query_row( "node_t", root, queries, k, n, order, misses );
+        for( curve_type order : { curve_type::none, curve_type::hilbert } ){
+            query_row( "grown", grownInput, queries, k, n, order, misses );
+            query_row( "grown+hil", grownCurve, queries, k, n, order, misses );
+        }
+        if( threads == 1 )
+            break;
+    }
+
+    destroy_kdtree(root);
+    destroy_kdtree(grownInput);
+    destroy_kdtree(grownCurve);
+    return EXIT_SUCCESS;
+}
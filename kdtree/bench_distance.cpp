@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "distance_kernels.hpp"
+
+using dtype = float;
+
+// compare<T,N> as it was before the distance kernels: std::pow per dimension and a square root per point.
+template<typename T, int N>
+T compare_pow( std::array<T,N> const& a, std::array<T,N> const& b ){
+    T s = 0;
+    for( int dim(0); dim < N; ++dim )
+        s += std::pow( a[dim] - b[dim] ,2);
+    return std::sqrt(s);
+}
+
+template<int N>
+void bench_dim( size_t numPoints, int repetitions ){
+    std::vector<std::array<dtype,N>> data;
+    generate_random<dtype,N>(numPoints, data);
+    std::array<dtype,N> q = data[numPoints / 2];
+
+    std::array<std::vector<dtype>,N> soa;
+    std::array<dtype const*,N> coords;
+    for( int dim(0); dim < N; ++dim ){
+        soa[dim].resize(numPoints);
+        for( size_t i(0); i < numPoints; ++i )
+            soa[dim][i] = data[i][dim];
+        coords[dim] = soa[dim].data();
+    }
+    std::vector<dtype> out(numPoints);
+    double total = double(numPoints) * repetitions;
+
+    // the sums keep the compiler from removing the loops.
+    dtype sum = 0;
+    timer t;
+    for( int r(0); r < repetitions; ++r )
+        for( size_t i(0); i < numPoints; ++i )
+            sum += compare_pow<dtype,N>(q, data[i]);
+    double pow_rate = total / t.seconds();
+
+    t.reset();
+    for( int r(0); r < repetitions; ++r )
+        for( size_t i(0); i < numPoints; ++i )
+            sum += compare<dtype,N>(q, data[i]);
+    double compare_rate = total / t.seconds();
+
+    std::cout << std::setw(4) << N << std::setw(16) << pow_rate / 1e6 << std::setw(16) << compare_rate / 1e6;
+
+    simd_level levels[] = { simd_level::scalar, simd_level::avx2, simd_level::avx512 };
+    for( simd_level level : levels ){
+        if( level > active_simd_level() ){
+            std::cout << std::setw(16) << "-";
+            continue;
+        }
+        t.reset();
+        for( int r(0); r < repetitions; ++r ){
+            squared_distances<dtype,N>(coords, numPoints, q, out.data(), level);
+            sum += out[r % numPoints];
+        }
+        std::cout << std::setw(16) << total / t.seconds() / 1e6;
+    }
+    std::cout << "   (" << sum << ")" << std::endl;
+}
+
+// usage: ./bench_distance [num_points=4096] [repetitions=2000]
+// Points per second of the distance computation from one query point to a block of points that fits in cache.
+int main( int argc, char *argv[] ){
+    size_t numPoints   = argc > 1 ? std::atoi(argv[1]) : 4096;
+    int    repetitions = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    std::cout << "runtime selected kernel: " << simd_level_name( active_simd_level() ) << std::endl;
+    std::cout << "Mpoints/s" << std::endl;
+    std::cout << std::setw(4) << "N" << std::setw(16) << "pow compare" << std::setw(16) << "compare"
+              << std::setw(16) << "scalar SoA" << std::setw(16) << "avx2 SoA" << std::setw(16) << "avx512 SoA" << std::endl;
+
+    bench_dim<2>(numPoints, repetitions);
+    bench_dim<3>(numPoints, repetitions);
+    bench_dim<8>(numPoints, repetitions);
+    bench_dim<16>(numPoints, repetitions);
+
+    return EXIT_SUCCESS;
+}
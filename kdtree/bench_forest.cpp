@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "flat_kdtree.hpp"
+#include "kdforest.hpp"
+#include "knn_search.hpp"
+
+using dtype = float;
+
+/**
+ * @brief Feature-like data: points of the linear subspace spanned by the rows of basis of R^N plus a little noise
+ * in every dimension, so the intrinsic dimension is much lower than N as for real feature vectors.
+ */
+template<int N>
+void generate_features( size_t numData, std::vector<dtype> const& basis, std::mt19937 & rng,
+    std::vector<std::array<dtype,N>> & data ){
+    std::normal_distribution<dtype> normal(0, 1);
+    int latentDims = basis.size() / N;
+
+    data.resize(numData);
+    std::vector<dtype> latent(latentDims);
+    for( std::array<dtype,N> & p : data ){
+        for( dtype & e : latent )
+            e = 10 * normal(rng);
+        for( int dim(0); dim < N; ++dim ){
+            p[dim] = 0.5 * normal(rng);
+            for( int l(0); l < latentDims; ++l )
+                p[dim] += latent[l] * basis[l * N + dim];
+        }
+    }
+}
+
+double recall( std::vector<neighbor<dtype>> const& result, std::vector<neighbor<dtype>> const& exact ){
+    size_t hits = 0;
+    for( neighbor<dtype> const& e : result )
+        hits += e.m_distance <= exact.back().m_distance;
+    return double(hits) / exact.size();
+}
+
+template<int N>
+void run( size_t numData, size_t numQueries, size_t k, int latentDims ){
+    std::mt19937 rng(N);
+    std::normal_distribution<dtype> normal(0, 1);
+    std::vector<dtype> basis( latentDims * N );
+    for( dtype & e : basis )
+        e = normal(rng);
+
+    std::vector<std::array<dtype,N>> data, queries;
+    generate_features<N>(numData, basis, rng, data);
+    generate_features<N>(numQueries, basis, rng, queries);
+
+    std::cout << std::endl << "N = " << N << ", " << numData << " points of intrinsic dimension " << latentDims << ", "
+              << numQueries << " queries, k = " << k << std::endl;
+    std::cout << std::setw(24) << "index" << std::setw(10) << "checks" << std::setw(16) << "latency [us]"
+              << std::setw(12) << "recall" << std::setw(14) << "points/query" << std::endl;
+
+    auto report = [&]( std::string const& name, std::string const& checks, double seconds, double rec, double points ){
+        std::cout << std::setw(24) << name << std::setw(10) << checks << std::setw(16) << seconds / numQueries * 1e6
+                  << std::setw(12) << rec / numQueries << std::setw(14) << points / numQueries << std::endl;
+    };
+
+    timer t;
+    for( size_t i(0); i < std::min<size_t>(numQueries, 100); ++i )
+        knn_search<dtype,N>(queries[i], k, data);
+    report( "brute force", "-", t.seconds() * numQueries / std::min<size_t>(numQueries, 100), numQueries, double(numData) * numQueries );
+
+    t.reset();
+    flat_kdtree<dtype,N> tree = build_flat_kdtree<dtype,N>( data, 16, 0 );
+    std::cout << std::setw(24) << "" << "  kd-tree built in " << t.seconds() << " s" << std::endl;
+    std::vector<std::vector<neighbor<dtype>>> exact( numQueries );
+    search_stats stats;
+    double points = 0;
+    t.reset();
+    for( size_t i(0); i < numQueries; ++i ){
+        knn_query<dtype,N>(tree, queries[i], k, exact[i], stats);
+        points += stats.m_points_visited;
+    }
+    report( "kd-tree exact", "-", t.seconds(), numQueries, points );
+
+    std::vector<neighbor<dtype>> result;
+    for( size_t leaves : { 8, 32, 128 } ){
+        double rec = 0;
+        points = 0;
+        t.reset();
+        for( size_t i(0); i < numQueries; ++i ){
+            approx_knn_query<dtype,N>(tree, queries[i], k, result, dtype(0), leaves, stats);
+            rec += recall(result, exact[i]);
+            points += stats.m_points_visited;
+        }
+        report( "kd-tree leaf budget", std::to_string(leaves * 16), t.seconds(), rec, points );
+    }
+
+    for( bool rotate : { false, true } )
+        for( int numTrees : { 1, 4, 8 } ){
+            kdforest_params params;
+            params.m_num_trees = numTrees;
+            params.m_rotate = rotate;
+            t.reset();
+            kdforest<dtype,N> forest = build_kdforest<dtype,N>( data, params );
+            double build = t.seconds();
+            kdforest_search_context<dtype,N> context;
+
+            for( size_t checks : { 128, 512, 2048 } ){
+                double rec = 0;
+                points = 0;
+                t.reset();
+                for( size_t i(0); i < numQueries; ++i ){
+                    knn_query<dtype,N>(forest, queries[i], k, result, checks, context, stats);
+                    rec += recall(result, exact[i]);
+                    points += stats.m_points_visited;
+                }
+                std::string name = "forest " + std::to_string(numTrees) + ( rotate ? " rotated" : "" );
+                report( name, std::to_string(checks), t.seconds(), rec, points );
+            }
+            std::cout << std::setw(24) << "" << "  built in " << build << " s" << std::endl;
+        }
+}
+
+// usage: ./bench_forest [num_points=1e5] [num_queries=1000] [k=10] [intrinsic_dims=8]
+// Recall and latency of randomized kd-forests against brute force, the exact kd-tree and the kd-tree with a leaf
+// budget on 32- and 128-dimensional feature-like data.
+int main( int argc, char *argv[] ){
+    size_t numData    = argc > 1 ? std::atof(argv[1]) : 1e5;
+    size_t numQueries = argc > 2 ? std::atoi(argv[2]) : 1000;
+    size_t k          = argc > 3 ? std::atoi(argv[3]) : 10;
+    int    latentDims = argc > 4 ? std::atoi(argv[4]) : 8;
+
+    run<32>( numData, numQueries, k, latentDims );
+    run<128>( numData, numQueries, k, latentDims );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+
+using dtype = float;
+constexpr int dim = 3;
+
+// generate_random before counter_rng: one normal_distribution draw, std::pow and push_back at a time.
+void sequential_generate_random( size_t numData, std::vector<std::array<dtype,dim>> &data ){
+    std::random_device dev;
+    std::mt19937 rng(dev());
+    std::normal_distribution<double> normal_dist(0, 10);
+    for( size_t i(0); i < numData; ++i ){
+        std::array<dtype,dim> p;
+        for( int d(0); d < dim; ++d )
+            p[d] = static_cast<dtype>( format_decimals(normal_dist(rng), 2) );
+        data.emplace_back(p);
+    }
+}
+
+// points per second of one generator; same tells whether its output equals that of a reference run on one thread.
+void row( std::string const& name, size_t numData, double seconds, std::string const& same = "-" ){
+    std::cout << std::setw(28) << name << std::setw(16) << numData / seconds << std::setw(8) << same << std::endl;
+}
+
+// fills the first count points of a distribution on one and on all threads and compares both outputs.
+template<typename Distribution>
+void compare( std::string const& name, size_t count, Distribution const& distribution,
+    std::vector<std::array<dtype,dim>> & reference, std::vector<std::array<dtype,dim>> & data, int threads ){
+    timer t;
+    fill_points<dtype,dim>( distribution, reference.data(), count, 1 );
+    row( name + " 1 thr", count, t.seconds() );
+    t.reset();
+    fill_points<dtype,dim>( distribution, data.data(), count, threads );
+    double seconds = t.seconds();
+    bool same = std::equal( reference.begin(), reference.begin() + count, data.begin() );
+    row( name + " " + std::to_string(threads) + " thr", count, seconds, same ? "yes" : "NO" );
+}
+
+// usage: ./bench_generate [num_points=1e7] [threads=0 (all)]
+// Generation of 3D datasets: the former sequential generate_random against the counter-based generators writing
+// to preallocated AoS and SoA buffers on one and on all threads, for normal, uniform, clustered and grid points.
+// "same" compares the output on all threads with the one of a single thread.
+int main( int argc, char *argv[] ){
+    size_t numData = argc > 1 ? std::atof(argv[1]) : 1e7;
+    int    threads = resolve_num_threads( argc > 2 ? std::atoi(argv[2]) : 0 );
+
+    std::cout << numData << " points in " << dim << "D, " << threads << " threads" << std::endl;
+    std::cout << std::setw(28) << "generator" << std::setw(16) << "points/s" << std::setw(8) << "same" << std::endl;
+
+    std::vector<std::array<dtype,dim>> data;
+    timer t;
+    sequential_generate_random( numData, data );
+    row( "sequential generate_random", numData, t.seconds() );
+
+    std::vector<std::array<dtype,dim>>().swap(data);
+    t.reset();
+    generate_random<dtype,dim>( numData, data );
+    row( "generate_random", numData, t.seconds() );
+
+    std::vector<std::array<dtype,dim>> reference( numData );
+    std::array<dtype,dim> lo = {{ -50, -50, -50 }}, hi = {{ 50, 50, 50 }};
+    size_t side = std::max<size_t>( 1, std::cbrt( double(numData) ) );
+
+    normal_points<dtype,dim> normal( counter_rng(42), 0, 10, 2 );
+    uniform_points<dtype,dim> uniform{ counter_rng(42), lo, hi };
+    clustered_points<dtype,dim> clusters = make_clustered_points<dtype,dim>( 42, 100, lo, hi, 2 );
+    dense_grid<dtype,dim> grid{ {{ side, side, side }}, {{ 1, 1, 1 }}, {{ 0, 0, 0 }} };
+
+    compare( "normal", numData, normal, reference, data, threads );
+    compare( "uniform", numData, uniform, reference, data, threads );
+    compare( "clustered", numData, clusters, reference, data, threads );
+    compare( "grid", grid.size(), grid, reference, data, threads );
+
+    std::array<std::vector<dtype>,dim> soa;
+    std::array<dtype*,dim> out;
+    for( int d(0); d < dim; ++d ){
+        soa[d].resize(numData);
+        out[d] = soa[d].data();
+    }
+    t.reset();
+    fill_points_soa<dtype,dim>( normal, out, numData, threads );
+    double seconds = t.seconds();
+    fill_points<dtype,dim>( normal, reference.data(), numData, threads );
+    bool same = true;
+    for( size_t i(0); i < numData; ++i )
+        for( int d(0); d < dim; ++d )
+            same = same && soa[d][i] == reference[i][d];
+    row( "normal soa " + std::to_string(threads) + " thr", numData, seconds, same ? "yes" : "NO" );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+#include "grid_index.hpp"
+#include "batch_search.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// radius_count over all queries on one index; returns the queries per second and adds up the counts in total.
+template<typename Index>
+double radius_throughput( Index const& index, std::vector<std::array<dtype,dim>> const& queries, dtype radius, size_t & total ){
+    total = 0;
+    timer t;
+    for( std::array<dtype,dim> const& q : queries )
+        total += radius_count<dtype,dim>(index, q, radius);
+    return queries.size() / t.seconds();
+}
+
+// one row per index: build time, radius_count and knn_batch throughput, and the checksum of the radius counts.
+template<typename Build>
+std::string index_row( std::string const& name, Build build, std::vector<std::array<dtype,dim>> const& queries,
+    dtype radius, size_t k, int threads ){
+
+    timer t;
+    auto index = build();
+    double seconds = t.seconds();
+
+    size_t total = 0;
+    double radius1 = radius_throughput(index, queries, radius, total);
+    double knn1 = knn_batch<dtype,dim>(index, queries, k, 1).queries_per_second();
+    double knnN = knn_batch<dtype,dim>(index, queries, k, threads).queries_per_second();
+
+    std::ostringstream row;
+    row << std::setw(16) << name << std::setw(12) << seconds << std::setw(16) << radius1 << std::setw(16) << knn1
+        << std::setw(16) << knnN << std::setw(16) << total;
+    return row.str();
+}
+
+// usage: ./bench_grid [grid_size=1001] [k=8] [threads=0 (all)]
+// Fixed-radius (radius 1.5 spacings) and kNN queries on the lattice of generate_2d_dense and on random points in
+// the same square: the uniform grid with cells of one spacing and of the automatic size against the flat kd-tree
+// and the node_t tree. The queries are the nodes of a second lattice shifted by half a spacing. Equal radius
+// checksums mean equal results.
+int main( int argc, char *argv[] ){
+    size_t n       = argc > 1 ? std::atoi(argv[1]) : 1001;
+    size_t k       = argc > 2 ? std::atoi(argv[2]) : 8;
+    int    threads = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+    const dtype radius = 1.5;
+
+    std::vector<std::array<dtype,dim>> lattice, random, queries;
+    generate_2d_dense<dtype>(lattice, n, n, 1, 1, 0, 0);
+    generate_2d_dense<dtype>(queries, n-1, n-1, 1, 1, 0.5, 0.5);
+    generate_random<dtype,dim>(lattice.size(), random);
+    for( std::array<dtype,dim> & p : random )
+        for( int d(0); d < dim; ++d )
+            p[d] = ( p[d] / 60 + dtype(0.5) ) * n;
+
+    std::vector<std::string> rows;
+    for( int set(0); set < 2; ++set ){
+        std::vector<std::array<dtype,dim>> const& data = set == 0 ? lattice : random;
+        rows.push_back( set == 0 ? "lattice" : "random" );
+        rows.push_back( index_row( "grid 1 thr", [&](){ return build_grid_index<dtype,dim>(data, 1, 1); }, queries, radius, k, threads ) );
+        rows.push_back( index_row( "grid", [&](){ return build_grid_index<dtype,dim>(data, 1, threads); }, queries, radius, k, threads ) );
+        rows.push_back( index_row( "grid auto", [&](){ return build_grid_index<dtype,dim>(data, 0, threads); }, queries, radius, k, threads ) );
+        rows.push_back( index_row( "flat kd-tree", [&](){ return build_flat_kdtree<dtype,dim>(data, 16, threads); }, queries, radius, k, threads ) );
+
+        node_t<dtype,dim> *root = nullptr;
+        rows.push_back( index_row( "node_t", [&](){ root = build_kdtree<dtype,dim>(data); return static_cast<node_t<dtype,dim> const*>(root); },
+            queries, radius, k, threads ) );
+        destroy_kdtree(root);
+    }
+
+    std::cout << std::endl << lattice.size() << " points, " << queries.size() << " queries, radius " << radius << ", k = "
+              << k << ", " << threads << " threads" << std::endl;
+    std::cout << std::setw(16) << "index" << std::setw(12) << "build [s]" << std::setw(16) << "radius [q/s]"
+              << std::setw(16) << "knn 1 thr [q/s]" << std::setw(16) << "knn [q/s]" << std::setw(16) << "radius sum" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "flat_kdtree.hpp"
+#include "kdtree_io.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_io [num_points=1e6] [path=kdtree_bench.bin] [num_queries=10000]
+// Builds a flat kd-tree, saves it, reopens it memory-mapped (with and without checksum verification) and checks
+// that the mapped tree returns the same k nearest neighbours as the freshly built flat tree and as build_kdtree.
+int main( int argc, char *argv[] ){
+    size_t      numData    = argc > 1 ? std::atof(argv[1]) : 1e6;
+    std::string path       = argc > 2 ? argv[2] : "kdtree_bench.bin";
+    size_t      numQueries = argc > 3 ? std::atoi(argv[3]) : 10000;
+    const size_t k = 8;
+
+    std::vector<std::array<dtype,dim>> data, queries;
+    generate_random<dtype,dim>(numData, data);
+    generate_random<dtype,dim>(numQueries, queries);
+
+    timer t;
+    flat_kdtree<dtype,dim> tree = build_flat_kdtree<dtype,dim>( data );
+    double build = t.seconds();
+
+    t.reset();
+    save_flat_kdtree( tree, path );
+    double save = t.seconds();
+
+    t.reset();
+    flat_kdtree<dtype,dim> verified = open_flat_kdtree<dtype,dim>( path );
+    double openVerified = t.seconds();
+
+    t.reset();
+    flat_kdtree<dtype,dim> mapped = open_flat_kdtree<dtype,dim>( path, false );
+    double open = t.seconds();
+
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+
+    size_t mismatches = 0;
+    std::vector<neighbor<dtype>> expected, fromMapped, fromLegacy;
+    for( std::array<dtype,dim> const& q : queries ){
+        knn_query<dtype,dim>(tree, q, k, expected);
+        knn_query<dtype,dim>(mapped, q, k, fromMapped);
+        knn_query<dtype,dim>(root, q, k, fromLegacy);
+        for( size_t j(0); j < k; ++j ){
+            mismatches += expected[j].m_id != fromMapped[j].m_id || expected[j].m_distance != fromMapped[j].m_distance;
+            mismatches += expected[j].m_id != fromLegacy[j].m_id || expected[j].m_distance != fromLegacy[j].m_distance;
+        }
+    }
+    destroy_kdtree(root);
+
+    std::cout << std::endl << numData << " points, " << numQueries << " queries, k = " << k << std::endl;
+    std::cout << std::setw(28) << "build [s]" << std::setw(12) << build << std::endl;
+    std::cout << std::setw(28) << "save [s]" << std::setw(12) << save << std::endl;
+    std::cout << std::setw(28) << "open + checksum [s]" << std::setw(12) << openVerified << std::endl;
+    std::cout << std::setw(28) << "open [s]" << std::setw(12) << open << std::endl;
+    std::cout << std::setw(28) << "mismatching neighbours" << std::setw(12) << mismatches << std::endl;
+
+    std::remove( path.c_str() );
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
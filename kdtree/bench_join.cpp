@@ -0,0 +1,75 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "batch_search.hpp"
+#include "knn_join.hpp"
+#include "knn_search.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_join [max_points=1e6] [k=8] [threads=0 (all)]
+// All-kNN of a random dataset A in a random dataset B of the same size, and the kNN graph of B: knn_join and
+// knn_self_join against looping knn_search (brute force, timed on a sample of the queries), looping knn_query on
+// the tree of B and knn_batch. Times in seconds; the join times include copying both trees into join_trees.
+int main( int argc, char *argv[] ){
+    size_t maxPoints = argc > 1 ? std::atof(argv[1]) : 1e6;
+    size_t k         = argc > 2 ? std::atoi(argv[2]) : 8;
+    int    threads   = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+
+    std::vector<std::string> rows;
+    for( size_t numData(10000); numData <= maxPoints; numData *= 10 ){
+        std::vector<std::array<dtype,dim>> a, b;
+        generate_random<dtype,dim>(numData, a);
+        generate_random<dtype,dim>(numData, b);
+        node_t<dtype,dim> *rootA = build_kdtree<dtype,dim>( a );
+        node_t<dtype,dim> *rootB = build_kdtree<dtype,dim>( b );
+
+        const size_t sample = std::min<size_t>( numData, 100 );
+        timer t;
+        for( size_t i(0); i < sample; ++i )
+            knn_search<dtype,dim>(a[i], k, b);
+        double brute = t.seconds() * numData / sample;
+
+        std::vector<neighbor<dtype>> neighbors;
+        neighbors.reserve(k);
+        search_stats stats;
+        size_t singlePoints = 0;
+        t.reset();
+        for( size_t i(0); i < numData; ++i ){
+            knn_query<dtype,dim>(rootB, a[i], k, neighbors, stats);
+            singlePoints += stats.m_points_visited;
+        }
+        double single = t.seconds();
+
+        double batch = knn_batch<dtype,dim>(rootB, a, k, threads).m_seconds;
+
+        knn_join_result<dtype> join1 = knn_join<dtype,dim>(rootA, rootB, k, 1);
+        knn_join_result<dtype> joinN = knn_join<dtype,dim>(rootA, rootB, k, threads);
+        knn_join_result<dtype> self = knn_self_join<dtype,dim>(rootB, k, threads);
+
+        std::ostringstream row;
+        row << std::setw(10) << numData << std::setw(14) << brute << std::setw(14) << single << std::setw(14) << batch
+            << std::setw(14) << join1.m_seconds << std::setw(14) << joinN.m_seconds << std::setw(14) << self.m_seconds
+            << std::setw(14) << double(singlePoints) / numData << std::setw(14) << double(join1.m_stats.m_points_visited) / numData;
+        rows.push_back( row.str() );
+
+        destroy_kdtree(rootA);
+        destroy_kdtree(rootB);
+    }
+
+    std::cout << std::endl << "k = " << k << ", " << threads << " threads; last two columns: distances computed per query point"
+              << std::endl;
+    std::cout << std::setw(10) << "points" << std::setw(14) << "knn_search" << std::setw(14) << "knn_query"
+              << std::setw(14) << "knn_batch" << std::setw(14) << "join 1 thr" << std::setw(14) << "join"
+              << std::setw(14) << "self join" << std::setw(14) << "query dist" << std::setw(14) << "join dist" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+
+    return EXIT_SUCCESS;
+}
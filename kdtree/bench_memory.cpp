@@ -0,0 +1,53 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+template<typename Container>
+node_t<dtype,dim> * build( size_t numData, double & input ){
+    std::vector<std::array<dtype,dim>> points;
+    generate_random<dtype,dim>(numData, points);
+    Container data( points.begin(), points.end() );
+    std::vector<std::array<dtype,dim>>().swap(points);
+    input = current_rss_mib();
+    return build_kdtree<dtype,dim>( data );
+}
+
+// usage: ./bench_memory [num_points=1e6] [container=vector|deque|list]
+// Peak RSS of build_kdtree. The peak of a process never goes down, so every run measures a single build: the
+// input is generated first and the peak reached during the build is reported on top of the RSS with the input
+// alone, together with the RSS held by the finished tree.
+int main( int argc, char *argv[] ){
+    size_t      numData   = argc > 1 ? std::atof(argv[1]) : 1e6;
+    std::string container = argc > 2 ? argv[2] : "vector";
+
+    double input = 0;
+    timer t;
+    node_t<dtype,dim> *root = nullptr;
+    if( container == "deque" )
+        root = build<std::deque<std::array<dtype,dim>>>( numData, input );
+    else if( container == "list" )
+        root = build<std::list<std::array<dtype,dim>>>( numData, input );
+    else
+        root = build<std::vector<std::array<dtype,dim>>>( numData, input );
+    double seconds = t.seconds();
+    double peak = peak_rss_mib();
+    double after = current_rss_mib();
+
+    std::cout << std::endl << std::setw(10) << "points" << std::setw(10) << "input" << std::setw(14) << "input [MiB]"
+              << std::setw(16) << "build peak [MiB]" << std::setw(16) << "tree [MiB]" << std::setw(14) << "bytes/point"
+              << std::setw(12) << "time [s]" << std::endl;
+    std::cout << std::setw(10) << numData << std::setw(10) << container << std::setw(14) << input
+              << std::setw(16) << peak - input << std::setw(16) << after - input
+              << std::setw(14) << ( after - input ) * 1048576.0 / numData << std::setw(12) << seconds << std::endl;
+
+    destroy_kdtree(root);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <memory>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "flat_kdtree.hpp"
+#include "quantized_kdtree.hpp"
+#include "batch_search.hpp"
+#include "space_filling_curve.hpp"
+
+using dtype = float;
+
+// exact distance computations per knn query, averaged over the first queries of the batch.
+template<typename Tree, int N>
+double points_per_query( Tree const& tree, std::vector<std::array<dtype,N>> const& queries, size_t k ){
+    size_t numQueries = std::min<size_t>(queries.size(), 10000), points = 0;
+    std::vector<neighbor<dtype>> result;
+    for( size_t i(0); i < numQueries; ++i ){
+        search_stats stats;
+        knn_query<dtype,N>(tree, queries[i], k, result, stats);
+        points += stats.m_points_visited;
+    }
+    return double(points) / numQueries;
+}
+
+// bytes per point of the exact coordinates a tree refines from outside of its index, none for flat kd-trees.
+template<int N>
+double exact_bytes( flat_kdtree<dtype,N> const& ){
+    return 0;
+}
+
+template<int N, typename Code>
+double exact_bytes( quantized_kdtree<dtype,N,Code> const& tree ){
+    return double(tree.getExact().memory_footprint()) / tree.size();
+}
+
+// one row per tree: index size, size of the exact coordinates outside of it, build time, knn and radius throughput, and whether the results match the reference.
+template<typename Tree, int N>
+std::string tree_row( std::string const& name, Tree const& tree, double build, std::vector<std::array<dtype,N>> const& queries,
+    size_t k, dtype radius, int threads, knn_batch_result<dtype> const& reference, size_t & radiusSum ){
+
+    knn_batch_result<dtype> knn1 = knn_batch<dtype,N>(tree, queries, k, 1, curve_type::hilbert);
+    knn_batch_result<dtype> knnN = knn_batch<dtype,N>(tree, queries, k, threads, curve_type::hilbert);
+
+    timer t;
+    size_t total = 0;
+    for( std::array<dtype,N> const& q : queries )
+        total += radius_count<dtype,N>(tree, q, radius);
+    double radiusRate = queries.size() / t.seconds();
+
+    bool sameIDs = knn1.m_ids == reference.m_ids && knnN.m_ids == reference.m_ids;
+    bool same = reference.m_ids.empty() || ( sameIDs && knn1.m_distances == reference.m_distances
+        && knnN.m_distances == reference.m_distances && total == radiusSum );
+    radiusSum = total;
+
+    std::ostringstream row;
+    std::ostringstream exact;
+    if( exact_bytes<N>(tree) > 0 )
+        exact << exact_bytes<N>(tree);
+    else
+        exact << "-";
+    row << std::setw(12) << name << std::setw(14) << double(tree.memory_footprint()) / tree.size() << std::setw(14) << exact.str()
+        << std::setw(12) << build
+        << std::setw(16) << knn1.queries_per_second() << std::setw(16) << knnN.queries_per_second()
+        << std::setw(14) << points_per_query<Tree,N>(tree, queries, k) << std::setw(16) << radiusRate
+        << std::setw(8) << ( same ? "yes" : "NO" );
+    return row.str();
+}
+
+template<int N>
+void run( size_t numData, size_t k, int threads, std::vector<std::string> & rows ){
+    std::vector<std::array<dtype,N>> data, queries;
+    generate_random<dtype,N>(numData, data);
+    generate_random<dtype,N>(std::min<size_t>(numData, 1000000), queries);
+    const dtype radius = 0.5;
+
+    std::ostringstream title;
+    title << N << "D, " << numData << " points";
+    rows.push_back( title.str() );
+
+    timer t;
+    flat_kdtree<dtype,N> flat16 = build_flat_kdtree<dtype,N>(data, 16, threads);
+    double build16 = t.seconds();
+    knn_batch_result<dtype> reference;
+    size_t radiusSum = 0;
+    rows.push_back( tree_row<flat_kdtree<dtype,N>,N>( "flat 16", flat16, build16, queries, k, radius, threads, reference, radiusSum ) );
+    reference = knn_batch<dtype,N>(flat16, queries, k, threads);
+    flat16 = flat_kdtree<dtype,N>();
+
+    // both quantized trees refine from the flat tree with leaves of 32 points, which they keep alive.
+    t.reset();
+    std::shared_ptr<flat_kdtree<dtype,N> const> flat32 = std::make_shared<flat_kdtree<dtype,N>>( build_flat_kdtree<dtype,N>(data, 32, threads) );
+    double build32 = t.seconds();
+    rows.push_back( tree_row<flat_kdtree<dtype,N>,N>( "flat 32", *flat32, build32, queries, k, radius, threads, reference, radiusSum ) );
+
+    t.reset();
+    quantized_kdtree<dtype,N,uint16_t> q16 = quantize_kdtree<dtype,N,uint16_t>(flat32, threads);
+    double quantize16 = build32 + t.seconds();
+    t.reset();
+    quantized_kdtree<dtype,N,uint8_t> q8 = quantize_kdtree<dtype,N,uint8_t>(flat32, threads);
+    double quantize8 = build32 + t.seconds();
+    flat32.reset();
+
+    rows.push_back( tree_row<quantized_kdtree<dtype,N,uint16_t>,N>( "quant 16", q16, quantize16, queries, k, radius, threads, reference, radiusSum ) );
+    rows.push_back( tree_row<quantized_kdtree<dtype,N,uint8_t>,N>( "quant 8", q8, quantize8, queries, k, radius, threads, reference, radiusSum ) );
+}
+
+// usage: ./bench_quantized [num_points=4e6] [k=8] [threads=0 (all)]
+// Flat kd-trees with leaves of 16 and 32 points against quantized kd-trees with 16-bit and 8-bit codes made from
+// the latter, in 2D and 3D: bytes per point of the index and of the exact coordinates the quantized trees refine
+// from (the flat tree with leaves of 32 points, shared by both and read only for the points that pass the filter),
+// build time, knn throughput on one and on all threads with the queries in Hilbert order, exact distance
+// computations per knn query, radius_count throughput, and whether all results equal those of the flat tree with
+// leaves of 16 points.
+int main( int argc, char *argv[] ){
+    size_t numData = argc > 1 ? std::atof(argv[1]) : 4e6;
+    size_t k       = argc > 2 ? std::atoi(argv[2]) : 8;
+    int    threads = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+
+    std::vector<std::string> rows;
+    run<2>( numData, k, threads, rows );
+    run<3>( numData, k, threads, rows );
+
+    std::cout << "k = " << k << ", radius 0.5, " << threads << " threads" << std::endl;
+    std::cout << std::setw(12) << "tree" << std::setw(14) << "index [B/pt]" << std::setw(14) << "exact [B/pt]" << std::setw(12) << "build [s]"
+              << std::setw(16) << "knn 1 thr [q/s]" << std::setw(16) << "knn [q/s]" << std::setw(14) << "points/query"
+              << std::setw(16) << "radius [q/s]" << std::setw(8) << "same" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+// every search of this program is recorded in the query profiles.
+#define KDTREE_QUERY_STATS 1
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "batch_search.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_query_stats [num_points=1e6] [num_queries=1e5] [output=query_stats.json] [threads=0 (all)]
+// Query profile of the node_t kd-tree built from normal points: ann_search, nn_search, knn_query (k = 8, also
+// batched on all threads through knn_batch), approx_knn_query (epsilon = 0.5), radius_count (radius 0.5) and
+// box_count (side 1) for queries of the same distribution. The histograms of nodes, leaves, distance
+// evaluations, pruned subtrees, backtracks and time per query are printed and written to the output as JSON.
+int main( int argc, char *argv[] ){
+    size_t      numData    = argc > 1 ? std::atof(argv[1]) : 1e6;
+    size_t      numQueries = argc > 2 ? std::atof(argv[2]) : 1e5;
+    std::string output     = argc > 3 ? argv[3] : "query_stats.json";
+    int         threads    = resolve_num_threads( argc > 4 ? std::atoi(argv[4]) : 0 );
+
+    std::vector<std::array<dtype,dim>> data, queries;
+    generate_points<dtype,dim>( normal_points<dtype,dim>( counter_rng(1), 0, 10, 2 ), numData, data );
+    generate_points<dtype,dim>( normal_points<dtype,dim>( counter_rng(2), 0, 10, 2 ), numQueries, queries );
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+
+    timer t;
+    std::vector<neighbor<dtype>> result;
+    result.reserve(8);
+    for( std::array<dtype,dim> const& q : queries ){
+        int nDepths = 0;
+        search_stats stats;
+        ann_search<dtype,dim>( root, q, nDepths, stats );
+        nn_search<dtype,dim>( root, q, stats );
+        knn_query<dtype,dim>( root, q, 8, result, stats );
+        approx_knn_query<dtype,dim>( root, q, 8, result, dtype(0.5), std::numeric_limits<size_t>::max(), stats );
+        radius_count<dtype,dim>( root, q, dtype(0.5) );
+        std::array<dtype,dim> lo = q, hi = q;
+        for( int d(0); d < dim; ++d ){
+            lo[d] -= dtype(0.5);
+            hi[d] += dtype(0.5);
+        }
+        box_count<dtype,dim>( root, lo, hi );
+    }
+    knn_batch<dtype,dim>( root, queries, 8, threads );
+    double seconds = t.seconds();
+
+    query_profile profile = collect_query_profile();
+    std::cout << std::endl << numData << " points, " << numQueries << " queries of every kind (" << seconds << " s), "
+              << threads << " threads for knn_batch" << std::endl;
+    profile.print( std::cout );
+
+    std::ofstream json(output);
+    profile.write_json( json );
+    if( !json )
+        throw std::runtime_error("could not write " + output);
+    std::cout << "profile written to " << output << std::endl;
+
+    destroy_kdtree(root);
+    return EXIT_SUCCESS;
+}
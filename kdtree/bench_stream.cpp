@@ -0,0 +1,80 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "bench_utils.hpp"
+#include "kdtree_stream.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// usage: ./bench_stream [num_points=2e7] [path=kdtree_stream] [leaf_size=16]
+// Writes a random point file chunk by chunk (it is never held in memory) and builds the tree file from it with
+// build_flat_kdtree_file under increasing memory budgets. The peak RSS of the process is monotonic, so each row
+// shows the peak reached up to and including that build. Trees built with different budgets must be identical,
+// which the checksums in their headers show.
+int main( int argc, char *argv[] ){
+    size_t      numData  = argc > 1 ? std::atof(argv[1]) : 2e7;
+    std::string path     = argc > 2 ? argv[2] : "kdtree_stream";
+    size_t      leafSize = argc > 3 ? std::atoi(argv[3]) : 16;
+
+    std::string pointsPath = path + ".points";
+    std::string treePath   = path + ".tree";
+
+    {
+        std::FILE * file = std::fopen(pointsPath.c_str(), "wb");
+        if( !file ){
+            std::cerr << "cannot create " << pointsPath << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<dtype> uniform(0, 1);
+        std::vector<std::array<dtype,dim>> chunk(1 << 16);
+        for( size_t begin(0); begin < numData; begin += chunk.size() ){
+            size_t count = std::min(chunk.size(), numData - begin);
+            for( size_t i(0); i < count; ++i )
+                for( int d(0); d < dim; ++d )
+                    chunk[i][d] = uniform(rng);
+            std::fwrite(chunk.data(), sizeof(chunk[0]), count, file);
+        }
+        std::fclose(file);
+    }
+
+    double pointsMiB = numData * sizeof(std::array<dtype,dim>) / 1048576.0;
+    std::cout << numData << " points, " << pointsMiB << " MiB of coordinates, peak RSS before the builds "
+              << peak_rss_mib() << " MiB" << std::endl;
+    std::cout << std::setw(12) << "budget [MiB]" << std::setw(12) << "time [s]" << std::setw(14) << "read [MiB]"
+              << std::setw(14) << "written [MiB]" << std::setw(12) << "external" << std::setw(15) << "buffers [MiB]"
+              << std::setw(16) << "peak RSS [MiB]" << std::setw(20) << "checksum" << std::endl;
+
+    for( size_t budget : { size_t(4) << 20, size_t(16) << 20, size_t(64) << 20, size_t(4) << 30 } ){
+        stream_build_params params;
+        params.m_memory_budget = budget;
+        params.m_leaf_size = leafSize;
+        stream_build_stats stats = build_flat_kdtree_file<dtype,dim>( pointsPath, treePath, params );
+        double rss = peak_rss_mib();
+
+        // only the header is read: mapping the tree would add its pages to the RSS.
+        kdtree_file_header header;
+        std::FILE * file = std::fopen(treePath.c_str(), "rb");
+        if( !file || std::fread(&header, sizeof(header), 1, file) != 1 ){
+            std::cerr << "cannot read " << treePath << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::fclose(file);
+
+        std::cout << std::setw(12) << ( budget >> 20 ) << std::setw(12) << stats.m_seconds
+                  << std::setw(14) << stats.m_bytes_read / 1048576.0 << std::setw(14) << stats.m_bytes_written / 1048576.0
+                  << std::setw(12) << stats.m_external_splits << std::setw(15) << stats.m_peak_memory / 1048576.0
+                  << std::setw(16) << rss << std::setw(20) << std::hex << header.m_checksum << std::dec
+                  << std::endl;
+    }
+
+    std::remove(pointsPath.c_str());
+    std::remove(treePath.c_str());
+
+    return EXIT_SUCCESS;
+}
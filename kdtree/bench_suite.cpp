@@ -0,0 +1,346 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <ctime>
+#include <cmath>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "flat_kdtree.hpp"
+#include "quantized_kdtree.hpp"
+#include "grid_index.hpp"
+#include "kdforest.hpp"
+#include "batch_search.hpp"
+#include "knn_search.hpp"
+
+using dtype = float;
+
+constexpr size_t suite_queries = 1000;
+constexpr size_t suite_k       = 10;
+
+/**
+ * @brief A kd-forest searched with a fixed budget of distance computations, so that knn_batch and the latency
+ * loop query it like the exact indexes.
+ */
+template<typename T, int N>
+struct budgeted_forest {
+    kdforest<T,N> m_forest;
+    size_t        m_max_checks;
+};
+
+template<typename T, int N>
+void knn_query( budgeted_forest<T,N> const& index, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    search_stats & stats, euclidean_metric<T,N> const& = euclidean_metric<T,N>() ){
+    static thread_local kdforest_search_context<T,N> context;
+    knn_query<T,N>(index.m_forest, queryPoint, k, result, index.m_max_checks, context, stats);
+}
+
+template<typename T, int N>
+void knn_query( budgeted_forest<T,N> const& index, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result ){
+    search_stats stats;
+    knn_query<T,N>(index, queryPoint, k, result, stats);
+}
+
+// the dataset and the queries of one case, with the exact neighbours of the queries as ground truth.
+template<int N>
+struct suite_case {
+    std::string                        m_distribution;
+    std::vector<std::array<dtype,N>>   m_data;
+    std::vector<std::array<dtype,N>>   m_queries;
+    knn_batch_result<dtype>            m_truth;
+    dtype                              m_radius = 0;
+};
+
+// JSON value of a measurement; not measured or not finite is null.
+std::string json_number( double value ){
+    if( !std::isfinite(value) )
+        return "null";
+    std::ostringstream o;
+    o << std::setprecision(6) << value;
+    return o.str();
+}
+
+// JSON string literal of text: quotes, backslashes and control characters are escaped.
+std::string json_string( std::string const& text ){
+    std::ostringstream o;
+    o << '"';
+    for( unsigned char c : text ){
+        if( c == '"' || c == '\\' )
+            o << '\\' << c;
+        else if( c < 0x20 )
+            o << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+        else
+            o << c;
+    }
+    o << '"';
+    return o.str();
+}
+
+double percentile( std::vector<double> sorted, double p ){
+    if( sorted.empty() )
+        return NAN;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[ std::min( sorted.size() - 1, static_cast<size_t>( p * sorted.size() ) ) ];
+}
+
+// measurements of one index on one case; NAN where an index does not support a query type.
+struct suite_result {
+    std::string m_index;
+    double      m_build_seconds  = NAN;
+    double      m_build_peak_mib = NAN;
+    double      m_index_mib      = NAN;
+    double      m_knn_qps        = NAN;
+    double      m_radius_qps     = NAN;
+    double      m_radius_points  = NAN;
+    double      m_recall         = NAN;
+    std::vector<double> m_latencies;
+};
+
+// fraction of the k nearest neighbours found, where a neighbour at the distance of the k-th true one counts as found.
+template<int N>
+double recall( suite_case<N> const& c, size_t query, std::vector<neighbor<dtype>> const& result, size_t k ){
+    size_t hits = 0;
+    dtype kth = c.m_truth.getDistance(query, k - 1);
+    for( size_t j(0); j < std::min(result.size(), k); ++j )
+        hits += result[j].m_distance <= kth;
+    return double(hits) / k;
+}
+
+// radius_count queries per second on one thread and the mean count; the kd-forest has no radius queries.
+template<int N, typename Index>
+void radius_throughput( Index const& index, suite_case<N> const& c, suite_result & r ){
+    timer t;
+    size_t total = 0;
+    for( std::array<dtype,N> const& q : c.m_queries )
+        total += radius_count<dtype,N>(index, q, c.m_radius);
+    r.m_radius_qps = c.m_queries.size() / t.seconds();
+    r.m_radius_points = double(total) / c.m_queries.size();
+}
+
+template<int N>
+void radius_throughput( budgeted_forest<dtype,N> const&, suite_case<N> const&, suite_result & ){}
+
+// the build of one index, its peak and retained memory, and the kNN latency, kNN and radius throughput and recall
+// of the queries. Single-query latencies and radius_count run on one thread, knn_batch on all of them.
+template<int N, typename Build>
+suite_result measure_index( std::string const& name, suite_case<N> const& c, Build build, int threads ){
+    suite_result r;
+    r.m_index = name;
+
+    bool resetPeak = reset_peak_rss();
+    double before = current_rss_mib();
+    timer t;
+    auto index = build();
+    r.m_build_seconds = t.seconds();
+    double after = current_rss_mib();
+    r.m_build_peak_mib = resetPeak ? std::max( 0.0, peak_rss_mib() - before ) : NAN;
+    r.m_index_mib = std::max( 0.0, after - before );
+
+    std::vector<neighbor<dtype>> result;
+    result.reserve(suite_k);
+    double recallSum = 0;
+    for( size_t q(0); q < c.m_queries.size(); ++q ){
+        t.reset();
+        knn_query<dtype,N>(index, c.m_queries[q], suite_k, result);
+        r.m_latencies.push_back( t.seconds() );
+        recallSum += recall<N>(c, q, result, suite_k);
+    }
+    r.m_recall = recallSum / c.m_queries.size();
+    r.m_knn_qps = knn_batch<dtype,N>(index, c.m_queries, suite_k, threads).queries_per_second();
+
+    radius_throughput<N>( index, c, r );
+    return r;
+}
+
+// ann_search on a node_t tree: the latency and how often the greedy descent finds the nearest neighbour.
+template<int N>
+suite_result measure_ann( suite_case<N> const& c, node_t<dtype,N> * root ){
+    suite_result r;
+    r.m_index = "kdtree_ann_search";
+    double hits = 0;
+    for( size_t q(0); q < c.m_queries.size(); ++q ){
+        int nDepths = 0;
+        timer t;
+        key<dtype,N> nearest = ann_search<dtype,N>(root, c.m_queries[q], nDepths);
+        r.m_latencies.push_back( t.seconds() );
+        hits += std::sqrt( squared_distance<dtype,N>(nearest.m_value, c.m_queries[q]) ) <= c.m_truth.getDistance(q, 0);
+    }
+    r.m_recall = hits / c.m_queries.size();
+    return r;
+}
+
+// brute force as the baseline: single-query knn_search and the tiled knn_brute_force on all threads.
+template<int N>
+suite_result measure_brute_force( suite_case<N> const& c, int threads ){
+    suite_result r;
+    r.m_index = "brute_force";
+    r.m_build_seconds = 0;
+    for( size_t q(0); q < c.m_queries.size(); ++q ){
+        timer t;
+        knn_search<dtype,N>(c.m_queries[q], suite_k, c.m_data);
+        r.m_latencies.push_back( t.seconds() );
+    }
+    r.m_recall = 1;
+    r.m_knn_qps = knn_brute_force<dtype,N>(c.m_data, c.m_queries, suite_k, threads).queries_per_second();
+    return r;
+}
+
+template<int N>
+std::string json_record( suite_case<N> const& c, suite_result const& r ){
+    std::ostringstream o;
+    o << "    {\"index\": " << json_string(r.m_index) << ", \"distribution\": " << json_string(c.m_distribution) << ", \"dim\": " << N
+      << ", \"points\": " << c.m_data.size() << ", \"queries\": " << c.m_queries.size() << ", \"k\": " << suite_k
+      << ", \"radius\": " << json_number(c.m_radius)
+      << ", \"build_seconds\": " << json_number(r.m_build_seconds)
+      << ", \"build_peak_mib\": " << json_number(r.m_build_peak_mib)
+      << ", \"index_mib\": " << json_number(r.m_index_mib)
+      << ", \"knn_latency_us\": {\"p50\": " << json_number(percentile(r.m_latencies, 0.5) * 1e6)
+      << ", \"p90\": " << json_number(percentile(r.m_latencies, 0.9) * 1e6)
+      << ", \"p99\": " << json_number(percentile(r.m_latencies, 0.99) * 1e6)
+      << ", \"max\": " << json_number(percentile(r.m_latencies, 1.0) * 1e6) << "}"
+      << ", \"knn_qps\": " << json_number(r.m_knn_qps)
+      << ", \"radius_qps\": " << json_number(r.m_radius_qps)
+      << ", \"radius_points\": " << json_number(r.m_radius_points)
+      << ", \"recall\": " << json_number(r.m_recall) << "}";
+    return o.str();
+}
+
+// the datasets of every distribution with numData points, generated with fixed seeds so that every run and every
+// version of the code measures the same points.
+template<int N>
+std::vector<suite_case<N>> make_cases( size_t numData, int threads ){
+    std::array<dtype,N> lo, hi;
+    lo.fill(-30);
+    hi.fill(30);
+    std::vector<suite_case<N>> cases(4);
+
+    cases[0].m_distribution = "uniform";
+    generate_points<dtype,N>( uniform_points<dtype,N>{ counter_rng(1), lo, hi }, numData, cases[0].m_data, threads );
+    generate_points<dtype,N>( uniform_points<dtype,N>{ counter_rng(2), lo, hi }, suite_queries, cases[0].m_queries, threads );
+
+    cases[1].m_distribution = "normal";
+    generate_points<dtype,N>( normal_points<dtype,N>( counter_rng(3), 0, 10, 2 ), numData, cases[1].m_data, threads );
+    generate_points<dtype,N>( normal_points<dtype,N>( counter_rng(4), 0, 10, 2 ), suite_queries, cases[1].m_queries, threads );
+
+    cases[2].m_distribution = "clustered";
+    clustered_points<dtype,N> clusters = make_clustered_points<dtype,N>( 5, 32, lo, hi, 1 );
+    generate_points<dtype,N>( clusters, numData, cases[2].m_data, threads );
+    clusters.m_rng = counter_rng(6);
+    clusters.m_offsets = counter_rng(7);
+    generate_points<dtype,N>( clusters, suite_queries, cases[2].m_queries, threads );
+
+    // the largest grid with at most numData nodes and unit spacing, queried between its nodes.
+    cases[3].m_distribution = "grid";
+    size_t side = std::max<size_t>( 2, std::floor( std::pow( double(numData), 1.0 / N ) + 1e-9 ) );
+    std::array<size_t,N> counts;
+    std::array<dtype,N> spacing, origin, gridHi;
+    counts.fill(side);
+    spacing.fill(1);
+    origin.fill(0);
+    gridHi.fill( dtype(side - 1) );
+    generate_dense_grid<dtype,N>( cases[3].m_data, counts, spacing, origin, threads );
+    generate_points<dtype,N>( uniform_points<dtype,N>{ counter_rng(8), origin, gridHi }, suite_queries, cases[3].m_queries, threads );
+
+    // the radius queries find k points on average: the median distance of the k-th neighbour.
+    for( suite_case<N> & c : cases ){
+        c.m_truth = knn_brute_force<dtype,N>(c.m_data, c.m_queries, suite_k, threads);
+        std::vector<double> kth;
+        for( size_t q(0); q < c.m_queries.size(); ++q )
+            kth.push_back( c.m_truth.getDistance(q, suite_k - 1) );
+        c.m_radius = percentile(kth, 0.5);
+    }
+    return cases;
+}
+
+template<int N>
+void run( size_t maxPoints, int threads, std::vector<std::string> & records, std::vector<std::string> & rows ){
+    for( size_t numData(10000); numData <= maxPoints; numData *= 10 ){
+        for( suite_case<N> const& c : make_cases<N>( numData, threads ) ){
+            std::vector<suite_result> results;
+            if( c.m_data.size() <= 100000 )
+                results.push_back( measure_brute_force<N>( c, threads ) );
+
+            node_t<dtype,N> *root = nullptr;
+            results.push_back( measure_index<N>( "kdtree", c, [&](){ root = build_kdtree<dtype,N>( c.m_data );
+                return static_cast<node_t<dtype,N> const*>(root); }, threads ) );
+            results.push_back( measure_ann<N>( c, root ) );
+            destroy_kdtree(root);
+
+            results.push_back( measure_index<N>( "flat_kdtree", c, [&](){ return build_flat_kdtree<dtype,N>( c.m_data, 16, threads ); },
+                threads ) );
+            results.push_back( measure_index<N>( "quantized_kdtree", c, [&](){ return build_quantized_kdtree<dtype,N,uint16_t>( c.m_data, 32, threads ); },
+                threads ) );
+            if( N <= 3 )
+                results.push_back( measure_index<N>( "grid_index", c, [&](){ return build_grid_index<dtype,N>( c.m_data, 0, threads ); },
+                    threads ) );
+            results.push_back( measure_index<N>( "kdforest", c, [&](){
+                kdforest_params params;
+                params.m_num_threads = threads;
+                return budgeted_forest<dtype,N>{ build_kdforest<dtype,N>( c.m_data, params ), 32 * suite_k }; }, threads ) );
+
+            for( suite_result const& r : results ){
+                records.push_back( json_record<N>( c, r ) );
+                std::ostringstream row;
+                row << std::setw(20) << r.m_index << std::setw(12) << c.m_distribution << std::setw(5) << N
+                    << std::setw(10) << c.m_data.size() << std::setw(12) << r.m_build_seconds
+                    << std::setw(12) << percentile(r.m_latencies, 0.5) * 1e6 << std::setw(12) << percentile(r.m_latencies, 0.99) * 1e6
+                    << std::setw(14) << r.m_knn_qps << std::setw(14) << r.m_radius_qps << std::setw(10) << r.m_recall;
+                rows.push_back( row.str() );
+            }
+        }
+    }
+}
+
+// usage: ./bench_suite [output=bench_suite.json] [max_points=1e6] [threads=0 (all)] [label=""]
+// Benchmark suite of the spatial indexes: for 2, 3 and 8 dimensions, 1e4 points up to max_points in steps of ten
+// and uniform, normal (as generate_random), clustered and grid points, every index is built and queried with
+// 1000 queries of the same distribution for their 10 nearest neighbours and for the points within the median
+// distance of the 10th neighbour. The results go to the output file as JSON, one record per index and case:
+// build time, build peak and retained memory (resident set size, so allocator effects included), single-query
+// kNN latency percentiles, knn_batch queries per second on all threads, radius_count queries per second on one
+// thread and the recall of the 10 nearest neighbours (of the nearest one for ann_search). Measurements that do
+// not apply are null. The datasets use fixed seeds, so files of different versions of the code (tagged with
+// label, e.g. a git revision) can be compared record by record to track regressions.
+int main( int argc, char *argv[] ){
+    std::string output    = argc > 1 ? argv[1] : "bench_suite.json";
+    size_t      maxPoints = argc > 2 ? std::atof(argv[2]) : 1e6;
+    int         threads   = resolve_num_threads( argc > 3 ? std::atoi(argv[3]) : 0 );
+    std::string label     = argc > 4 ? argv[4] : "";
+
+    std::vector<std::string> records, rows;
+    run<2>( maxPoints, threads, records, rows );
+    run<3>( maxPoints, threads, records, rows );
+    run<8>( maxPoints, threads, records, rows );
+
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    const char * simd[] = { "scalar", "avx2", "avx512" };
+
+    std::ofstream json(output);
+    json << "{\n  \"suite\": \"kdtree\",\n  \"label\": " << json_string(label) << ",\n  \"date\": \"" << date << "\",\n"
+         << "  \"compiler\": " << json_string(__VERSION__) << ",\n  \"simd\": \"" << simd[ static_cast<int>( active_simd_level() ) ] << "\",\n"
+         << "  \"threads\": " << threads << ",\n  \"results\": [\n";
+    for( size_t i(0); i < records.size(); ++i )
+        json << records[i] << ( i + 1 < records.size() ? ",\n" : "\n" );
+    json << "  ]\n}\n";
+    if( !json ){
+        std::cerr << "could not write " << output << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << std::endl << std::setw(20) << "index" << std::setw(12) << "data" << std::setw(5) << "N"
+              << std::setw(10) << "points" << std::setw(12) << "build [s]" << std::setw(12) << "p50 [us]"
+              << std::setw(12) << "p99 [us]" << std::setw(14) << "knn [q/s]" << std::setw(14) << "radius [q/s]"
+              << std::setw(10) << "recall" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+    std::cout << records.size() << " records written to " << output << std::endl;
+
+    return EXIT_SUCCESS;
+}
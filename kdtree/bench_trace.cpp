@@ -0,0 +1,139 @@
+// the trace sinks of this program are only called with the hook compiled in.
+#define KDTREE_TRACE 1
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+#include "parallel.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+// ann_search over all queries split across threads; returns the queries per second and adds up the depths in total.
+double ann_throughput( node_t<dtype,dim> * root, std::vector<std::array<dtype,dim>> const& queries, int threads, size_t & total ){
+    std::vector<size_t> depths( threads, 0 );
+    timer t;
+    parallel_for_chunks( 0, queries.size(), threads, [&]( size_t chunk, size_t begin, size_t end ){
+        size_t sum = 0;
+        for( size_t i(begin); i < end; ++i ){
+            int nDepths = 0;
+            ann_search<dtype,dim>( root, queries[i], nDepths );
+            sum += nDepths;
+        }
+        depths[chunk] = sum;
+    });
+    double seconds = t.seconds();
+    total = 0;
+    for( size_t d : depths )
+        total += d;
+    return queries.size() / seconds;
+}
+
+// the output of depth_search before the hook: every leaf reached, printed to std::cout whatever verbose said.
+void print_leaves( trace_event const& event, void * ){
+    if( event.m_kind == trace_kind::leaf_reached )
+        print_trace_event( std::cout, event );
+}
+
+// points stdout at /dev/null while alive, so the std::cout sink pays for the locked stream without flooding the terminal.
+class silenced_stdout {
+    private:
+        int m_saved;
+
+    public:
+        silenced_stdout(){
+            std::cout.flush();
+            std::fflush(stdout);
+            m_saved = dup(STDOUT_FILENO);
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+
+        ~silenced_stdout(){
+            std::cout.flush();
+            std::fflush(stdout);
+            dup2(m_saved, STDOUT_FILENO);
+            close(m_saved);
+        }
+};
+
+// usage: ./bench_trace [num_points=1e6] [num_queries=2e5] [max_threads=0 (all, at least 4)]
+// Multithreaded ann_search throughput on 1, 2, 4, ... threads with the leaves reached printed to std::cout as
+// before the tracing hook (stdout sent to /dev/null), without a trace sink, and with all events (descents and
+// leaves) captured in the per-thread ring buffers. Builds without KDTREE_TRACE, the default, have no hook at all.
+int main( int argc, char *argv[] ){
+    size_t numData    = argc > 1 ? std::atof(argv[1]) : 1e6;
+    size_t numQueries = argc > 2 ? std::atof(argv[2]) : 2e5;
+    int    maxThreads = argc > 3 ? std::atoi(argv[3]) : 0;
+    if( maxThreads < 1 )
+        maxThreads = std::max( 4, resolve_num_threads(0) );
+
+    std::array<dtype,dim> lo, hi;
+    lo.fill(0);
+    hi.fill(100);
+    std::vector<std::array<dtype,dim>> data, queries;
+    generate_points<dtype,dim>( uniform_points<dtype,dim>{ counter_rng(1), lo, hi }, numData, data );
+    generate_points<dtype,dim>( uniform_points<dtype,dim>{ counter_rng(2), lo, hi }, numQueries, queries );
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+
+    std::vector<int> threadCounts;
+    for( int t(1); t < maxThreads; t *= 2 )
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    std::vector<std::string> rows;
+    double base[3] = { 0, 0, 0 };
+    size_t reference = 0;
+    for( int threads : threadCounts ){
+        size_t total[3];
+        double qps[3];
+        {
+            silenced_stdout silenced;
+            set_trace_sink( print_leaves );
+            qps[0] = ann_throughput( root, queries, threads, total[0] );
+        }
+        set_trace_sink( nullptr );
+        qps[1] = ann_throughput( root, queries, threads, total[1] );
+        set_trace_sink( trace_to_thread_buffer );
+        qps[2] = ann_throughput( root, queries, threads, total[2] );
+        set_trace_sink( nullptr );
+
+        if( threads == 1 ){
+            reference = total[1];
+            for( int m(0); m < 3; ++m )
+                base[m] = qps[m];
+        }
+        for( int m(0); m < 3; ++m )
+            if( total[m] != reference )
+                throw std::runtime_error("the searches differ between the trace modes");
+
+        std::ostringstream row;
+        row << std::setw(8) << threads;
+        for( int m(0); m < 3; ++m )
+            row << std::setw(14) << std::setprecision(4) << qps[m] << std::setw(10) << std::setprecision(3) << qps[m] / base[m];
+        rows.push_back( row.str() );
+    }
+
+    std::cout << numData << " points, " << numQueries << " ann_search queries, " << resolve_num_threads(0)
+              << " hardware threads; speedup over 1 thread after every throughput" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "cout [q/s]" << std::setw(10) << "speedup"
+              << std::setw(14) << "none [q/s]" << std::setw(10) << "speedup"
+              << std::setw(14) << "ring [q/s]" << std::setw(10) << "speedup" << std::endl;
+    for( std::string const& row : rows )
+        std::cout << row << std::endl;
+    std::cout << "events held by the ring buffer of the main thread: " << thread_trace_buffer().events().size()
+              << " of " << thread_trace_buffer().pushed() << std::endl;
+
+    destroy_kdtree(root);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+
+#include "bench_utils.hpp"
+#include "generate.hpp"
+#include "kdtree.hpp"
+
+using dtype = float;
+constexpr int dim = 2;
+
+struct latency {
+    std::vector<double> m_samples;
+
+    double mean() const {
+        double sum = 0;
+        for( double s : m_samples )
+            sum += s;
+        return m_samples.empty() ? 0 : sum / m_samples.size();
+    }
+
+    double percentile( double p ){
+        if( m_samples.empty() )
+            return 0;
+        size_t i = std::min( m_samples.size() - 1, static_cast<size_t>( p * m_samples.size() ) );
+        std::nth_element( m_samples.begin(), m_samples.begin() + i, m_samples.end() );
+        return m_samples[i];
+    }
+};
+
+/**
+ * @brief Runs numOps operations on a tree built from numData random points: a fraction updateRatio of them are
+ * updates (half inserts of new points, half removals of random live points), the rest kNN queries.
+ */
+void run_workload( size_t numData, size_t numOps, size_t k, double updateRatio ){
+    std::vector<std::array<dtype,dim>> data;
+    generate_random<dtype,dim>(numData, data);
+
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+
+    std::vector<key<dtype,dim>> live(numData);
+    for( size_t i(0); i < numData; ++i ){
+        live[i].m_id = i;
+        live[i].m_value = data[i];
+    }
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<dtype> coordinate(0, 1);
+    std::uniform_real_distribution<double> coin(0, 1);
+    size_t nextID = numData;
+
+    latency queries, updates;
+    std::vector<neighbor<dtype>> result;
+    result.reserve(k);
+    timer t;
+    for( size_t op(0); op < numOps; ++op ){
+        bool update = coin(gen) < updateRatio;
+        bool insert = coin(gen) < 0.5 || live.empty();
+
+        key<dtype,dim> e;
+        std::array<dtype,dim> q;
+        size_t victim = 0;
+        if( update && insert ){
+            e.m_id = nextID++;
+            for( int d(0); d < dim; ++d )
+                e.m_value[d] = coordinate(gen);
+        } else if( update ){
+            victim = gen() % live.size();
+            e = live[victim];
+        } else {
+            for( int d(0); d < dim; ++d )
+                q[d] = coordinate(gen);
+        }
+
+        t.reset();
+        if( update && insert )
+            root = insert_into_kdtree( root, e );
+        else if( update )
+            remove_from_kdtree( root, e );
+        else
+            knn_query<dtype,dim>( root, q, k, result );
+        double seconds = t.seconds();
+
+        if( update ){
+            updates.m_samples.push_back( seconds );
+            if( insert )
+                live.push_back( e );
+            else {
+                live[victim] = live.back();
+                live.pop_back();
+            }
+        } else
+            queries.m_samples.push_back( seconds );
+    }
+    destroy_kdtree(root);
+
+    std::cout << std::setw(10) << updateRatio * 100 << "%"
+              << std::setw(16) << queries.mean() * 1e6 << std::setw(16) << queries.percentile(0.99) * 1e6
+              << std::setw(16) << updates.mean() * 1e6 << std::setw(16) << updates.percentile(0.99) * 1e6
+              << std::setw(16) << updates.percentile(1.0) * 1e6 << std::endl;
+}
+
+// usage: ./bench_update [num_points=1e5] [num_ops=1e5] [k=8]
+// Mixed workloads of kNN queries and updates (inserts and lazy removals) on a tree from build_kdtree, compared
+// with a static query-only workload and with the time of rebuilding the tree from scratch.
+int main( int argc, char *argv[] ){
+    size_t numData = argc > 1 ? std::atof(argv[1]) : 1e5;
+    size_t numOps  = argc > 2 ? std::atof(argv[2]) : 1e5;
+    size_t k       = argc > 3 ? std::atoi(argv[3]) : 8;
+
+    std::vector<std::array<dtype,dim>> data;
+    generate_random<dtype,dim>(numData, data);
+    timer t;
+    node_t<dtype,dim> *root = build_kdtree<dtype,dim>( data );
+    double build = t.seconds();
+    destroy_kdtree(root);
+
+    std::cout << std::endl << numData << " points, " << numOps << " operations, k = " << k
+              << ", full rebuild takes " << build * 1e6 << " us" << std::endl;
+    std::cout << std::setw(11) << "updates" << std::setw(16) << "query [us]" << std::setw(16) << "query p99"
+              << std::setw(16) << "update [us]" << std::setw(16) << "update p99" << std::setw(16) << "update max"
+              << std::endl;
+
+    run_workload( numData, numOps, k, 0.0 );
+    run_workload( numData, numOps, k, 0.1 );
+    run_workload( numData, numOps, k, 0.5 );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "timer.hpp"
+
+// current resident set size of the process, in MiB.
+inline double current_rss_mib(){
+    long pages = 0, resident = 0;
+    std::FILE * statm = std::fopen("/proc/self/statm", "r");
+    if( statm ){
+        if( std::fscanf(statm, "%ld %ld", &pages, &resident) != 2 )
+            resident = 0;
+        std::fclose(statm);
+    }
+    return resident * ( sysconf(_SC_PAGESIZE) / 1048576.0 );
+}
+
+// peak resident set size of the process since its start or the last reset_peak_rss, in MiB.
+inline double peak_rss_mib(){
+    long peak = -1;
+    std::FILE * status = std::fopen("/proc/self/status", "r");
+    if( status ){
+        char line[256];
+        while( std::fgets(line, sizeof(line), status) )
+            if( std::strncmp(line, "VmHWM:", 6) == 0 && std::sscanf(line + 6, "%ld", &peak) != 1 )
+                peak = -1;
+        std::fclose(status);
+    }
+    if( peak < 0 ){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+    return peak / 1024.0;
+}
+
+// lowers the peak resident set size to the current one (Linux 4.0 and later), so that peak_rss_mib measures the
+// peak of what follows; false where it cannot be reset and the peak remains the one of the whole process.
+inline bool reset_peak_rss(){
+    std::FILE * refs = std::fopen("/proc/self/clear_refs", "w");
+    if( !refs )
+        return false;
+    bool written = std::fputs("5", refs) >= 0;
+    return std::fclose(refs) == 0 && written;
+}
+
+/**
+ * @brief Hardware cache misses of the calling thread and of the threads it starts while counting, read from the
+ * Linux perf events. available() is false where the counter cannot be opened (other systems, virtual machines
+ * without a PMU, perf_event_paranoid too strict), and the benchmarks then report no misses.
+ */
+class cache_miss_counter {
+    private:
+        int m_fd = -1;
+
+    public:
+        cache_miss_counter(){
+#ifdef __linux__
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fd = static_cast<int>( syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0) );
+#endif
+        }
+
+        ~cache_miss_counter(){
+#ifdef __linux__
+            if( m_fd >= 0 )
+                close(m_fd);
+#endif
+        }
+
+        cache_miss_counter( cache_miss_counter const& ) = delete;
+        cache_miss_counter & operator=( cache_miss_counter const& ) = delete;
+
+        bool available() const { return m_fd >= 0; }
+
+        void start(){
+#ifdef __linux__
+            if( m_fd >= 0 ){
+                ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        // misses since start().
+        uint64_t stop(){
+            uint64_t count = 0;
+#ifdef __linux__
+            if( m_fd >= 0 ){
+                ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+                if( read(m_fd, &count, sizeof(count)) != sizeof(count) )
+                    count = 0;
+            }
+#endif
+            return count;
+        }
+};
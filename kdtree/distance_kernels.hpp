@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && ( defined(__GNUC__) || defined(__clang__) )
+    #define KDTREE_X86_SIMD 1
+    #include <immintrin.h>
+#else
+    #define KDTREE_X86_SIMD 0
+#endif
+
+/**
+ * @brief Instruction sets the distance kernels can run on; the best one supported by the CPU is selected at
+ * runtime, so the same binary runs everywhere.
+ */
+enum class simd_level { scalar = 0, avx2 = 1, avx512 = 2 };
+
+inline simd_level detect_simd_level(){
+#if KDTREE_X86_SIMD
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx512f") )
+        return simd_level::avx512;
+    if( __builtin_cpu_supports("avx2") )
+        return simd_level::avx2;
+#endif
+    return simd_level::scalar;
+}
+
+inline simd_level active_simd_level(){
+    static const simd_level level = detect_simd_level();
+    return level;
+}
+
+inline char const* simd_level_name( simd_level level ){
+    switch( level ){
+        case simd_level::avx512: return "avx512";
+        case simd_level::avx2:   return "avx2";
+        default:                 return "scalar";
+    }
+}
+
+/**
+ * @brief Squared distances between the query point q and a block of count points stored in structure-of-arrays
+ * form: coords[dim][i] is coordinate dim of point i. The results are written to out[0..count).
+ *
+ * All kernels add up the squared differences in the order of the dimensions and without fused multiply-adds, so
+ * the scalar and the SIMD kernels return bitwise identical distances and search results do not depend on the CPU.
+ * This requires compiling with -ffp-contract=off (see the Makefile), otherwise the compiler may fuse the
+ * multiply and add of the AVX-512 kernels.
+ */
+template<typename T, int N>
+void squared_distances_scalar( std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out ){
+    for( size_t i(0); i < count; ++i )
+        out[i] = 0;
+    for( int dim(0); dim < N; ++dim ){
+        T const* c = coords[dim];
+        T qd = q[dim];
+        for( size_t i(0); i < count; ++i ){
+            T diff = c[i] - qd;
+            out[i] += diff * diff;
+        }
+    }
+}
+
+#if KDTREE_X86_SIMD
+
+template<int N>
+__attribute__((target("avx2")))
+void squared_distances_avx2( std::array<float const*,N> const& coords, size_t count, std::array<float,N> const& q, float *out ){
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ){
+        __m256 acc = _mm256_setzero_ps();
+        for( int dim(0); dim < N; ++dim ){
+            __m256 diff = _mm256_sub_ps( _mm256_loadu_ps(coords[dim] + i), _mm256_set1_ps(q[dim]) );
+            acc = _mm256_add_ps( acc, _mm256_mul_ps(diff, diff) );
+        }
+        _mm256_storeu_ps(out + i, acc);
+    }
+    std::array<float const*,N> tail;
+    for( int dim(0); dim < N; ++dim )
+        tail[dim] = coords[dim] + i;
+    squared_distances_scalar<float,N>(tail, count - i, q, out + i);
+}
+
+template<int N>
+__attribute__((target("avx2")))
+void squared_distances_avx2( std::array<double const*,N> const& coords, size_t count, std::array<double,N> const& q, double *out ){
+    size_t i = 0;
+    for( ; i + 4 <= count; i += 4 ){
+        __m256d acc = _mm256_setzero_pd();
+        for( int dim(0); dim < N; ++dim ){
+            __m256d diff = _mm256_sub_pd( _mm256_loadu_pd(coords[dim] + i), _mm256_set1_pd(q[dim]) );
+            acc = _mm256_add_pd( acc, _mm256_mul_pd(diff, diff) );
+        }
+        _mm256_storeu_pd(out + i, acc);
+    }
+    std::array<double const*,N> tail;
+    for( int dim(0); dim < N; ++dim )
+        tail[dim] = coords[dim] + i;
+    squared_distances_scalar<double,N>(tail, count - i, q, out + i);
+}
+
+template<int N>
+__attribute__((target("avx512f")))
+void squared_distances_avx512( std::array<float const*,N> const& coords, size_t count, std::array<float,N> const& q, float *out ){
+    size_t i = 0;
+    for( ; i + 16 <= count; i += 16 ){
+        __m512 acc = _mm512_setzero_ps();
+        for( int dim(0); dim < N; ++dim ){
+            __m512 diff = _mm512_sub_ps( _mm512_loadu_ps(coords[dim] + i), _mm512_set1_ps(q[dim]) );
+            acc = _mm512_add_ps( acc, _mm512_mul_ps(diff, diff) );
+        }
+        _mm512_storeu_ps(out + i, acc);
+    }
+    std::array<float const*,N> tail;
+    for( int dim(0); dim < N; ++dim )
+        tail[dim] = coords[dim] + i;
+    squared_distances_scalar<float,N>(tail, count - i, q, out + i);
+}
+
+template<int N>
+__attribute__((target("avx512f")))
+void squared_distances_avx512( std::array<double const*,N> const& coords, size_t count, std::array<double,N> const& q, double *out ){
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ){
+        __m512d acc = _mm512_setzero_pd();
+        for( int dim(0); dim < N; ++dim ){
+            __m512d diff = _mm512_sub_pd( _mm512_loadu_pd(coords[dim] + i), _mm512_set1_pd(q[dim]) );
+            acc = _mm512_add_pd( acc, _mm512_mul_pd(diff, diff) );
+        }
+        _mm512_storeu_pd(out + i, acc);
+    }
+    std::array<double const*,N> tail;
+    for( int dim(0); dim < N; ++dim )
+        tail[dim] = coords[dim] + i;
+    squared_distances_scalar<double,N>(tail, count - i, q, out + i);
+}
+
+#endif
+
+/**
+ * @brief Dispatches to the best kernel for the given level. Types other than float and double always use the
+ * scalar kernel.
+ */
+template<typename T, int N>
+struct squared_distances_dispatch {
+    static void run( simd_level, std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out ){
+        squared_distances_scalar<T,N>(coords, count, q, out);
+    }
+};
+
+#if KDTREE_X86_SIMD
+
+template<int N>
+struct squared_distances_dispatch<float,N> {
+    static void run( simd_level level, std::array<float const*,N> const& coords, size_t count, std::array<float,N> const& q, float *out ){
+        if( level == simd_level::avx512 )    squared_distances_avx512<N>(coords, count, q, out);
+        else if( level == simd_level::avx2 ) squared_distances_avx2<N>(coords, count, q, out);
+        else                                 squared_distances_scalar<float,N>(coords, count, q, out);
+    }
+};
+
+template<int N>
+struct squared_distances_dispatch<double,N> {
+    static void run( simd_level level, std::array<double const*,N> const& coords, size_t count, std::array<double,N> const& q, double *out ){
+        if( level == simd_level::avx512 )    squared_distances_avx512<N>(coords, count, q, out);
+        else if( level == simd_level::avx2 ) squared_distances_avx2<N>(coords, count, q, out);
+        else                                 squared_distances_scalar<double,N>(coords, count, q, out);
+    }
+};
+
+#endif
+
+template<typename T, int N>
+void squared_distances( std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out,
+    simd_level level = active_simd_level() ){
+    squared_distances_dispatch<T,N>::run(level, coords, count, q, out);
+}
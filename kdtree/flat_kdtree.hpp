@@ -0,0 +1,769 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <array>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include "kdtree.hpp"
+#include "distance_kernels.hpp"
+#include "parallel.hpp"
+
+/**
+ * @brief A node of the flat kd-tree. All nodes live in one contiguous array and reference their children by
+ * index instead of by pointer. Every node covers the range [m_begin, m_end) of the permuted points of the tree,
+ * therefore the points of a leaf (its bucket) are stored contiguously.
+ *
+ * @tparam T type of data.
+ */
+template<typename T>
+struct flat_node_t {
+    T      m_split_value;
+    int    m_split_dim;     // -1 for leaf nodes
+    size_t m_left;
+    size_t m_right;
+    size_t m_begin;
+    size_t m_end;
+
+    bool   isLeaf()   const { return m_split_dim < 0; }
+    size_t size()     const { return m_end - m_begin; }
+    size_t getLeft()  const { return m_left; }
+    size_t getRight() const { return m_right; }
+};
+
+/**
+ * @brief Pointer-free kd-tree. The nodes are stored in a single array (index-linked, the root is node 0) and
+ * the coordinates of the points in structure-of-arrays form, permuted such that each node covers a contiguous
+ * range of points. Leaves are buckets of up to m_leaf_size points. The id of each point is its index in the
+ * dataset the tree was built from, as in key<T,N>.
+ *
+ * The queries read the arrays through plain pointers, which either point to the vectors owned by the tree (a tree
+ * built in memory) or into a read-only memory mapping of a tree file that is kept alive by m_mapping (see
+ * kdtree_io.hpp). Copies of a mapped tree share the mapping.
+ *
+ * @tparam T type of data.
+ * @tparam N number of dimensions.
+ */
+template<typename T, int N>
+struct flat_kdtree {
+    using key_type  = key<T,N>;
+    using node_type = flat_node_t<T>;
+
+    std::vector<node_type>       m_nodes;
+    std::array<std::vector<T>,N> m_coords;
+    std::vector<size_t>          m_ids;
+    size_t                       m_leaf_size = 16;
+
+    node_type const*             m_node_data = nullptr;
+    std::array<T const*,N>       m_coord_data;
+    size_t const*                m_id_data = nullptr;
+    size_t                       m_num_nodes = 0;
+    size_t                       m_num_points = 0;
+    std::shared_ptr<void const>  m_mapping;
+
+    flat_kdtree(){ m_coord_data.fill(nullptr); }
+
+    flat_kdtree( flat_kdtree const& other ) : m_nodes(other.m_nodes), m_coords(other.m_coords), m_ids(other.m_ids),
+        m_leaf_size(other.m_leaf_size), m_node_data(other.m_node_data), m_coord_data(other.m_coord_data),
+        m_id_data(other.m_id_data), m_num_nodes(other.m_num_nodes), m_num_points(other.m_num_points),
+        m_mapping(other.m_mapping) {
+        if( !m_mapping )
+            attach();
+    }
+
+    flat_kdtree( flat_kdtree && other ) : flat_kdtree() { swap(other); }
+
+    flat_kdtree & operator=( flat_kdtree other ){
+        swap(other);
+        return *this;
+    }
+
+    // swapping the vectors keeps their buffers, so the pointers stay valid.
+    void swap( flat_kdtree & other ){
+        m_nodes.swap(other.m_nodes);
+        for( int dim(0); dim < N; ++dim )
+            m_coords[dim].swap(other.m_coords[dim]);
+        m_ids.swap(other.m_ids);
+        std::swap(m_leaf_size, other.m_leaf_size);
+        std::swap(m_node_data, other.m_node_data);
+        std::swap(m_coord_data, other.m_coord_data);
+        std::swap(m_id_data, other.m_id_data);
+        std::swap(m_num_nodes, other.m_num_nodes);
+        std::swap(m_num_points, other.m_num_points);
+        m_mapping.swap(other.m_mapping);
+    }
+
+    // points the arrays read by the queries to the vectors owned by the tree.
+    void attach(){
+        m_node_data = m_nodes.data();
+        for( int dim(0); dim < N; ++dim )
+            m_coord_data[dim] = m_coords[dim].data();
+        m_id_data = m_ids.data();
+        m_num_nodes = m_nodes.size();
+        m_num_points = m_ids.size();
+    }
+
+    bool   isMapped() const { return static_cast<bool>(m_mapping); }
+    size_t size()     const { return m_num_points; }
+    bool   empty()    const { return m_num_points == 0; }
+    size_t numNodes() const { return m_num_nodes; }
+
+    node_type const& getNode( size_t i )   const { return m_node_data[i]; }
+    T const*         getCoords( int dim )  const { return m_coord_data[dim]; }
+    T                getValue( size_t i, int dim ) const { return m_coord_data[dim][i]; }
+    size_t           getID( size_t i )     const { return m_id_data[i]; }
+    size_t const*    getIDs()              const { return m_id_data; }
+    node_type const* getNodes()            const { return m_node_data; }
+
+    // pointers to the coordinates of point i in every dimension, the input of the distance kernels.
+    std::array<T const*,N> getBlock( size_t i ) const {
+        std::array<T const*,N> block;
+        for( int dim(0); dim < N; ++dim )
+            block[dim] = m_coord_data[dim] + i;
+        return block;
+    }
+
+    key_type getKey( size_t i ) const {
+        key_type k;
+        k.m_id = m_id_data[i];
+        for( int dim(0); dim < N; ++dim )
+            k.m_value[dim] = m_coord_data[dim][i];
+        return k;
+    }
+
+    // heap memory owned by the tree; the pages of a mapped tree are shared and not included.
+    size_t memory_footprint() const {
+        return sizeof(*this) + m_nodes.capacity() * sizeof(node_type)
+            + N * m_ids.size() * sizeof(T) + m_ids.capacity() * sizeof(size_t);
+    }
+};
+
+/**
+ * @brief Builds a flat kd-tree from a random-access container of std::array<T,N> points. The points are never
+ * copied during the build: a single index array is partitioned in place, by selection, at the median of the
+ * dimension with the highest spread, and only at the end the coordinates are gathered in the permuted order.
+ *
+ * Points are ordered by (value in the split dim, id), which is a strict total order, so the set of points on each
+ * side of a split does not depend on how the median was selected and ties with the split value may end up on both
+ * sides: the left side holds values <= m_split_value and the right side values >= m_split_value. Leaf buckets are
+ * sorted by id. As a result the serial and the parallel build produce identical trees.
+ *
+ * The shape of the tree only depends on the number of points (the left child of a node with n points gets n/2
+ * points), so the index of every node is known before its subtree is built and independent subtrees can be built
+ * concurrently, each writing to its own slots of the node array.
+ */
+template<typename T, int N, typename Container>
+class flat_kdtree_builder {
+    private:
+        struct point_less {
+            Container const& m_data;
+            int              m_dim;
+            bool operator()( size_t a, size_t b ) const {
+                T va = m_data[a][m_dim];
+                T vb = m_data[b][m_dim];
+                return va < vb || ( va == vb && a < b );
+            }
+        };
+
+        Container const&         m_data;
+        flat_kdtree<T,N>       & m_tree;
+        std::vector<size_t>      m_perm;
+        std::vector<size_t>      m_buffer;
+        std::map<size_t,size_t>  m_num_nodes;
+        size_t                   m_parallel_cutoff = 1 << 15;
+
+        size_t count_nodes( size_t n ){
+            if( n <= m_tree.m_leaf_size )
+                return 1;
+            auto it = m_num_nodes.find(n);
+            if( it != m_num_nodes.end() )
+                return it->second;
+            size_t count = 1 + count_nodes(n / 2) + count_nodes(n - n / 2);
+            m_num_nodes[n] = count;
+            return count;
+        }
+
+        // read-only lookup, safe to call concurrently once count_nodes has been called for the root.
+        size_t num_nodes( size_t n ) const {
+            return n <= m_tree.m_leaf_size ? 1 : m_num_nodes.find(n)->second;
+        }
+
+        int find_dim_with_highest_spread( size_t begin, size_t end, int num_threads ) const {
+            size_t chunks = num_threads > 1 && end - begin > m_parallel_cutoff ? num_threads : 1;
+            std::vector<std::array<T,N>> min_value(chunks), max_value(chunks);
+
+            // each chunk computes the min/max of all dimensions in a single pass over its points.
+            parallel_for_chunks( begin, end, chunks, [&]( size_t c, size_t b, size_t e ){
+                min_value[c] = m_data[m_perm[b]];
+                max_value[c] = min_value[c];
+                for( size_t i(b+1); i < e; ++i ){
+                    std::array<T,N> const& value = m_data[m_perm[i]];
+                    for( int dim(0); dim < N; ++dim ){
+                        min_value[c][dim] = std::min(min_value[c][dim], value[dim]);
+                        max_value[c][dim] = std::max(max_value[c][dim], value[dim]);
+                    }
+                }
+            });
+
+            for( size_t c(1); c < chunks; ++c )
+                for( int dim(0); dim < N; ++dim ){
+                    min_value[0][dim] = std::min(min_value[0][dim], min_value[c][dim]);
+                    max_value[0][dim] = std::max(max_value[0][dim], max_value[c][dim]);
+                }
+
+            T max_spread = 0;
+            int max_dim = 0;
+            for( int dim(0); dim < N; ++dim )
+                if ( max_value[0][dim] - min_value[0][dim] > max_spread ){
+                    max_spread = max_value[0][dim] - min_value[0][dim];
+                    max_dim = dim;
+                }
+
+            return max_dim;
+        }
+
+        // places the nth point of perm[begin,end) in its sorted position with smaller points before it and larger
+        // points after it. Large ranges are narrowed with a parallel three-way partition around a sampled pivot.
+        void select( size_t begin, size_t nth, size_t end, int dim, int num_threads ){
+            point_less less = { m_data, dim };
+
+            while( num_threads > 1 && end - begin > m_parallel_cutoff ){
+                std::array<size_t,31> sample;
+                for( size_t s(0); s < sample.size(); ++s )
+                    sample[s] = m_perm[begin + s * (end - begin) / sample.size()];
+                std::nth_element(sample.begin(), sample.begin() + 15, sample.end(), less);
+                size_t pivot = sample[15];
+
+                std::vector<size_t> num_less(num_threads, 0), num_greater(num_threads, 0);
+                parallel_for_chunks( begin, end, num_threads, [&]( size_t c, size_t b, size_t e ){
+                    for( size_t i(b); i < e; ++i ){
+                        if( less(m_perm[i], pivot) ) ++num_less[c];
+                        else if( m_perm[i] != pivot ) ++num_greater[c];
+                    }
+                });
+
+                std::vector<size_t> offset_less(num_threads, 0), offset_greater(num_threads, 0);
+                for( int c(1); c < num_threads; ++c ){
+                    offset_less[c] = offset_less[c-1] + num_less[c-1];
+                    offset_greater[c] = offset_greater[c-1] + num_greater[c-1];
+                }
+                size_t split = begin + offset_less[num_threads-1] + num_less[num_threads-1];
+
+                parallel_for_chunks( begin, end, num_threads, [&]( size_t c, size_t b, size_t e ){
+                    size_t l = begin + offset_less[c];
+                    size_t g = split + 1 + offset_greater[c];
+                    for( size_t i(b); i < e; ++i ){
+                        if( less(m_perm[i], pivot) ) m_buffer[l++] = m_perm[i];
+                        else if( m_perm[i] != pivot ) m_buffer[g++] = m_perm[i];
+                    }
+                });
+                m_buffer[split] = pivot;
+
+                parallel_for_chunks( begin, end, num_threads, [&]( size_t, size_t b, size_t e ){
+                    std::copy(m_buffer.begin() + b, m_buffer.begin() + e, m_perm.begin() + b);
+                });
+
+                if( nth == split )
+                    return;
+                if( nth < split )
+                    end = split;
+                else
+                    begin = split + 1;
+            }
+
+            std::nth_element(m_perm.begin() + begin, m_perm.begin() + nth, m_perm.begin() + end, less);
+        }
+
+        void split( size_t begin, size_t end, size_t index, int num_threads ){
+            flat_node_t<T> & node = m_tree.m_nodes[index];
+            node.m_begin = begin;
+            node.m_end = end;
+            node.m_split_dim = -1;
+            node.m_split_value = 0;
+            node.m_left = 0;
+            node.m_right = 0;
+
+            if( end - begin <= m_tree.m_leaf_size ){
+                std::sort(m_perm.begin() + begin, m_perm.begin() + end);
+                return;
+            }
+
+            int dim = find_dim_with_highest_spread(begin, end, num_threads);
+            size_t mid = begin + (end - begin) / 2;
+            select(begin, mid, end, dim, num_threads);
+
+            node.m_split_dim = dim;
+            node.m_split_value = m_data[m_perm[mid]][dim];
+            node.m_left = index + 1;
+            node.m_right = index + 1 + num_nodes(mid - begin);
+
+            // below the cutoff, or when no more threads are available, the subtrees are built serially.
+            if( num_threads > 1 && end - begin > m_parallel_cutoff ){
+                int left_threads = num_threads / 2;
+                std::thread left( &flat_kdtree_builder::split, this, begin, mid, node.m_left, left_threads );
+                split(mid, end, node.m_right, num_threads - left_threads);
+                left.join();
+            } else {
+                split(begin, mid, node.m_left, 1);
+                split(mid, end, node.m_right, 1);
+            }
+        }
+
+    public:
+        flat_kdtree_builder( Container const& data, flat_kdtree<T,N> & tree ) : m_data(data), m_tree(tree) {}
+
+        void build( int num_threads ){
+            num_threads = resolve_num_threads(num_threads);
+
+            size_t numData = m_data.size();
+            m_perm.resize(numData);
+            std::iota(m_perm.begin(), m_perm.end(), 0);
+            if( num_threads > 1 )
+                m_buffer.resize(numData);
+
+            m_tree.m_nodes.resize( count_nodes(numData) );
+            split(0, numData, 0, num_threads);
+            std::vector<size_t>().swap(m_buffer);
+
+            // gather the coordinates in the permuted order, one dimension at a time.
+            for( int dim(0); dim < N; ++dim ){
+                std::vector<T> & coords = m_tree.m_coords[dim];
+                coords.resize(numData);
+                parallel_for_chunks( 0, numData, num_threads, [&]( size_t, size_t b, size_t e ){
+                    for( size_t i(b); i < e; ++i )
+                        coords[i] = m_data[m_perm[i]][dim];
+                });
+            }
+            m_tree.m_ids.swap(m_perm);
+            m_tree.attach();
+        }
+};
+
+template<typename T, int N, typename Container>
+flat_kdtree<T,N> build_flat_kdtree_from( Container const& data, size_t leaf_size, int num_threads ){
+    flat_kdtree<T,N> tree;
+    tree.m_leaf_size = std::max<size_t>(leaf_size, 1);
+
+    if( data.empty() )
+        return tree;
+
+    flat_kdtree_builder<T,N,Container> builder( data, tree );
+    builder.build( num_threads );
+
+    return tree;
+}
+
+/**
+ * @brief Builds a flat kd-tree with leaf buckets of up to leaf_size points. With num_threads > 1 independent
+ * subtrees, and at the top levels also the spread and median computations, run in parallel; num_threads = 0 uses
+ * all hardware threads. The resulting tree does not depend on num_threads.
+ */
+template<typename T, int N>
+flat_kdtree<T,N> build_flat_kdtree( std::vector<std::array<T,N>> const& data, size_t leaf_size = 16, int num_threads = 1 ){
+    return build_flat_kdtree_from<T,N>( data, leaf_size, num_threads );
+}
+
+template<typename T, int N>
+flat_kdtree<T,N> build_flat_kdtree( std::deque<std::array<T,N>> const& data, size_t leaf_size = 16, int num_threads = 1 ){
+    return build_flat_kdtree_from<T,N>( data, leaf_size, num_threads );
+}
+
+template<typename T, int N>
+flat_kdtree<T,N> build_flat_kdtree( std::list<std::array<T,N>> const& data, size_t leaf_size = 16, int num_threads = 1 ){
+    std::vector<std::array<T,N>> tempData( data.begin(), data.end() );
+    return build_flat_kdtree_from<T,N>( tempData, leaf_size, num_threads );
+}
+
+/**
+ * @brief Adapter of ann_search for the flat kd-tree: descends greedily to the leaf that contains the query point
+ * and returns the closest point of its bucket, in the same key<T,N> form as for node_t trees.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> ann_search( flat_kdtree<T,N> const& tree, std::array<T,N> queryPoint, int & nDepths, bool verbose = false,
+    Metric const& metric = Metric() ){
+    nDepths = 0;
+    if( tree.empty() )
+        return key<T,N>();
+
+    size_t index = 0;
+    while( true ){
+        nDepths += 1;
+        flat_node_t<T> const& node = tree.getNode(index);
+        if( node.isLeaf() )
+            break;
+        kdtree_trace( queryPoint[node.m_split_dim] < node.m_split_value ? trace_kind::descend_left : trace_kind::descend_right,
+            "ann_search( flat_kdtree )", double(queryPoint[node.m_split_dim]), verbose );
+        index = queryPoint[node.m_split_dim] < node.m_split_value ? node.m_left : node.m_right;
+    }
+
+    flat_node_t<T> const& leaf = tree.getNode(index);
+    size_t closest = leaf.m_begin;
+    T distance = metric_distance<T,N>(metric, queryPoint, tree.getKey(closest).m_value);
+    for( size_t i(leaf.m_begin+1); i < leaf.m_end; ++i ){
+        T d = metric_distance<T,N>(metric, queryPoint, tree.getKey(i).m_value);
+        if( d < distance ){
+            distance = d;
+            closest = i;
+        }
+    }
+
+    return tree.getKey(closest);
+}
+
+// leaf buckets are scanned with the distance kernels in blocks of at most this many points.
+const size_t leaf_block_size = 64;
+
+/**
+ * @brief Recursive part of nn_search on the flat kd-tree, see nn_search_node for node_t trees. closest is the
+ * position of the best point found so far in the permuted point arrays of the tree. Leaf buckets are scanned with
+ * metric_distances, which uses the SIMD distance kernels for the Euclidean metric.
+ */
+template<typename T, int N, typename Metric>
+void nn_search_node( flat_kdtree<T,N> const& tree, size_t index, std::array<T,N> const& queryPoint,
+    search_cell<T,N> & cell, size_t & closest, T & distance, search_stats & stats, Metric const& metric ){
+
+    flat_node_t<T> const& node = tree.getNode(index);
+    stats.m_nodes_visited += 1;
+
+    if( node.isLeaf() ){
+        T distances[leaf_block_size];
+        for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+            size_t count = std::min(leaf_block_size, node.m_end - begin);
+            metric_distances<T,N>(metric, tree.getBlock(begin), count, queryPoint, distances);
+            for( size_t i(0); i < count; ++i )
+                if( distances[i] < distance ){
+                    distance = distances[i];
+                    closest = begin + i;
+                }
+        }
+        stats.m_points_visited += node.size();
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    bool nearUpper = !( queryPoint[dim] < node.m_split_value );
+    size_t near = nearUpper ? node.m_right : node.m_left;
+    size_t far  = nearUpper ? node.m_left : node.m_right;
+
+    typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd < distance )
+        nn_search_node<T,N>(tree, near, queryPoint, cell, closest, distance, stats, metric);
+    cell.restore(dim, nearUpper, state);
+
+    state = cell.narrow(dim, !nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd < distance )
+        nn_search_node<T,N>(tree, far, queryPoint, cell, closest, distance, stats, metric);
+    cell.restore(dim, !nearUpper, state);
+}
+
+/**
+ * @brief Exact nearest neighbour of queryPoint in the flat kd-tree, in the same key<T,N> form as for node_t trees.
+ *
+ * @param stats number of nodes and points visited by this query.
+ * @param metric distance metric policy, see metrics.hpp.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> nn_search( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, search_stats & stats,
+    Metric const& metric = Metric() ){
+    stats = search_stats();
+    if( tree.empty() )
+        return key<T,N>();
+
+    size_t closest = 0;
+    T distance = std::numeric_limits<T>::max();
+    search_cell<T,N> cell;
+    nn_search_node<T,N>(tree, 0, queryPoint, cell, closest, distance, stats, metric);
+
+    return tree.getKey(closest);
+}
+
+template<typename T, int N>
+key<T,N> nn_search( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint ){
+    search_stats stats;
+    return nn_search<T,N>(tree, queryPoint, stats);
+}
+
+/**
+ * @brief Recursive part of knn_query on the flat kd-tree, see knn_query_node for node_t trees.
+ */
+template<typename T, int N, typename Metric>
+void knn_query_node( flat_kdtree<T,N> const& tree, size_t index, std::array<T,N> const& queryPoint, size_t k,
+    search_cell<T,N> & cell, std::vector<neighbor<T>> & heap, search_stats & stats, Metric const& metric ){
+
+    flat_node_t<T> const& node = tree.getNode(index);
+    stats.m_nodes_visited += 1;
+
+    if( node.isLeaf() ){
+        T distances[leaf_block_size];
+        for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+            size_t count = std::min(leaf_block_size, node.m_end - begin);
+            metric_distances<T,N>(metric, tree.getBlock(begin), count, queryPoint, distances);
+            for( size_t i(0); i < count; ++i )
+                push_neighbor( heap, k, tree.getID(begin + i), distances[i] );
+        }
+        stats.m_points_visited += node.size();
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    bool nearUpper = !( queryPoint[dim] < node.m_split_value );
+    size_t near = nearUpper ? node.m_right : node.m_left;
+    size_t far  = nearUpper ? node.m_left : node.m_right;
+
+    typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd <= neighbor_bound(heap, k) )
+        knn_query_node<T,N>(tree, near, queryPoint, k, cell, heap, stats, metric);
+    cell.restore(dim, nearUpper, state);
+
+    state = cell.narrow(dim, !nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd <= neighbor_bound(heap, k) )
+        knn_query_node<T,N>(tree, far, queryPoint, k, cell, heap, stats, metric);
+    cell.restore(dim, !nearUpper, state);
+}
+
+/**
+ * @brief Exact k nearest neighbours of queryPoint in the flat kd-tree, sorted by increasing distance. Reusing
+ * result across queries makes the query allocation free, see knn_query for node_t trees.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+void knn_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    result.clear();
+    if( tree.empty() || k == 0 )
+        return;
+
+    search_cell<T,N> cell;
+    knn_query_node<T,N>(tree, 0, queryPoint, k, cell, result, stats, metric);
+    finalize_neighbors( result, metric );
+}
+
+template<typename T, int N>
+void knn_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result ){
+    search_stats stats;
+    knn_query<T,N>(tree, queryPoint, k, result, stats);
+}
+
+template<typename T, int N>
+std::vector<neighbor<T>> knn_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, size_t k ){
+    std::vector<neighbor<T>> result;
+    result.reserve(k);
+    knn_query<T,N>(tree, queryPoint, k, result);
+    return result;
+}
+
+/**
+ * @brief Approximate k nearest neighbours of queryPoint in the flat kd-tree with an epsilon guarantee and a budget
+ * of leaves, see approx_knn_query for node_t trees.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+approx_knn_info<T> approx_knn_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, size_t k,
+    std::vector<neighbor<T>> & result, T epsilon, size_t max_leaves, search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    result.clear();
+    approx_knn_info<T> info;
+    if( tree.empty() || k == 0 )
+        return info;
+
+    using pending = pending_subtree<T,N,size_t>;
+    std::vector<pending> queue( 1, pending{ search_cell<T,N>(), 0 } );
+    T unexplored = std::numeric_limits<T>::max();
+    T distances[leaf_block_size];
+
+    while( !queue.empty() ){
+        std::pop_heap( queue.begin(), queue.end(), std::greater<pending>() );
+        pending next = queue.back();
+        queue.pop_back();
+
+        if( metric.actual(next.m_cell.m_rd) * ( 1 + epsilon ) > metric.actual( neighbor_bound(result, k) ) ){
+            unexplored = next.m_cell.m_rd;
+            break;
+        }
+        if( info.m_leaves_visited >= max_leaves ){
+            unexplored = next.m_cell.m_rd;
+            info.m_budget_exhausted = true;
+            break;
+        }
+
+        // descend to the nearest leaf, queuing the farther child of every node on the way.
+        size_t index = next.m_node;
+        search_cell<T,N> & cell = next.m_cell;
+        while( true ){
+            flat_node_t<T> const& node = tree.getNode(index);
+            stats.m_nodes_visited += 1;
+
+            if( node.isLeaf() ){
+                for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+                    size_t count = std::min(leaf_block_size, node.m_end - begin);
+                    metric_distances<T,N>(metric, tree.getBlock(begin), count, queryPoint, distances);
+                    for( size_t i(0); i < count; ++i )
+                        push_neighbor( result, k, tree.getID(begin + i), distances[i] );
+                }
+                stats.m_points_visited += node.size();
+                info.m_leaves_visited += 1;
+                break;
+            }
+
+            int dim = node.m_split_dim;
+            bool nearUpper = !( queryPoint[dim] < node.m_split_value );
+            pending farSubtree = { cell, nearUpper ? node.m_left : node.m_right };
+            farSubtree.m_cell.narrow(dim, !nearUpper, node.m_split_value, queryPoint, metric);
+            queue.push_back( farSubtree );
+            std::push_heap( queue.begin(), queue.end(), std::greater<pending>() );
+
+            cell.narrow(dim, nearUpper, node.m_split_value, queryPoint, metric);
+            index = nearUpper ? node.m_right : node.m_left;
+        }
+    }
+
+    finalize_neighbors( result, metric );
+    info.m_epsilon = achieved_epsilon( result, k, unexplored, metric );
+    return info;
+}
+
+template<typename T, int N>
+approx_knn_info<T> approx_knn_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, size_t k,
+    std::vector<neighbor<T>> & result, T epsilon, size_t max_leaves = std::numeric_limits<size_t>::max() ){
+    search_stats stats;
+    return approx_knn_query<T,N>(tree, queryPoint, k, result, epsilon, max_leaves, stats);
+}
+
+/**
+ * @brief Recursive part of the range queries on the flat kd-tree, see range_query_node for node_t trees. Since
+ * every node covers a contiguous range of points, contained cells are reported with a plain loop.
+ */
+template<typename T, int N, typename Range, typename Function>
+void range_query_node( flat_kdtree<T,N> const& tree, size_t index, Range const& range, std::array<T,N> & lo,
+    std::array<T,N> & hi, Function & f ){
+
+    if( !range.intersects_cell(lo, hi) )
+        return;
+
+    flat_node_t<T> const& node = tree.getNode(index);
+
+    if( range.contains_cell(lo, hi) ){
+        for( size_t i(node.m_begin); i < node.m_end; ++i )
+            f( tree.getKey(i) );
+        return;
+    }
+
+    if( node.isLeaf() ){
+        for( size_t i(node.m_begin); i < node.m_end; ++i ){
+            key<T,N> e = tree.getKey(i);
+            if( range.contains(e.m_value) )
+                f( e );
+        }
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    T old = hi[dim];
+    hi[dim] = node.m_split_value;
+    range_query_node<T,N>(tree, node.m_left, range, lo, hi, f);
+    hi[dim] = old;
+
+    old = lo[dim];
+    lo[dim] = node.m_split_value;
+    range_query_node<T,N>(tree, node.m_right, range, lo, hi, f);
+    lo[dim] = old;
+}
+
+template<typename T, int N, typename Range>
+size_t range_count_node( flat_kdtree<T,N> const& tree, size_t index, Range const& range, std::array<T,N> & lo,
+    std::array<T,N> & hi ){
+
+    if( !range.intersects_cell(lo, hi) )
+        return 0;
+
+    flat_node_t<T> const& node = tree.getNode(index);
+
+    if( range.contains_cell(lo, hi) )
+        return node.size();
+
+    if( node.isLeaf() ){
+        size_t count = 0;
+        for( size_t i(node.m_begin); i < node.m_end; ++i )
+            count += range.contains(tree.getKey(i).m_value);
+        return count;
+    }
+
+    int dim = node.m_split_dim;
+    T old = hi[dim];
+    hi[dim] = node.m_split_value;
+    size_t count = range_count_node<T,N>(tree, node.m_left, range, lo, hi);
+    hi[dim] = old;
+
+    old = lo[dim];
+    lo[dim] = node.m_split_value;
+    count += range_count_node<T,N>(tree, node.m_right, range, lo, hi);
+    lo[dim] = old;
+
+    return count;
+}
+
+template<typename T, int N, typename Range, typename Function>
+void range_query( flat_kdtree<T,N> const& tree, Range const& range, Function f ){
+    if( tree.empty() )
+        return;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    range_query_node<T,N>(tree, 0, range, lo, hi, f);
+}
+
+template<typename T, int N, typename Range>
+size_t range_count( flat_kdtree<T,N> const& tree, Range const& range ){
+    if( tree.empty() )
+        return 0;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    return range_count_node<T,N>(tree, 0, range, lo, hi);
+}
+
+template<typename T, int N, typename Function, typename Metric = euclidean_metric<T,N>>
+void radius_for_each( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, T radius, Function f,
+    Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    range_query<T,N>(tree, range, f);
+}
+
+template<typename T, int N, typename OutputIt, typename Metric = euclidean_metric<T,N>>
+OutputIt radius_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, T radius, OutputIt out,
+    Metric const& metric = Metric() ){
+    radius_for_each<T,N>(tree, queryPoint, radius, [&out]( key<T,N> const& e ){ *out++ = e; }, metric);
+    return out;
+}
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+size_t radius_count( flat_kdtree<T,N> const& tree, std::array<T,N> const& queryPoint, T radius, Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    return range_count<T,N>(tree, range);
+}
+
+template<typename T, int N, typename Function>
+void box_for_each( flat_kdtree<T,N> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi, Function f ){
+    box_range<T,N> range = { lo, hi };
+    range_query<T,N>(tree, range, f);
+}
+
+template<typename T, int N, typename OutputIt>
+OutputIt box_query( flat_kdtree<T,N> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi, OutputIt out ){
+    box_for_each<T,N>(tree, lo, hi, [&out]( key<T,N> const& e ){ *out++ = e; });
+    return out;
+}
+
+template<typename T, int N>
+size_t box_count( flat_kdtree<T,N> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi ){
+    box_range<T,N> range = { lo, hi };
+    return range_count<T,N>(tree, range);
+}
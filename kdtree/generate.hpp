@@ -1,64 +1,318 @@
 #pragma once
 
 #include <array>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 #include <random>
 #include <iostream>
 
+#include "parallel.hpp"
+
 template<typename T>
 double format_decimals(T value, int decimal_places) {
     const T multiplier = std::pow(10.0, decimal_places);
     return std::ceil(value * multiplier) / multiplier;
 }
 
+/**
+ * @brief Counter-based random number generator: the n-th number of a stream is a hash (the SplitMix64 finaliser)
+ * of the seed and n, so any element can be drawn without drawing the ones before it. Datasets are generated in
+ * parallel by giving each point its own counters, and the output only depends on the seed. split() derives
+ * independent generators, e.g. one for the centres and one for the points of a clustered dataset.
+ */
+class counter_rng {
+    private:
+        uint64_t m_seed;
+
+        static uint64_t mix( uint64_t z ){
+            z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+            z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+            return z ^ ( z >> 31 );
+        }
+
+    public:
+        explicit counter_rng( uint64_t seed = 0 ) : m_seed( mix(seed) ) {}
+
+        uint64_t bits( uint64_t counter ) const { return mix( m_seed + ( counter + 1 ) * 0x9E3779B97F4A7C15ull ); }
+
+        // uniform in [0,1) with 53 random bits.
+        double uniform( uint64_t counter ) const { return ( bits(counter) >> 11 ) * ( 1.0 / 9007199254740992.0 ); }
+
+        // standard normal number m (ziggurat method); number m uses the counters m * 256, ..., m * 256 + 255.
+        double normal( uint64_t m ) const;
+
+        counter_rng split( uint64_t stream ) const { return counter_rng( bits(stream) ^ m_seed ); }
+};
+
+/**
+ * @brief Layers of the ziggurat for counter_rng::normal (Marsaglia and Tsang, with the 128 layers and the
+ * rectangle test of Doornik's ZIGNOR): m_x[i] is the right edge of layer i and m_ratio[i] = m_x[i+1] / m_x[i].
+ */
+struct ziggurat_tables {
+    static constexpr int    layers = 128;
+    static constexpr double r      = 3.442619855899;
+    static constexpr double volume = 9.91256303526217e-3;
+
+    double m_x[layers + 1];
+    double m_ratio[layers];
+
+    ziggurat_tables(){
+        double f = std::exp( -0.5 * r * r );
+        m_x[0] = volume / f;
+        m_x[1] = r;
+        m_x[layers] = 0;
+        for( int i(2); i < layers; ++i ){
+            m_x[i] = std::sqrt( -2 * std::log( volume / m_x[i-1] + f ) );
+            f = std::exp( -0.5 * m_x[i] * m_x[i] );
+        }
+        for( int i(0); i < layers; ++i )
+            m_ratio[i] = m_x[i+1] / m_x[i];
+    }
+
+    static ziggurat_tables const& get(){
+        static const ziggurat_tables tables;
+        return tables;
+    }
+};
+
+inline double counter_rng::normal( uint64_t m ) const {
+    ziggurat_tables const& z = ziggurat_tables::get();
+    const uint64_t base = m << 8;
+
+    // attempt a uses the counters base + 4a (layer and abscissa) and base + 4a + 1 (wedge test); more than 32
+    // attempts happen with probability below 1e-60.
+    for( uint64_t a(0); a < 32; ++a ){
+        uint64_t b = bits(base + 4 * a);
+        int i = static_cast<int>( b & ( ziggurat_tables::layers - 1 ) );
+        double u = 2 * ( ( b >> 11 ) * ( 1.0 / 9007199254740992.0 ) ) - 1;
+        if( std::fabs(u) < z.m_ratio[i] )
+            return u * z.m_x[i];
+
+        if( i == 0 ){
+            // the tail beyond r, from the counters base + 128 + 2t and base + 129 + 2t.
+            for( uint64_t t(0); t < 64; ++t ){
+                double x = std::log( 1 - uniform(base + 128 + 2 * t) ) / ziggurat_tables::r;
+                double y = std::log( 1 - uniform(base + 129 + 2 * t) );
+                if( -2 * y >= x * x )
+                    return u < 0 ? x - ziggurat_tables::r : ziggurat_tables::r - x;
+            }
+            continue;
+        }
+
+        double x = u * z.m_x[i];
+        double f0 = std::exp( -0.5 * ( z.m_x[i] * z.m_x[i] - x * x ) );
+        double f1 = std::exp( -0.5 * ( z.m_x[i+1] * z.m_x[i+1] - x * x ) );
+        if( f1 + uniform(base + 4 * a + 1) * ( f0 - f1 ) < 1 )
+            return x;
+    }
+    return 0;
+}
+
+// a seed from the system entropy source, for datasets that differ from run to run.
+inline uint64_t random_seed(){
+    std::random_device dev;
+    return ( uint64_t( dev() ) << 32 ) ^ dev();
+}
+
+/**
+ * @brief Points with independent normal coordinates of mean m_mean and standard deviation m_stddev. With
+ * m_decimals >= 0 the coordinates are rounded up to that many decimal places, which gives ties as in measured
+ * data. Point i only depends on the generator and i.
+ */
+template<typename T, int N>
+struct normal_points {
+    counter_rng m_rng;
+    double      m_mean       = 0;
+    double      m_stddev     = 1;
+    int         m_decimals   = -1;
+    double      m_multiplier = 1;
+
+    normal_points( counter_rng const& rng, double mean, double stddev, int decimals = -1 )
+        : m_rng(rng), m_mean(mean), m_stddev(stddev), m_decimals(decimals), m_multiplier( std::pow(10.0, decimals) ) {}
+
+    std::array<T,N> operator()( size_t i ) const {
+        std::array<T,N> p;
+        for( int dim(0); dim < N; ++dim ){
+            double value = m_mean + m_stddev * m_rng.normal( i * N + dim );
+            if( m_decimals >= 0 )
+                value = std::ceil(value * m_multiplier) / m_multiplier;
+            p[dim] = static_cast<T>( value );
+        }
+        return p;
+    }
+};
+
+/**
+ * @brief Points uniformly distributed in the box [m_lo, m_hi].
+ */
+template<typename T, int N>
+struct uniform_points {
+    counter_rng     m_rng;
+    std::array<T,N> m_lo;
+    std::array<T,N> m_hi;
+
+    std::array<T,N> operator()( size_t i ) const {
+        std::array<T,N> p;
+        for( int dim(0); dim < N; ++dim )
+            p[dim] = static_cast<T>( m_lo[dim] + m_rng.uniform( i * N + dim ) * ( double(m_hi[dim]) - m_lo[dim] ) );
+        return p;
+    }
+};
+
+/**
+ * @brief Nodes of a regular N-dimensional grid of m_counts[dim] nodes per dimension: node i has the coordinates
+ * m_origin[dim] + index[dim] * m_spacing[dim], with the index of dimension 0 running fastest.
+ */
+template<typename T, int N>
+struct dense_grid {
+    std::array<size_t,N> m_counts;
+    std::array<T,N>      m_spacing;
+    std::array<T,N>      m_origin;
+
+    size_t size() const {
+        size_t n = 1;
+        for( int dim(0); dim < N; ++dim )
+            n *= m_counts[dim];
+        return n;
+    }
+
+    std::array<T,N> operator()( size_t i ) const {
+        std::array<T,N> p;
+        for( int dim(0); dim < N; ++dim ){
+            size_t index = i % m_counts[dim];
+            i /= m_counts[dim];
+            p[dim] = m_origin[dim] + T(index) * m_spacing[dim];
+        }
+        return p;
+    }
+};
+
+/**
+ * @brief Points around m_centers: every point picks a centre uniformly and adds normal offsets of standard
+ * deviation m_stddev to it. See make_clustered_points.
+ */
+template<typename T, int N>
+struct clustered_points {
+    counter_rng                  m_rng;
+    counter_rng                  m_offsets;
+    std::vector<std::array<T,N>> m_centers;
+    double                       m_stddev = 1;
+
+    std::array<T,N> operator()( size_t i ) const {
+        // the centre comes from the high bits of one draw of m_rng, the offsets from m_offsets.
+        size_t c = static_cast<size_t>( ( ( m_rng.bits(i) >> 32 ) * m_centers.size() ) >> 32 );
+        std::array<T,N> p;
+        for( int dim(0); dim < N; ++dim )
+            p[dim] = static_cast<T>( m_centers[c][dim] + m_stddev * m_offsets.normal( i * N + dim ) );
+        return p;
+    }
+};
+
+/**
+ * @brief numClusters clusters of standard deviation stddev, centred at points drawn uniformly from [lo, hi].
+ */
+template<typename T, int N>
+clustered_points<T,N> make_clustered_points( uint64_t seed, size_t numClusters, std::array<T,N> const& lo,
+    std::array<T,N> const& hi, double stddev ){
+    counter_rng rng(seed);
+    clustered_points<T,N> clusters;
+    clusters.m_rng = rng.split(1);
+    clusters.m_offsets = rng.split(3);
+    clusters.m_stddev = stddev;
+    uniform_points<T,N> centers{ rng.split(2), lo, hi };
+    for( size_t c(0); c < numClusters; ++c )
+        clusters.m_centers.push_back( centers(c) );
+    return clusters;
+}
+
+/**
+ * @brief Writes the points first, ..., first + count - 1 of a distribution (normal_points, uniform_points,
+ * dense_grid, clustered_points or any functor of the point index) to the preallocated array out, on num_threads
+ * threads (0 = all cores). Each point only depends on its index, so the output is the same for any number of
+ * threads and a large dataset can be generated piece by piece.
+ */
+template<typename T, int N, typename Distribution>
+void fill_points( Distribution const& distribution, std::array<T,N> *out, size_t count, int num_threads = 0, size_t first = 0 ){
+    parallel_for_chunks( 0, count, resolve_num_threads(num_threads), [&]( size_t, size_t begin, size_t end ){
+        for( size_t i(begin); i < end; ++i )
+            out[i] = distribution( first + i );
+    });
+}
+
+/**
+ * @brief fill_points into structure-of-arrays buffers: coordinate dim of point first + i goes to out[dim][i].
+ */
+template<typename T, int N, typename Distribution>
+void fill_points_soa( Distribution const& distribution, std::array<T*,N> const& out, size_t count, int num_threads = 0, size_t first = 0 ){
+    parallel_for_chunks( 0, count, resolve_num_threads(num_threads), [&]( size_t, size_t begin, size_t end ){
+        for( size_t i(begin); i < end; ++i ){
+            std::array<T,N> p = distribution( first + i );
+            for( int dim(0); dim < N; ++dim )
+                out[dim][i] = p[dim];
+        }
+    });
+}
+
+/**
+ * @brief Appends the first numData points of a distribution to data; see fill_points.
+ */
+template<typename T, int N, typename Distribution>
+void generate_points( Distribution const& distribution, size_t numData, std::vector<std::array<T,N>> &data, int num_threads = 0 ){
+    size_t offset = data.size();
+    data.resize( offset + numData );
+    fill_points<T,N>( distribution, data.data() + offset, numData, num_threads );
+}
+
+/**
+ * @brief Appends numData points with normal coordinates (mean 0, standard deviation 10) rounded up to two
+ * decimals to data, different in every run; see normal_points for reproducible datasets.
+ */
 template<typename T, int N>
 int generate_random( size_t numData, std::vector<std::array<T,N>> &data, bool verbose = false ){
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    double mean = 0;
-    double stddeviation = 10;
-    std::normal_distribution<double> normal_dist(mean, stddeviation);
-
-    for(size_t indexData(0); indexData < numData; ++indexData ){
-        std::array<T,N> tempArray;
-        if ( verbose )
+    size_t offset = data.size();
+    generate_points<T,N>( normal_points<T,N>( counter_rng( random_seed() ), 0, 10, 2 ), numData, data );
+
+    if( verbose ){
+        for( size_t indexData(0); indexData < numData; ++indexData ){
             std::cout << indexData << ":   ";
-        for( int indexValue(0); indexValue < N; ++indexValue ){
-            double value = normal_dist(rng);
-            tempArray[indexValue] = static_cast<T>( format_decimals(value,2) );
-            if( verbose ){
-                if( tempArray[indexValue] > 0 )
+            for( int indexValue(0); indexValue < N; ++indexValue ){
+                if( data[offset + indexData][indexValue] > 0 )
                     std::cout << "+";
-                std::cout << tempArray[indexValue] << "      ";
+                std::cout << data[offset + indexData][indexValue] << "      ";
             }
-        }
-        if( verbose )
             std::cout << std::endl;
-        data.emplace_back( tempArray );
+        }
     }
 
     return 0;
 }
 
+/**
+ * @brief Replaces data with the nodes of an N-dimensional grid; see dense_grid.
+ */
+template<typename T, int N>
+void generate_dense_grid( std::vector<std::array<T,N>> &data, std::array<size_t,N> const& counts,
+    std::array<T,N> const& spacing, std::array<T,N> const& origin, int num_threads = 0 ){
+    dense_grid<T,N> grid{ counts, spacing, origin };
+    data.clear();
+    generate_points<T,N>( grid, grid.size(), data, num_threads );
+}
 
 template<typename T>
 int generate_2d_dense( std::vector<std::array<T,2>> &data, size_t nx, size_t ny, T dx, T dy, T xmin, T ymin, bool verbose = false ){
 
-    // make sure no values existed before in the vector of data.
-    data.clear();
+    // make sure no values existed before in the vector of data; x is the fastest index of the grid.
+    generate_dense_grid<T,2>( data, {{ nx, ny }}, {{ dx, dy }}, {{ xmin, ymin }} );
 
-    // loop over x,y coordinates using x as the fastes index and grid a rectangular grid of coordinates.
-    for ( size_t iy(0); iy <  ny; ++iy ){
-        T y = ymin + iy * dy;
-        for( size_t ix(0); ix < nx; ++ix ){
-            T x = xmin + ix * dx;
-            std::array<T,2> coord = { x, y };
-            data.push_back( coord );
-            if(verbose)
+    if( verbose ){
+        for( size_t iy(0); iy < ny; ++iy ){
+            for( size_t ix(0); ix < nx; ++ix ){
+                std::array<T,2> const& coord = data[iy * nx + ix];
                 std::cout << "("<<coord[0]<<","<<coord[1]<<")"<<"  ";
-        }
-        if(verbose)
+            }
             std::cout << std::endl;
+        }
     }
 
     return 0;
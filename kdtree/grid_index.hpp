@@ -0,0 +1,587 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include <array>
+#include <deque>
+#include <list>
+#include <limits>
+
+#include "kdtree.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
+#include "space_filling_curve.hpp"
+
+/**
+ * @brief Uniform grid (cell list) over N-dimensional points: space is cut into cubic cells of side m_cell_size
+ * starting at m_origin, and the points are stored cell by cell in structure-of-arrays form, so the points of a
+ * cell are contiguous and m_cell_start[c] .. m_cell_start[c+1] is the range of cell c. Cells are numbered with
+ * dim 0 fastest. Within a cell the points are sorted by id, the index of the point in the dataset the grid was
+ * built from, as in key<T,N>.
+ *
+ * Cell c along dim covers [cellLower(dim, c), cellLower(dim, c+1)) and the build assigns every point to the cell
+ * whose computed bounds contain it, so the distance bounds of the cells (see metrics.hpp) are exact and pruning
+ * does not change the results. For a regular lattice, or any data of roughly uniform density, with cells about
+ * the size of the query radius, a query only scans the few cells around the query point.
+ *
+ * @tparam T type of data.
+ * @tparam N number of dimensions.
+ */
+template<typename T, int N>
+struct grid_index {
+    using key_type = key<T,N>;
+
+    std::array<T,N>              m_origin;
+    T                            m_cell_size = 1;
+    std::array<size_t,N>         m_num_cells;   // cells per dimension
+    std::array<size_t,N>         m_strides;     // distance between the indices of cells adjacent along each dim
+    std::vector<size_t>          m_cell_start;
+    std::array<std::vector<T>,N> m_coords;
+    std::vector<size_t>          m_ids;
+
+    grid_index(){
+        m_origin.fill(0);
+        m_num_cells.fill(1);
+        m_strides.fill(1);
+    }
+
+    size_t size()     const { return m_ids.size(); }
+    bool   empty()    const { return m_ids.empty(); }
+    size_t numCells() const { return m_cell_start.empty() ? 0 : m_cell_start.size() - 1; }
+    T      getCellSize() const { return m_cell_size; }
+
+    size_t cellBegin( size_t cell ) const { return m_cell_start[cell]; }
+    size_t cellEnd( size_t cell )   const { return m_cell_start[cell + 1]; }
+
+    // lower bound of cell c along dim, computed the same way by the build and the queries.
+    T cellLower( int dim, size_t c ) const { return m_origin[dim] + T(c) * m_cell_size; }
+
+    // cell along dim that holds the coordinate value, clamped to the grid.
+    size_t cellOf( int dim, T value ) const {
+        if( !( value >= m_origin[dim] ) )
+            return 0;
+        double guess = std::floor( double( value - m_origin[dim] ) / double( m_cell_size ) );
+        size_t c = guess < double( m_num_cells[dim] ) ? static_cast<size_t>( guess ) : m_num_cells[dim] - 1;
+        while( c > 0 && value < cellLower(dim, c) )
+            c -= 1;
+        while( c + 1 < m_num_cells[dim] && !( value < cellLower(dim, c + 1) ) )
+            c += 1;
+        return c;
+    }
+
+    T      getValue( size_t i, int dim ) const { return m_coords[dim][i]; }
+    size_t getID( size_t i )             const { return m_ids[i]; }
+
+    // pointers to the coordinates of point i in every dimension, the input of the distance kernels.
+    std::array<T const*,N> getBlock( size_t i ) const {
+        std::array<T const*,N> block;
+        for( int dim(0); dim < N; ++dim )
+            block[dim] = m_coords[dim].data() + i;
+        return block;
+    }
+
+    key_type getKey( size_t i ) const {
+        key_type k;
+        k.m_id = m_ids[i];
+        for( int dim(0); dim < N; ++dim )
+            k.m_value[dim] = m_coords[dim][i];
+        return k;
+    }
+
+    size_t memory_footprint() const {
+        return sizeof(*this) + m_cell_start.capacity() * sizeof(size_t)
+            + N * m_ids.size() * sizeof(T) + m_ids.capacity() * sizeof(size_t);
+    }
+
+    /**
+     * @brief Calls f(cell, coords) for the cells of the grid at Chebyshev distance ring (in cells) from the cell
+     * center: the shell of the box of cells around center. Along dim 0 only the two end cells of a row are
+     * visited unless another dim already puts the row on the shell.
+     */
+    template<typename Function>
+    void for_each_cell_in_ring( std::array<size_t,N> const& center, size_t ring, Function & f ) const {
+        std::array<size_t,N> lo, hi, c;
+        for( int dim(0); dim < N; ++dim ){
+            lo[dim] = center[dim] >= ring ? center[dim] - ring : 0;
+            hi[dim] = std::min( center[dim] + ring, m_num_cells[dim] - 1 );
+        }
+
+        c = lo;
+        while( true ){
+            bool onShell = false;
+            size_t base = 0;
+            for( int dim(1); dim < N; ++dim ){
+                onShell = onShell || c[dim] + ring == center[dim] || c[dim] == center[dim] + ring;
+                base += c[dim] * m_strides[dim];
+            }
+
+            if( onShell || ring == 0 )
+                for( c[0] = lo[0]; c[0] <= hi[0]; ++c[0] )
+                    f( base + c[0], c );
+            else {
+                if( center[0] >= ring ){
+                    c[0] = center[0] - ring;
+                    f( base + c[0], c );
+                }
+                if( center[0] + ring < m_num_cells[0] ){
+                    c[0] = center[0] + ring;
+                    f( base + c[0], c );
+                }
+            }
+
+            int dim = 1;
+            while( dim < N && c[dim] == hi[dim] ){
+                c[dim] = lo[dim];
+                ++dim;
+            }
+            if( dim >= N )
+                return;
+            c[dim] += 1;
+        }
+    }
+
+    /**
+     * @brief Calls f(cell, coords) for every cell of the box of cells [lo, hi] (bounds included).
+     */
+    template<typename Function>
+    void for_each_cell_in_box( std::array<size_t,N> const& lo, std::array<size_t,N> const& hi, Function & f ) const {
+        std::array<size_t,N> c = lo;
+        while( true ){
+            size_t base = 0;
+            for( int dim(1); dim < N; ++dim )
+                base += c[dim] * m_strides[dim];
+            for( c[0] = lo[0]; c[0] <= hi[0]; ++c[0] )
+                f( base + c[0], c );
+
+            int dim = 1;
+            while( dim < N && c[dim] == hi[dim] ){
+                c[dim] = lo[dim];
+                ++dim;
+            }
+            if( dim >= N )
+                return;
+            c[dim] += 1;
+        }
+    }
+
+    // whether the box of cells within ring of center covers the whole grid.
+    bool ring_covers_grid( std::array<size_t,N> const& center, size_t ring ) const {
+        for( int dim(0); dim < N; ++dim )
+            if( center[dim] > ring || center[dim] + ring < m_num_cells[dim] - 1 )
+                return false;
+        return true;
+    }
+
+    /**
+     * @brief Calls f(lo, hi) with the coordinate box of each of the (up to 2N) slabs of the grid that lie outside
+     * the box of cells within ring of center. Every cell not yet visited by a ring search is in one of them.
+     */
+    template<typename Function>
+    void for_each_outer_slab( std::array<size_t,N> const& center, size_t ring, Function f ) const {
+        std::array<T,N> lo, hi;
+        for( int dim(0); dim < N; ++dim ){
+            lo[dim] = cellLower(dim, 0);
+            hi[dim] = cellLower(dim, m_num_cells[dim]);
+        }
+        for( int dim(0); dim < N; ++dim ){
+            if( center[dim] > ring ){
+                T old = hi[dim];
+                hi[dim] = cellLower(dim, center[dim] - ring);
+                f( lo, hi );
+                hi[dim] = old;
+            }
+            if( center[dim] + ring + 1 < m_num_cells[dim] ){
+                T old = lo[dim];
+                lo[dim] = cellLower(dim, center[dim] + ring + 1);
+                f( lo, hi );
+                lo[dim] = old;
+            }
+        }
+    }
+
+    std::array<size_t,N> cellOf( std::array<T,N> const& p ) const {
+        std::array<size_t,N> c;
+        for( int dim(0); dim < N; ++dim )
+            c[dim] = cellOf(dim, p[dim]);
+        return c;
+    }
+
+    void cellBounds( std::array<size_t,N> const& c, std::array<T,N> & lo, std::array<T,N> & hi ) const {
+        for( int dim(0); dim < N; ++dim ){
+            lo[dim] = cellLower(dim, c[dim]);
+            hi[dim] = cellLower(dim, c[dim] + 1);
+        }
+    }
+};
+
+// a grid never has more than this many cells per point, the cell size grows until it fits.
+const double grid_max_cells_per_point = 4;
+
+// points per cell aimed at when build_grid_index chooses the cell size itself.
+const double grid_points_per_cell = 2;
+
+/**
+ * @brief Builds a grid over a random-access container of std::array<T,N> points in O(n) on num_threads threads
+ * (0 = all cores): the cells of the points are computed in parallel and the ids sorted by cell with the stable
+ * radix_sort_by_key, whose scratch is O(n) plus a fixed histogram per thread whatever the number of cells. The
+ * first position of every cell is then filled in from the boundaries between cells in the sorted order, and the
+ * coordinates are gathered cell by cell. The result does not depend on num_threads.
+ *
+ * @param cell_size side of the cells, typically the radius of the queries; 0 picks one for about
+ * grid_points_per_cell points per cell. It is enlarged if the grid would have more than grid_max_cells_per_point
+ * cells per point.
+ */
+template<typename T, int N, typename Container>
+grid_index<T,N> build_grid_index_from( Container const& data, T cell_size, int num_threads ){
+    grid_index<T,N> grid;
+    const size_t n = data.size();
+    if( n == 0 )
+        return grid;
+
+    std::array<T,N> lo = data[0], hi = data[0];
+    for( size_t i(1); i < n; ++i )
+        for( int dim(0); dim < N; ++dim ){
+            lo[dim] = std::min( lo[dim], data[i][dim] );
+            hi[dim] = std::max( hi[dim], data[i][dim] );
+        }
+    grid.m_origin = lo;
+
+    if( !( cell_size > 0 ) ){
+        double volume = 1;
+        int spanned = 0;
+        for( int dim(0); dim < N; ++dim )
+            if( hi[dim] > lo[dim] ){
+                volume *= double( hi[dim] - lo[dim] );
+                spanned += 1;
+            }
+        cell_size = spanned > 0 ? T( std::pow( volume * grid_points_per_cell / n, 1.0 / spanned ) ) : T(1);
+        if( !( cell_size > 0 ) )
+            cell_size = 1;
+    }
+
+    double total = 0;
+    while( true ){
+        grid.m_cell_size = cell_size;
+        total = 1;
+        for( int dim(0); dim < N; ++dim ){
+            double cells = std::floor( double( hi[dim] - lo[dim] ) / double( cell_size ) ) + 1;
+            size_t c = static_cast<size_t>( std::min( cells, 1e18 ) );
+            while( !( hi[dim] < grid.cellLower(dim, c) ) )
+                c += 1;
+            grid.m_num_cells[dim] = c;
+            total *= double( c );
+        }
+        if( total <= std::max( grid_max_cells_per_point * n, 1.0 ) )
+            break;
+        cell_size *= 2;
+    }
+
+    size_t numCells = static_cast<size_t>( total );
+    for( int dim(0); dim < N; ++dim )
+        grid.m_strides[dim] = dim == 0 ? 1 : grid.m_strides[dim-1] * grid.m_num_cells[dim-1];
+
+    num_threads = std::max<int>( 1, std::min<size_t>( static_cast<size_t>(resolve_num_threads(num_threads)), n / 4096 + 1 ) );
+    std::vector<uint64_t> cellOf(n);
+    std::vector<size_t> order(n);
+    parallel_for_chunks( 0, n, num_threads, [&]( size_t, size_t b, size_t e ){
+        for( size_t i(b); i < e; ++i ){
+            size_t cell = 0;
+            for( int dim(0); dim < N; ++dim )
+                cell += grid.cellOf(dim, data[i][dim]) * grid.m_strides[dim];
+            cellOf[i] = cell;
+            order[i] = i;
+        }
+    });
+    radix_sort_by_key( cellOf, order, num_threads );
+
+    // the cells after the one of the previous point, up to the one of point j, start at position j.
+    grid.m_cell_start.resize( numCells + 1 );
+    parallel_for_chunks( 0, n, num_threads, [&]( size_t, size_t b, size_t e ){
+        for( size_t j(b); j < e; ++j )
+            for( size_t cell( j == 0 ? 0 : cellOf[j-1] + 1 ); cell <= cellOf[j]; ++cell )
+                grid.m_cell_start[cell] = j;
+    });
+    for( size_t cell( cellOf[n-1] + 1 ); cell <= numCells; ++cell )
+        grid.m_cell_start[cell] = n;
+
+    for( int dim(0); dim < N; ++dim )
+        grid.m_coords[dim].resize(n);
+    parallel_for_chunks( 0, n, num_threads, [&]( size_t, size_t b, size_t e ){
+        for( size_t j(b); j < e; ++j )
+            for( int dim(0); dim < N; ++dim )
+                grid.m_coords[dim][j] = data[ order[j] ][dim];
+    });
+    grid.m_ids.swap(order);
+
+    return grid;
+}
+
+template<typename T, int N>
+grid_index<T,N> build_grid_index( std::vector<std::array<T,N>> const& data, T cell_size = 0, int num_threads = 1 ){
+    return build_grid_index_from<T,N>( data, cell_size, num_threads );
+}
+
+template<typename T, int N>
+grid_index<T,N> build_grid_index( std::deque<std::array<T,N>> const& data, T cell_size = 0, int num_threads = 1 ){
+    return build_grid_index_from<T,N>( data, cell_size, num_threads );
+}
+
+template<typename T, int N>
+grid_index<T,N> build_grid_index( std::list<std::array<T,N>> const& data, T cell_size = 0, int num_threads = 1 ){
+    std::vector<std::array<T,N>> tempData( data.begin(), data.end() );
+    return build_grid_index_from<T,N>( tempData, cell_size, num_threads );
+}
+
+// points of a cell whose distances are computed at once by metric_distances.
+const size_t grid_block_size = 64;
+
+/**
+ * @brief Searches the cells of the grid ring by ring around the cell of queryPoint for the nearest points:
+ * scan(begin, end) is called for every non-empty cell whose distance from queryPoint is at most bound(), and the
+ * search stops when every cell outside the searched rings is farther than bound(). Visited cells are counted in
+ * stats.m_nodes_visited.
+ */
+template<typename T, int N, typename Metric, typename Bound, typename Scan>
+void nearest_cells( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, Metric const& metric,
+    search_stats & stats, Bound bound, Scan scan ){
+
+    std::array<size_t,N> center = grid.cellOf(queryPoint);
+    std::array<T,N> lo, hi;
+    auto visit = [&]( size_t cell, std::array<size_t,N> const& c ){
+        size_t begin = grid.cellBegin(cell), end = grid.cellEnd(cell);
+        if( begin == end )
+            return;
+        grid.cellBounds(c, lo, hi);
+        T rd = 0;
+        for( int dim(0); dim < N; ++dim )
+            rd = metric.combine( rd, metric.interval_component(queryPoint[dim], lo[dim], hi[dim], dim) );
+        if( rd > bound() )
+            return;
+
+        stats.m_nodes_visited += 1;
+        stats.m_points_visited += end - begin;
+        scan( begin, end );
+    };
+
+    for( size_t ring(0); ; ++ring ){
+        grid.for_each_cell_in_ring(center, ring, visit);
+        if( grid.ring_covers_grid(center, ring) )
+            return;
+
+        T outside = std::numeric_limits<T>::max();
+        grid.for_each_outer_slab(center, ring, [&]( std::array<T,N> const& slabLo, std::array<T,N> const& slabHi ){
+            T rd = 0;
+            for( int dim(0); dim < N; ++dim )
+                rd = metric.combine( rd, metric.interval_component(queryPoint[dim], slabLo[dim], slabHi[dim], dim) );
+            outside = std::min( outside, rd );
+        });
+        if( outside > bound() )
+            return;
+    }
+}
+
+/**
+ * @brief Exact k nearest neighbours of queryPoint in the grid, sorted by increasing distance, with the same
+ * interface and results as knn_query on the trees. Cells farther than the current k-th neighbour are skipped.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+void knn_query( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    result.clear();
+    if( grid.empty() || k == 0 )
+        return;
+
+    T distances[grid_block_size];
+    nearest_cells<T,N>( grid, queryPoint, metric, stats,
+        [&](){ return neighbor_bound(result, k); },
+        [&]( size_t begin, size_t end ){
+            for( ; begin < end; begin += grid_block_size ){
+                size_t count = std::min(grid_block_size, end - begin);
+                metric_distances<T,N>(metric, grid.getBlock(begin), count, queryPoint, distances);
+                for( size_t i(0); i < count; ++i )
+                    push_neighbor( result, k, grid.getID(begin + i), distances[i] );
+            }
+        });
+
+    finalize_neighbors( result, metric );
+}
+
+template<typename T, int N>
+void knn_query( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result ){
+    search_stats stats;
+    knn_query<T,N>(grid, queryPoint, k, result, stats);
+}
+
+template<typename T, int N>
+std::vector<neighbor<T>> knn_query( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, size_t k ){
+    std::vector<neighbor<T>> result;
+    result.reserve(k);
+    knn_query<T,N>(grid, queryPoint, k, result);
+    return result;
+}
+
+/**
+ * @brief Exact nearest neighbour of queryPoint in the grid.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> nn_search( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, search_stats & stats,
+    Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    if( grid.empty() )
+        return key<T,N>();
+
+    size_t closest = 0;
+    T distance = std::numeric_limits<T>::max();
+    T distances[grid_block_size];
+    nearest_cells<T,N>( grid, queryPoint, metric, stats,
+        [&](){ return distance; },
+        [&]( size_t begin, size_t end ){
+            for( ; begin < end; begin += grid_block_size ){
+                size_t count = std::min(grid_block_size, end - begin);
+                metric_distances<T,N>(metric, grid.getBlock(begin), count, queryPoint, distances);
+                for( size_t i(0); i < count; ++i )
+                    if( distances[i] < distance ){
+                        distance = distances[i];
+                        closest = begin + i;
+                    }
+            }
+        });
+
+    return grid.getKey(closest);
+}
+
+template<typename T, int N>
+key<T,N> nn_search( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint ){
+    search_stats stats;
+    return nn_search<T,N>(grid, queryPoint, stats);
+}
+
+/**
+ * @brief Cells of the grid that intersect a radius_range: searched ring by ring around the cell of its center
+ * until no cell outside the searched rings intersects the range. report(begin, end, contained) is called for each.
+ */
+template<typename T, int N, typename Metric, typename Report>
+void range_cells( grid_index<T,N> const& grid, radius_range<T,N,Metric> const& range, Report & report ){
+    std::array<size_t,N> center = grid.cellOf(range.m_center);
+    std::array<T,N> lo, hi;
+    auto visit = [&]( size_t cell, std::array<size_t,N> const& c ){
+        if( grid.cellBegin(cell) == grid.cellEnd(cell) )
+            return;
+        grid.cellBounds(c, lo, hi);
+        if( range.intersects_cell(lo, hi) )
+            report( grid.cellBegin(cell), grid.cellEnd(cell), range.contains_cell(lo, hi) );
+    };
+
+    for( size_t ring(0); ; ++ring ){
+        grid.for_each_cell_in_ring(center, ring, visit);
+        if( grid.ring_covers_grid(center, ring) )
+            return;
+
+        bool intersects = false;
+        grid.for_each_outer_slab(center, ring, [&]( std::array<T,N> const& slabLo, std::array<T,N> const& slabHi ){
+            intersects = intersects || range.intersects_cell(slabLo, slabHi);
+        });
+        if( !intersects )
+            return;
+    }
+}
+
+/**
+ * @brief Cells of the grid that intersect a box_range: those of the box of cells between its corners.
+ */
+template<typename T, int N, typename Report>
+void range_cells( grid_index<T,N> const& grid, box_range<T,N> const& range, Report & report ){
+    std::array<T,N> lo, hi;
+    auto visit = [&]( size_t cell, std::array<size_t,N> const& c ){
+        if( grid.cellBegin(cell) == grid.cellEnd(cell) )
+            return;
+        grid.cellBounds(c, lo, hi);
+        if( range.intersects_cell(lo, hi) )
+            report( grid.cellBegin(cell), grid.cellEnd(cell), range.contains_cell(lo, hi) );
+    };
+    std::array<size_t,N> first = grid.cellOf(range.m_lo), last = grid.cellOf(range.m_hi);
+    for( int dim(0); dim < N; ++dim )
+        if( first[dim] > last[dim] )
+            return;
+    grid.for_each_cell_in_box( first, last, visit );
+}
+
+/**
+ * @brief Calls f(key) for every point of the grid inside the range (a box_range or a radius_range). Cells
+ * contained in the range are reported without testing their points.
+ */
+template<typename T, int N, typename Range, typename Function>
+void range_query( grid_index<T,N> const& grid, Range const& range, Function f ){
+    if( grid.empty() )
+        return;
+
+    auto report = [&]( size_t begin, size_t end, bool contained ){
+        for( size_t i(begin); i < end; ++i ){
+            key<T,N> e = grid.getKey(i);
+            if( contained || range.contains(e.m_value) )
+                f( e );
+        }
+    };
+    range_cells<T,N>(grid, range, report);
+}
+
+template<typename T, int N, typename Range>
+size_t range_count( grid_index<T,N> const& grid, Range const& range ){
+    if( grid.empty() )
+        return 0;
+
+    size_t count = 0;
+    auto add = [&]( size_t begin, size_t end, bool contained ){
+        if( contained ){
+            count += end - begin;
+            return;
+        }
+        for( size_t i(begin); i < end; ++i )
+            count += range.contains( grid.getKey(i).m_value );
+    };
+    range_cells<T,N>(grid, range, add);
+    return count;
+}
+
+template<typename T, int N, typename Function, typename Metric = euclidean_metric<T,N>>
+void radius_for_each( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, T radius, Function f,
+    Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    range_query<T,N>(grid, range, f);
+}
+
+template<typename T, int N, typename OutputIt, typename Metric = euclidean_metric<T,N>>
+OutputIt radius_query( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, T radius, OutputIt out,
+    Metric const& metric = Metric() ){
+    radius_for_each<T,N>(grid, queryPoint, radius, [&out]( key<T,N> const& e ){ *out++ = e; }, metric);
+    return out;
+}
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+size_t radius_count( grid_index<T,N> const& grid, std::array<T,N> const& queryPoint, T radius, Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    return range_count<T,N>(grid, range);
+}
+
+template<typename T, int N, typename Function>
+void box_for_each( grid_index<T,N> const& grid, std::array<T,N> const& lo, std::array<T,N> const& hi, Function f ){
+    box_range<T,N> range = { lo, hi };
+    range_query<T,N>(grid, range, f);
+}
+
+template<typename T, int N, typename OutputIt>
+OutputIt box_query( grid_index<T,N> const& grid, std::array<T,N> const& lo, std::array<T,N> const& hi, OutputIt out ){
+    box_for_each<T,N>(grid, lo, hi, [&out]( key<T,N> const& e ){ *out++ = e; });
+    return out;
+}
+
+template<typename T, int N>
+size_t box_count( grid_index<T,N> const& grid, std::array<T,N> const& lo, std::array<T,N> const& hi ){
+    box_range<T,N> range = { lo, hi };
+    return range_count<T,N>(grid, range);
+}
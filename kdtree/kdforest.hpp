@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <array>
+#include <deque>
+#include <list>
+#include <limits>
+#include <functional>
+
+#include "kdtree.hpp"
+#include "flat_kdtree.hpp"
+#include "parallel.hpp"
+
+/**
+ * @brief Build parameters of a randomized kd-forest.
+ */
+struct kdforest_params {
+    int      m_num_trees   = 4;
+    int      m_top_dims    = 5;     // the split dim is drawn among this many dims of highest variance
+    bool     m_rotate      = false; // give each tree its own random rotation of the space
+    size_t   m_leaf_size   = 16;
+    size_t   m_sample_size = 128;   // points sampled per node to estimate the variance of the dims
+    unsigned m_seed        = 0;
+    int      m_num_threads = 0;     // trees are built concurrently, 0 = all cores
+};
+
+/**
+ * @brief One randomized tree of a kd-forest. It references the points of the forest by index, so the trees share
+ * a single copy of the data: m_ids is the permutation of the point indices, each node covers a contiguous range
+ * of it as in the flat kd-tree. With a rotation the split dims refer to the axes of the rotated space, the rows
+ * of the row-major N x N matrix m_rotation; without one it is empty.
+ */
+template<typename T>
+struct kdforest_tree {
+    std::vector<flat_node_t<T>> m_nodes;
+    std::vector<size_t>         m_ids;
+    std::vector<T>              m_rotation;
+};
+
+/**
+ * @brief Coordinates of p along the rows of the row-major N x N matrix rotation, or p itself if it is empty.
+ */
+template<typename T, int N>
+void project_point( std::vector<T> const& rotation, std::array<T,N> const& p, T *out ){
+    if( rotation.empty() ){
+        std::copy(p.begin(), p.end(), out);
+        return;
+    }
+    for( int row(0); row < N; ++row ){
+        T s = 0;
+        for( int dim(0); dim < N; ++dim )
+            s += rotation[row * N + dim] * p[dim];
+        out[row] = s;
+    }
+}
+
+/*************************************************************************************************************
+ * @brief Forest of randomized kd-trees for approximate nearest neighbour search in high dimensions, where a
+ * single kd-tree that always splits the dim of highest spread has to visit almost all of its leaves. Each tree
+ * splits at the median of a dim drawn at random among the dims of highest variance (and optionally in its own
+ * randomly rotated space), so the trees partition the space differently and a point missed by one tree is likely
+ * close to the query in another. All trees are searched together from one priority queue (see knn_query).
+ *
+ * @tparam T type of data.
+ * @tparam N number of dimensions.
+ */
+template<typename T, int N>
+struct kdforest {
+    std::vector<std::array<T,N>>  m_points;
+    std::vector<kdforest_tree<T>> m_trees;
+    size_t                        m_leaf_size = 16;
+
+    size_t size()     const { return m_points.size(); }
+    bool   empty()    const { return m_points.empty(); }
+    size_t numTrees() const { return m_trees.size(); }
+
+    std::array<T,N> const& getPoint( size_t id ) const { return m_points[id]; }
+    kdforest_tree<T> const& getTree( size_t t ) const { return m_trees[t]; }
+
+    // coordinates of p along the axes of tree t.
+    void project( size_t t, std::array<T,N> const& p, T *out ) const {
+        project_point<T,N>( m_trees[t].m_rotation, p, out );
+    }
+};
+
+/**
+ * @brief Random orthonormal N x N matrix (row-major): Gram-Schmidt orthonormalisation of a Gaussian matrix.
+ */
+template<typename T, int N>
+std::vector<T> random_rotation( std::mt19937 & rng ){
+    std::normal_distribution<double> normal(0, 1);
+    std::vector<double> m(N * N);
+    for( double & e : m )
+        e = normal(rng);
+
+    for( int row(0); row < N; ++row ){
+        double *r = &m[row * N];
+        for( int prev(0); prev < row; ++prev ){
+            double const* p = &m[prev * N];
+            double dot = std::inner_product(r, r + N, p, 0.0);
+            for( int dim(0); dim < N; ++dim )
+                r[dim] -= dot * p[dim];
+        }
+        double norm = std::sqrt( std::inner_product(r, r + N, r, 0.0) );
+        for( int dim(0); dim < N; ++dim )
+            r[dim] /= norm;
+    }
+
+    return std::vector<T>(m.begin(), m.end());
+}
+
+/**
+ * @brief Builds one tree of a kd-forest. The coordinates the tree splits on are those of the forest's points, or
+ * their projections on the rotated axes, which are computed once for the whole build.
+ */
+template<typename T, int N>
+class kdforest_tree_builder {
+    private:
+        struct point_less {
+            T const* m_values;
+            int      m_dim;
+            bool operator()( size_t a, size_t b ) const {
+                T va = m_values[a * N + m_dim];
+                T vb = m_values[b * N + m_dim];
+                return va < vb || ( va == vb && a < b );
+            }
+        };
+
+        kdforest<T,N> const& m_forest;
+        kdforest_tree<T>   & m_tree;
+        kdforest_params const& m_params;
+        std::mt19937         m_rng;
+        std::vector<T>       m_projected;
+        T const*             m_values = nullptr;    // row-major n x N coordinates the tree splits on
+
+        // draws the split dim among the m_top_dims dims of highest variance, estimated on a sample of the range.
+        int choose_dim( size_t begin, size_t end ){
+            size_t count = end - begin;
+            size_t samples = std::min(count, std::max<size_t>(m_params.m_sample_size, 1));
+            std::array<double,N> mean, var;
+            mean.fill(0);
+            var.fill(0);
+            for( size_t s(0); s < samples; ++s ){
+                T const* v = m_values + m_tree.m_ids[begin + s * count / samples] * N;
+                for( int dim(0); dim < N; ++dim ){
+                    mean[dim] += v[dim];
+                    var[dim] += double(v[dim]) * v[dim];
+                }
+            }
+            for( int dim(0); dim < N; ++dim ){
+                mean[dim] /= samples;
+                var[dim] = var[dim] / samples - mean[dim] * mean[dim];
+            }
+
+            std::array<int,N> dims;
+            std::iota(dims.begin(), dims.end(), 0);
+            int top = std::max(1, std::min(m_params.m_top_dims, N));
+            std::partial_sort(dims.begin(), dims.begin() + top, dims.end(),
+                [&var]( int a, int b ){ return var[a] > var[b] || ( var[a] == var[b] && a < b ); });
+            return dims[ std::uniform_int_distribution<int>(0, top - 1)(m_rng) ];
+        }
+
+        size_t split( size_t begin, size_t end ){
+            size_t index = m_tree.m_nodes.size();
+            flat_node_t<T> leaf = { 0, -1, 0, 0, begin, end };
+            m_tree.m_nodes.push_back(leaf);
+
+            if( end - begin <= m_forest.m_leaf_size )
+                return index;
+
+            int dim = choose_dim(begin, end);
+            size_t mid = begin + (end - begin) / 2;
+            point_less less = { m_values, dim };
+            std::nth_element(m_tree.m_ids.begin() + begin, m_tree.m_ids.begin() + mid, m_tree.m_ids.begin() + end, less);
+
+            T value = m_values[m_tree.m_ids[mid] * N + dim];
+            size_t left = split(begin, mid);
+            size_t right = split(mid, end);
+
+            flat_node_t<T> & node = m_tree.m_nodes[index];
+            node.m_split_dim = dim;
+            node.m_split_value = value;
+            node.m_left = left;
+            node.m_right = right;
+            return index;
+        }
+
+    public:
+        kdforest_tree_builder( kdforest<T,N> const& forest, kdforest_tree<T> & tree, kdforest_params const& params,
+            unsigned seed ) : m_forest(forest), m_tree(tree), m_params(params), m_rng(seed) {}
+
+        void build(){
+            size_t numData = m_forest.size();
+            if( m_params.m_rotate ){
+                m_tree.m_rotation = random_rotation<T,N>(m_rng);
+                m_projected.resize(numData * N);
+                for( size_t i(0); i < numData; ++i )
+                    project_point<T,N>( m_tree.m_rotation, m_forest.getPoint(i), &m_projected[i * N] );
+                m_values = m_projected.data();
+            } else
+                m_values = m_forest.m_points.empty() ? nullptr : m_forest.m_points[0].data();
+
+            m_tree.m_ids.resize(numData);
+            std::iota(m_tree.m_ids.begin(), m_tree.m_ids.end(), 0);
+            if( numData > 0 )
+                split(0, numData);
+        }
+};
+
+/**
+ * @brief Builds a forest of params.m_num_trees randomized kd-trees over a copy of the points, one tree per thread.
+ * The trees only depend on params.m_seed, not on the number of threads.
+ */
+template<typename T, int N, typename Container>
+kdforest<T,N> build_kdforest_from( Container const& data, kdforest_params const& params ){
+    kdforest<T,N> forest;
+    forest.m_points.assign(data.begin(), data.end());
+    forest.m_leaf_size = std::max<size_t>(params.m_leaf_size, 1);
+    forest.m_trees.resize( std::max(params.m_num_trees, 1) );
+
+    size_t numTrees = forest.m_trees.size();
+    int num_threads = std::min<int>( resolve_num_threads(params.m_num_threads), numTrees );
+    parallel_for_chunks( 0, numTrees, num_threads, [&]( size_t, size_t b, size_t e ){
+        for( size_t t(b); t < e; ++t ){
+            kdforest_tree_builder<T,N> builder( forest, forest.m_trees[t], params, params.m_seed + 7919 * t );
+            builder.build();
+        }
+    });
+
+    return forest;
+}
+
+template<typename T, int N>
+kdforest<T,N> build_kdforest( std::vector<std::array<T,N>> const& data, kdforest_params const& params = kdforest_params() ){
+    return build_kdforest_from<T,N>( data, params );
+}
+
+template<typename T, int N>
+kdforest<T,N> build_kdforest( std::deque<std::array<T,N>> const& data, kdforest_params const& params = kdforest_params() ){
+    return build_kdforest_from<T,N>( data, params );
+}
+
+template<typename T, int N>
+kdforest<T,N> build_kdforest( std::list<std::array<T,N>> const& data, kdforest_params const& params = kdforest_params() ){
+    return build_kdforest_from<T,N>( data, params );
+}
+
+/**
+ * @brief Scratch memory of the forest queries, reused across the queries of a thread so that they do not allocate:
+ * the priority queue, the per-dimension offsets of the queued subtrees and a stamp per point that marks the points
+ * already checked by the current query, since every point appears once in every tree.
+ */
+template<typename T, int N>
+struct kdforest_search_context {
+    struct pending {
+        T      m_rd;
+        size_t m_tree;
+        size_t m_node;
+        size_t m_offsets;   // position of the offsets of the subtree in m_offsets
+
+        bool operator>( pending const& other ) const { return m_rd > other.m_rd; }
+    };
+
+    std::vector<pending>  m_queue;
+    std::vector<T>        m_offsets;
+    std::vector<T>        m_queries;      // the query point projected on the axes of every tree
+    std::vector<unsigned> m_stamps;
+    unsigned              m_stamp = 0;
+
+    void reset( size_t numPoints, size_t numTrees ){
+        m_queue.clear();
+        m_offsets.clear();
+        m_queries.resize(numTrees * N);
+        if( m_stamps.size() != numPoints || m_stamp == std::numeric_limits<unsigned>::max() ){
+            m_stamps.assign(numPoints, 0);
+            m_stamp = 0;
+        }
+        m_stamp += 1;
+    }
+};
+
+/**
+ * @brief Approximate k nearest neighbours of queryPoint in the forest. Every tree is entered at its root and all
+ * trees share one priority queue of subtrees ordered by their distance from the query point: the nearest queued
+ * subtree is descended to its nearest leaf, queuing the farther child at every node. The search stops after
+ * max_checks distance evaluations (but not before k points were checked) or when the nearest queued subtree is
+ * farther than the current k-th neighbour divided by (1 + epsilon). With an unlimited budget and epsilon = 0 the
+ * result is exact.
+ *
+ * @param result ids and Euclidean distances of the neighbours found, sorted by increasing distance.
+ * @param max_checks budget of points whose distance is computed, which controls the recall.
+ * @param context scratch memory, reused across the queries of a thread.
+ * @param stats number of nodes and points visited by this query.
+ */
+template<typename T, int N>
+void knn_query( kdforest<T,N> const& forest, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    size_t max_checks, kdforest_search_context<T,N> & context, search_stats & stats, T epsilon = 0 ){
+
+    using pending = typename kdforest_search_context<T,N>::pending;
+
+    stats = search_stats();
+    result.clear();
+    if( forest.empty() || k == 0 )
+        return;
+
+    context.reset( forest.size(), forest.numTrees() );
+    std::vector<pending> & queue = context.m_queue;
+    std::vector<T> & pool = context.m_offsets;
+    std::array<T,N> offsets;
+
+    for( size_t t(0); t < forest.numTrees(); ++t ){
+        forest.project( t, queryPoint, &context.m_queries[t * N] );
+        pending root = { T(0), t, 0, pool.size() };
+        pool.resize( pool.size() + N, T(0) );
+        queue.push_back( root );
+    }
+
+    T factor = ( 1 + epsilon ) * ( 1 + epsilon );
+    size_t checks = 0;
+    while( !queue.empty() ){
+        std::pop_heap( queue.begin(), queue.end(), std::greater<pending>() );
+        pending next = queue.back();
+        queue.pop_back();
+
+        if( next.m_rd * factor > neighbor_bound(result, k) )
+            break;
+        if( checks >= max_checks && result.size() == k )
+            break;
+
+        kdforest_tree<T> const& tree = forest.getTree(next.m_tree);
+        T const* q = &context.m_queries[next.m_tree * N];
+        std::copy( pool.begin() + next.m_offsets, pool.begin() + next.m_offsets + N, offsets.begin() );
+        T rd = next.m_rd;
+        size_t index = next.m_node;
+
+        // descend to the nearest leaf, queuing the farther child of every node on the way. The distance of the
+        // farther child is updated incrementally from the offsets of the query point from its cell.
+        while( true ){
+            flat_node_t<T> const& node = tree.m_nodes[index];
+            stats.m_nodes_visited += 1;
+
+            if( node.isLeaf() ){
+                for( size_t i(node.m_begin); i < node.m_end; ++i ){
+                    size_t id = tree.m_ids[i];
+                    if( context.m_stamps[id] == context.m_stamp )
+                        continue;
+                    context.m_stamps[id] = context.m_stamp;
+                    push_neighbor( result, k, id, squared_distance<T,N>(queryPoint, forest.getPoint(id)) );
+                    checks += 1;
+                }
+                stats.m_points_visited += node.size();
+                break;
+            }
+
+            int dim = node.m_split_dim;
+            T diff = q[dim] - node.m_split_value;
+            T farRd = rd - offsets[dim] * offsets[dim] + diff * diff;
+            if( farRd * factor <= neighbor_bound(result, k) ){
+                pending far = { farRd, next.m_tree, diff < 0 ? node.m_right : node.m_left, pool.size() };
+                pool.insert( pool.end(), offsets.begin(), offsets.end() );
+                pool[far.m_offsets + dim] = diff;
+                queue.push_back( far );
+                std::push_heap( queue.begin(), queue.end(), std::greater<pending>() );
+            }
+            index = diff < 0 ? node.m_left : node.m_right;
+        }
+    }
+
+    finalize_neighbors( result );
+}
+
+template<typename T, int N>
+void knn_query( kdforest<T,N> const& forest, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    size_t max_checks, kdforest_search_context<T,N> & context ){
+    search_stats stats;
+    knn_query<T,N>(forest, queryPoint, k, result, max_checks, context, stats);
+}
+
+template<typename T, int N>
+std::vector<neighbor<T>> knn_query( kdforest<T,N> const& forest, std::array<T,N> const& queryPoint, size_t k, size_t max_checks ){
+    kdforest_search_context<T,N> context;
+    std::vector<neighbor<T>> result;
+    result.reserve(k);
+    knn_query<T,N>(forest, queryPoint, k, result, max_checks, context);
+    return result;
+}
@@ -1,10 +1,20 @@
 #pragma once
 
 #include <algorithm>
+#include <iostream>
+#include <cmath>
 #include <vector>
 #include <array>
 #include <deque>
 #include <list>
+#include <limits>
+#include <functional>
+#include <utility>
+
+#include "metrics.hpp"
+#include "node_arena.hpp"
+#include "query_stats.hpp"
+#include "trace.hpp"
 
 /**
  * @brief Each multi-dimensional value in a key has a unique id that makes it retrievable from the initial dataset.
@@ -19,8 +29,68 @@ struct key{
 };
 
 /**
- * @brief Each note holds a key and a dataset to pass in successor nodes dusing construction. When the tree 
- * is fully constructed the datasets in all nodes are empty.
+ * @brief A neighbour found by the k-nearest-neighbour queries: the id of the point and its distance from the query
+ * point. Neighbours are ordered by distance and, for equal distances, by id so that results are deterministic.
+ */
+template<typename T>
+struct neighbor {
+    size_t m_id;
+    T      m_distance;
+
+    bool operator<( neighbor const& other ) const {
+        return m_distance < other.m_distance || ( m_distance == other.m_distance && m_id < other.m_id );
+    }
+};
+
+/**
+ * @brief Offers a candidate to a bounded max-heap that keeps the k smallest neighbours seen so far, the largest
+ * one at heap.front(). The heap never grows beyond k elements, so with heap.capacity() >= k it never allocates.
+ */
+template<typename T>
+void push_neighbor( std::vector<neighbor<T>> & heap, size_t k, size_t id, T distance ){
+    neighbor<T> candidate = { id, distance };
+    if( heap.size() < k ){
+        heap.push_back( candidate );
+        std::push_heap( heap.begin(), heap.end() );
+    } else if( candidate < heap.front() ){
+        std::pop_heap( heap.begin(), heap.end() );
+        heap.back() = candidate;
+        std::push_heap( heap.begin(), heap.end() );
+    }
+}
+
+/**
+ * @brief Largest distance a candidate may have to enter the heap of push_neighbor.
+ */
+template<typename T>
+T neighbor_bound( std::vector<neighbor<T>> const& heap, size_t k ){
+    return heap.size() < k ? std::numeric_limits<T>::max() : heap.front().m_distance;
+}
+
+/**
+ * @brief Turns the heap filled with reduced distances of the metric (see metrics.hpp) into the final result:
+ * actual distances sorted in increasing order.
+ */
+template<typename T, typename Metric>
+void finalize_neighbors( std::vector<neighbor<T>> & heap, Metric const& metric ){
+    std::sort_heap( heap.begin(), heap.end() );
+    for( neighbor<T> & e : heap )
+        e.m_distance = metric.actual( e.m_distance );
+}
+
+/**
+ * @brief Turns the heap filled with squared distances into the final result: sorted by increasing distance.
+ */
+template<typename T>
+void finalize_neighbors( std::vector<neighbor<T>> & heap ){
+    std::sort_heap( heap.begin(), heap.end() );
+    for( neighbor<T> & e : heap )
+        e.m_distance = std::sqrt( e.m_distance );
+}
+
+/**
+ * @brief Each node holds one key of the tree and splits the space of its subtree at the value of that key along
+ * m_split_dim: its left subtree holds the keys with smaller values and its right subtree the others.
  * 
  * @tparam T type of data.
  * @tparam N number of dimensions.
@@ -28,210 +98,305 @@ struct key{
 template<typename T, int N>
 struct node_t {
     using key_type = key<T,N>;
-    using dataset_type = std::deque<key_type>;
     
-    key_type     m_key;
-    dataset_type m_dataset;
-    bool m_is_leaf;
-    int  m_split_dim;
+    key_type m_key;
+    int     m_split_dim = 0;
+    size_t  m_size = 1;         // number of keys in the subtree rooted at this node, tombstones excluded
+    size_t  m_num_deleted = 0;  // number of tombstones in the subtree rooted at this node
+    bool    m_deleted = false;  // m_key was removed by remove_from_kdtree but is kept until the next rebuild
     node_t* m_left = nullptr;
     node_t* m_right = nullptr;
 
     node_t<T,N> & operator=( node_t<T,N> const& ) = delete;
     node_t<T,N>( node_t<T,N> const& ) = delete;
 
-    node_t( dataset_type dataset ) : m_dataset(dataset) {
-        m_is_leaf = true;
-        m_left = nullptr;
-        m_right = nullptr;
-    }
+    explicit node_t( key_type const& k ) : m_key(k) {}
 
     ~node_t() = default;
 
-    bool isLeaf()       const { return m_is_leaf; }
+    bool isLeaf()       const { return m_left == nullptr && m_right == nullptr; }
     int getID()         const { return m_key.m_id; }
     T getValue( int i ) const { return m_key.m_value.at(i); }
     node_t *getLeft()   const { return m_left; }
     node_t *getRight()  const { return m_right; }
+    size_t size()       const { return m_size; }
 };
 
+/**
+ * @brief Creates a node holding the key k in the arena, if one is given, and with new otherwise.
+ */
 template<typename T, int N>
-node_t<T,N> *make_new_node( std::deque<key<T,N>> dataset, bool verbose = false ){
-    if ( verbose )
-        std::cout << "Called make_new_node" << std::endl;
+node_t<T,N> *make_new_node( key<T,N> const& k, bool verbose = false, node_arena<T,N> * arena = nullptr ){
+    kdtree_trace( trace_kind::node_created, "make_new_node", uint64_t(k.m_id), verbose );
+
+    if ( arena )
+        return arena->create( k );
 
-    return new node_t<T,N>( dataset );
+    return new node_t<T,N>( k );
 }
 
 template<typename T, int N>
-T compare( std::array<T,N> const& a, std::array<T,N> const& b ){
+T squared_distance( std::array<T,N> const& a, std::array<T,N> const& b ){
     T s = 0;
     for( int dim(0); dim < N; ++dim )
-        s += std::pow( a[dim] - b[dim] ,2);
-    
-    return std::sqrt(s);
-}
+        s += ( a[dim] - b[dim] ) * ( a[dim] - b[dim] );
 
-template<typename T, int N>
-T find_min( std::deque<key<T,N>> const& dataset, int dim, bool verbose = false ){
-    T min_value = 1e9;
-    for( key<T,N> const& e : dataset )
-        if ( e.m_value[dim] < min_value )
-            min_value = e.m_value[dim];
-    return min_value;
+    return s;
 }
 
 template<typename T, int N>
-T find_max( std::deque<key<T,N>> const& dataset, int dim, bool verbose = false ){
-    T max_value = -1e9;
-    for( key<T,N> const& e : dataset )
-        if ( e.m_value[dim] > max_value )
-            max_value = e.m_value[dim];
-    return max_value;
+T compare( std::array<T,N> const& a, std::array<T,N> const& b ){
+    return std::sqrt( squared_distance<T,N>(a, b) );
 }
 
+/**
+ * @brief Axis-aligned box [m_lo, m_hi] (bounds included) used by the range queries. Like radius_range it answers
+ * whether a point is inside the range and whether the cell [lo, hi] of a tree node intersects or is contained in it.
+ */
 template<typename T, int N>
-int find_dim_with_highest_spread(  std::deque<key<T,N>> const& dataset, bool verbose = false ){
-    
-    T max_spread = 0;
-    int max_dim = 0;
-    for( int dim(0); dim < N; ++dim ){
-        T min_value = find_min(dataset,dim,verbose);
-        T max_value = find_max(dataset,dim,verbose);
-        T spread = std::abs(max_value - min_value);
-        if ( spread > max_spread ){
-            max_spread = spread;
-            max_dim = dim;
-        }
+struct box_range {
+    std::array<T,N> m_lo;
+    std::array<T,N> m_hi;
+
+    bool contains( std::array<T,N> const& p ) const {
+        for( int dim(0); dim < N; ++dim )
+            if( p[dim] < m_lo[dim] || p[dim] > m_hi[dim] )
+                return false;
+        return true;
     }
-    
-    return max_dim;
-}
 
-template<typename T, int N>
-key<T,N> find_median_of_selected_dim(  std::deque<key<T,N>> & dataset, int dim, bool verbose = false ){
-
-    // copy the values of the dim of interest in a vector and sort them; then find the median.
-    std::vector<T> vec(dataset.size());
-    for( size_t i(0); i<vec.size(); ++i )
-        vec[i] = dataset[i].m_value[dim];
-    std::sort(vec.begin(), vec.end());
-    T median = vec[vec.size()/2];
-
-    // loop over the dataset over the dim of interest and identify the key that corresponds to the median.
-    int target;
-    T closest = 1e9;
-    key<T,N> median_key;
-    for( size_t i(0); i < dataset.size(); ++i ){
-        T diff = std::abs(dataset[i].m_value[dim] - median);
-        if ( diff < closest ){
-            median_key = dataset[i];
-            target = i;
-            closest = diff;
-        }
+    bool intersects_cell( std::array<T,N> const& lo, std::array<T,N> const& hi ) const {
+        for( int dim(0); dim < N; ++dim )
+            if( lo[dim] > m_hi[dim] || hi[dim] < m_lo[dim] )
+                return false;
+        return true;
     }
 
-    // the key is removed from the dataset before it is returned as the output of this function.
-    dataset.erase(dataset.begin()+target);
+    bool contains_cell( std::array<T,N> const& lo, std::array<T,N> const& hi ) const {
+        for( int dim(0); dim < N; ++dim )
+            if( lo[dim] < m_lo[dim] || hi[dim] > m_hi[dim] )
+                return false;
+        return true;
+    }
+};
 
-    return median_key;
-}
+/**
+ * @brief Ball of radius m_radius (boundary included) around m_center under the metric (see metrics.hpp) used by
+ * the range queries.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+struct radius_range {
+    std::array<T,N> m_center;
+    T               m_radius;
+    Metric          m_metric;
 
-template<typename T, int N>
-void split_the_dataset_in_two_based_on_median( T median, int dim, std::deque<key<T,N>> & dataset,
-    std::deque<key<T,N>> & dataset_left, std::deque<key<T,N>> & dataset_right ){
-    dataset_left.clear();
-    dataset_right.clear();
-    while( dataset.size() > 0 ){
-        if( dataset[0].m_value[dim] < median ){
-            dataset_left.push_back(dataset[0]);
-        } else {
-            dataset_right.push_back(dataset[0]);
-        }
-        dataset.pop_front();
+    bool contains( std::array<T,N> const& p ) const {
+        return metric_distance<T,N>(m_metric, p, m_center) <= m_metric.reduced(m_radius);
     }
-}
 
+    bool intersects_cell( std::array<T,N> const& lo, std::array<T,N> const& hi ) const {
+        T rd = 0;
+        for( int dim(0); dim < N; ++dim )
+            rd = m_metric.combine( rd, m_metric.interval_component(m_center[dim], lo[dim], hi[dim], dim) );
+        return rd <= m_metric.reduced(m_radius);
+    }
+
+    bool contains_cell( std::array<T,N> const& lo, std::array<T,N> const& hi ) const {
+        T rd = 0;
+        for( int dim(0); dim < N; ++dim )
+            rd = m_metric.combine( rd, m_metric.farthest_component(m_center[dim], lo[dim], hi[dim], dim) );
+        return rd <= m_metric.reduced(m_radius);
+    }
+};
+
+/**
+ * @brief Points of an indexed container (std::vector or std::deque) as seen by kdtree_builder: the id of a point
+ * is its index.
+ */
+template<typename T, int N, typename Container>
+struct indexed_points {
+    Container const& m_data;
+
+    size_t size()                               const { return m_data.size(); }
+    std::array<T,N> const& value( size_t i )    const { return m_data[i]; }
+    size_t id( size_t i )                       const { return i; }
+};
+
+/**
+ * @brief Points of a container without random access (std::list), reached through one pointer per point.
+ */
+template<typename T, int N>
+struct pointed_points {
+    std::vector<std::array<T,N> const*> m_data;
+
+    size_t size()                               const { return m_data.size(); }
+    std::array<T,N> const& value( size_t i )    const { return *m_data[i]; }
+    size_t id( size_t i )                       const { return i; }
+};
+
+/**
+ * @brief Keys collected from a tree, which keep their ids when the tree is rebuilt from them.
+ */
 template<typename T, int N>
-void split_balanced(node_t<T,N> * node, bool verbose = false){
-    if( node->m_dataset.size() > 3 ){
-        // find the dim with the highest stdev
-        int dim = find_dim_with_highest_spread(node->m_dataset, verbose);
-        node->m_split_dim = dim;
-        
-        // find the median key based on the selected dim
-        key<T,N> median_key = find_median_of_selected_dim(node->m_dataset, dim, verbose);
-        node->m_key = median_key;
-
-        // split the dataset in two based on the median
-        std::deque<key<T,N>> dataset_left, dataset_right;
-        T median = median_key.m_value[dim];
-        split_the_dataset_in_two_based_on_median(median, dim, node->m_dataset, dataset_left, dataset_right );
-        
-        // create left node and continue spliting
-        if(dataset_left.size()>0){
-            node->m_left = make_new_node(dataset_left, verbose);
-            split_balanced(node->m_left, verbose);
+struct key_points {
+    std::vector<key<T,N>> const& m_data;
+
+    size_t size()                               const { return m_data.size(); }
+    std::array<T,N> const& value( size_t i )    const { return m_data[i].m_value; }
+    size_t id( size_t i )                       const { return m_data[i].m_id; }
+};
+
+/**
+ * @brief Builds a tree of one key per node from points (see indexed_points) without copying them: every split
+ * reorders a range of a single permutation of point indices in place. A range is split along its dimension of
+ * highest spread at its median; the median key goes to the node, the smaller values to the left subtree and the
+ * rest to the right one. The larger subtree of every node is built by iteration rather than recursion, so the
+ * stack stays O(log n) deep whatever the data, and the memory of the build is the permutation plus the nodes.
+ */
+template<typename T, int N, typename Points>
+class kdtree_builder {
+    private:
+        Points const&       m_points;
+        node_arena<T,N> *   m_arena;
+        std::vector<size_t> m_perm;
+
+        key<T,N> make_key( size_t i ) const {
+            key<T,N> k;
+            k.m_id = m_points.id(i);
+            k.m_value = m_points.value(i);
+            return k;
+        }
+
+        int find_dim_with_highest_spread( size_t begin, size_t end ) const {
+            T max_spread = 0;
+            int max_dim = 0;
+            for( int dim(0); dim < N; ++dim ){
+                T min_value = m_points.value( m_perm[begin] )[dim];
+                T max_value = min_value;
+                for( size_t i(begin + 1); i < end; ++i ){
+                    T v = m_points.value( m_perm[i] )[dim];
+                    min_value = std::min( min_value, v );
+                    max_value = std::max( max_value, v );
+                }
+                if ( max_value - min_value > max_spread ){
+                    max_spread = max_value - min_value;
+                    max_dim = dim;
+                }
+            }
+            return max_dim;
         }
 
-        if ( verbose )
-            std::cout << node->m_key.m_id << ", " << node->m_key.m_value[0] << std::endl;
+        // places the median key of the range along dim at the returned position, the smaller values before it.
+        size_t select_median( size_t begin, size_t end, int dim ){
+            Points const& points = m_points;
+            auto less = [&points, dim]( size_t a, size_t b ){
+                T va = points.value(a)[dim], vb = points.value(b)[dim];
+                return va < vb || ( va == vb && a < b );
+            };
+            size_t mid = begin + ( end - begin ) / 2;
+            std::nth_element( m_perm.begin() + begin, m_perm.begin() + mid, m_perm.begin() + end, less );
 
-        // create right node and continue spliting
-        if(dataset_right.size()>0){
-            node->m_right = make_new_node(dataset_right, verbose);
-            split_balanced(node->m_right, verbose);   
+            // the keys equal to the median on dim belong to the right subtree, the first of them becomes the node.
+            T median = points.value( m_perm[mid] )[dim];
+            auto first = std::partition( m_perm.begin() + begin, m_perm.begin() + mid,
+                [&points, dim, median]( size_t i ){ return points.value(i)[dim] < median; } );
+            std::iter_swap( first, m_perm.begin() + mid );
+            return first - m_perm.begin();
         }
-    }
 
-    if ( node->m_left || node->m_right )
-        node->m_is_leaf = false;
+        // fills node with the subtree of the points m_perm[begin, end), begin < end.
+        void split( node_t<T,N> * node, size_t begin, size_t end ){
+            while( true ){
+                int dim = end - begin > 1 ? find_dim_with_highest_spread(begin, end) : 0;
+                size_t pivot = select_median(begin, end, dim);
 
-    if( node->isLeaf() )
-        if ( verbose )
-            std::cout << "reached leaf node!" << std::endl;
-}
+                node->m_key = make_key( m_perm[pivot] );
+                node->m_split_dim = dim;
+                node->m_size = end - begin;
+                node->m_num_deleted = 0;
+                node->m_deleted = false;
+                node->m_left = nullptr;
+                node->m_right = nullptr;
 
-template<typename T, int N>
-node_t<T,N> * build_kdtree( std::deque<std::array<T,N>> const& data ){
-    std::cout << "Called build_kdtree( std::deque )" << std::endl;
+                // the children get their keys when they are split, the one given to make_new_node is a placeholder.
+                if( pivot > begin )
+                    node->m_left = make_new_node<T,N>( node->m_key, false, m_arena );
+                if( pivot + 1 < end )
+                    node->m_right = make_new_node<T,N>( node->m_key, false, m_arena );
+
+                if( node->isLeaf() )
+                    return;
+                if( pivot - begin < end - pivot - 1 ){
+                    if( node->m_left )
+                        split( node->m_left, begin, pivot );
+                    node = node->m_right;
+                    begin = pivot + 1;
+                } else {
+                    if( node->m_right )
+                        split( node->m_right, pivot + 1, end );
+                    node = node->m_left;
+                    end = pivot;
+                }
+            }
+        }
 
-    std::deque<key<T,N>> dataset;
+    public:
+        kdtree_builder( Points const& points, node_arena<T,N> * arena = nullptr )
+            : m_points(points), m_arena(arena), m_perm(points.size()) {
+            for( size_t i(0); i < m_perm.size(); ++i )
+                m_perm[i] = i;
+        }
 
-    for( size_t i(0); i < data.size(); ++i ){
-        key<T,N> k;
-        k.m_id = i;
-        k.m_value = data[i];
-        dataset.emplace_back( k );
-    }
+        /**
+         * @brief Rebuilds the subtree of node, which must have no children, from all the points. Without points
+         * node becomes a tombstone: a tree without keys is a single deleted node.
+         */
+        void build( node_t<T,N> * node ){
+            if( m_perm.empty() ){
+                node->m_size = 0;
+                node->m_num_deleted = 1;
+                node->m_deleted = true;
+                return;
+            }
+            split( node, 0, m_perm.size() );
+        }
 
-    node_t<T,N> * root = new node_t<T,N>( dataset );
+        node_t<T,N> * build(){
+            node_t<T,N> * root = make_new_node<T,N>( key<T,N>(), false, m_arena );
+            build( root );
+            return root;
+        }
+};
 
-    split_balanced(root);
+/**
+ * @brief Builds the tree with its nodes allocated in arena, if one is given, or with new otherwise. A tree built
+ * in an arena is freed by clearing the arena instead of destroy_kdtree.
+ */
+template<typename T, int N>
+node_t<T,N> * build_kdtree( std::deque<std::array<T,N>> const& data, node_arena<T,N> * arena = nullptr ){
+    kdtree_trace( trace_kind::build, "build_kdtree( std::deque )", uint64_t(data.size()) );
 
-    return root;
+    indexed_points<T,N,std::deque<std::array<T,N>>> points = { data };
+    return kdtree_builder<T,N,decltype(points)>( points, arena ).build();
 }
 
 template<typename T, int N>
-node_t<T,N> * build_kdtree( std::vector<std::array<T,N>> const& data ){
-    std::cout << "Called build_kdtree( std::vector )" << std::endl;
+node_t<T,N> * build_kdtree( std::vector<std::array<T,N>> const& data, node_arena<T,N> * arena = nullptr ){
+    kdtree_trace( trace_kind::build, "build_kdtree( std::vector )", uint64_t(data.size()) );
 
-    std::deque<std::array<T,N>> tempData;
-    for( auto e : data )
-        tempData.emplace_back(e);
-    
-    return build_kdtree<T,N>( tempData );
+    indexed_points<T,N,std::vector<std::array<T,N>>> points = { data };
+    return kdtree_builder<T,N,decltype(points)>( points, arena ).build();
 }
 
 template<typename T, int N>
-node_t<T,N> * build_kdtree( std::list<std::array<T,N>> const& data ){
-    std::cout << "Called build_kdtree( std::list )" << std::endl;
+node_t<T,N> * build_kdtree( std::list<std::array<T,N>> const& data, node_arena<T,N> * arena = nullptr ){
+    kdtree_trace( trace_kind::build, "build_kdtree( std::list )", uint64_t(data.size()) );
 
-    std::deque<std::array<T,N>> tempData;
-    for( auto e : data )
-        tempData.emplace_back(e);
-    
-    return build_kdtree<T,N>( tempData );
+    pointed_points<T,N> points;
+    points.m_data.reserve( data.size() );
+    for( std::array<T,N> const& e : data )
+        points.m_data.push_back( &e );
+    return kdtree_builder<T,N,pointed_points<T,N>>( points, arena ).build();
 }
 
 template<typename T, int N>
@@ -246,8 +411,6 @@ void print_kdtree( node_t<T,N> * node ){
         if(node->m_right)
             std::cout << node->m_right->m_key.m_value[0] << " ";
     }
-    std::cout << " - dataset.size() = " << node->m_dataset.size() << " : ";
-    for( auto e : node->m_dataset ) std::cout << e.m_value[0] << " ";
     std::cout << std::endl;
 
     if(node->m_right)
@@ -256,11 +419,10 @@ void print_kdtree( node_t<T,N> * node ){
 
 template<typename T, int N>
 void destroy_kdtree( node_t<T,N> * node, bool verbose = false ){
-    if (verbose)
-        std::cout << "destroying node " << node->getID() << std::endl;
-
     if (node == nullptr) return;
 
+    kdtree_trace( trace_kind::node_destroyed, "destroy_kdtree", uint64_t(node->m_key.m_id), verbose );
+
     if (node->m_left)
         destroy_kdtree(node->m_left,verbose);
 
@@ -270,20 +432,43 @@ void destroy_kdtree( node_t<T,N> * node, bool verbose = false ){
     delete node;
 }
 
+/**
+ * @brief Frees the subtree of node: with destroy_kdtree, or by returning its nodes to the arena it was built in.
+ */
 template<typename T, int N>
-void depth_search( node_t<T,N> * node, std::array<T,N> const& queryPoint, key<T,N> &closest, T &distance, int & nDepths, bool verbose = false ){
+void destroy_kdtree( node_t<T,N> * node, node_arena<T,N> * arena ){
+    if ( arena == nullptr ){
+        destroy_kdtree(node);
+        return;
+    }
+
+    if (node->m_left)
+        destroy_kdtree(node->m_left, arena);
+
+    if (node->m_right)
+        destroy_kdtree(node->m_right, arena);
+
+    arena->release(node);
+}
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+void depth_search( node_t<T,N> * node, std::array<T,N> const& queryPoint, key<T,N> &closest, T &distance, int & nDepths,
+    search_stats & stats, bool verbose = false, Metric const& metric = Metric() ){
 
     nDepths+=1;
+    stats.m_nodes_visited += 1;
 
     if(node->isLeaf()){
-        std::cout << "reached leaf node: " << node->m_key.m_value[0] << std::endl;
+        stats.m_leaves_visited += 1;
+        kdtree_trace( trace_kind::leaf_reached, "depth_search", double(node->m_key.m_value[0]), verbose );
         return;
     }
 
     // find distance from node expanding on the left
     T distance_left;
     if(node->m_left){
-        distance_left = compare<T,N>(queryPoint, node->m_left->m_key.m_value);
+        distance_left = metric.actual( metric_distance<T,N>(metric, queryPoint, node->m_left->m_key.m_value) );
+        stats.m_points_visited += 1;
     } else {
         distance_left = 1e9;
     }
@@ -291,35 +476,720 @@ void depth_search( node_t<T,N> * node, std::array<T,N> const& queryPoint, key<T,
     // find distance from node expanding on the right
     T distance_right;
     if(node->m_right){
-        distance_right = compare<T,N>(queryPoint, node->m_right->m_key.m_value);
+        distance_right = metric.actual( metric_distance<T,N>(metric, queryPoint, node->m_right->m_key.m_value) );
+        stats.m_points_visited += 1;
     } else {
         distance_right = 1e9;
     }
 
+    // the greedy descent never returns to the child it does not take.
+    stats.m_subtrees_pruned += node->m_left && node->m_right;
+
     // select the next node to proceed based on proximity!
     // before jumping to the next node update the closest point if found a point that is closer.
     if( distance_left < distance_right ){
-        if(verbose)
-            std::cout << "going left\n";
-        closest  = distance_left < distance ? node->m_left->m_key : closest;
-        distance = distance_left < distance ? distance_left : distance;
-        depth_search<T,N>(node->m_left,queryPoint,closest,distance,nDepths,verbose);
+        kdtree_trace( trace_kind::descend_left, "depth_search", double(distance_left), verbose );
+        if( distance_left < distance && !node->m_left->m_deleted ){
+            closest  = node->m_left->m_key;
+            distance = distance_left;
+        }
+        depth_search<T,N>(node->m_left,queryPoint,closest,distance,nDepths,stats,verbose,metric);
     } else {
-        if(verbose)
-            std::cout << "going right\n";
-        closest  = distance_right < distance ? node->m_right->m_key : closest;
-        distance = distance_right < distance ? distance_right : distance;
-        depth_search<T,N>(node->m_right,queryPoint,closest,distance,nDepths,verbose);
+        kdtree_trace( trace_kind::descend_right, "depth_search", double(distance_right), verbose );
+        if( distance_right < distance && !node->m_right->m_deleted ){
+            closest  = node->m_right->m_key;
+            distance = distance_right;
+        }
+        depth_search<T,N>(node->m_right,queryPoint,closest,distance,nDepths,stats,verbose,metric);
     }
 }
 
-template<typename T, int N>
-key<T,N> ann_search( node_t<T,N> * root, std::array<T,N> queryPoint, int & nDepths, bool verbose = false ){
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+void depth_search( node_t<T,N> * node, std::array<T,N> const& queryPoint, key<T,N> &closest, T &distance, int & nDepths, bool verbose = false,
+    Metric const& metric = Metric() ){
+    search_stats stats;
+    depth_search<T,N>(node,queryPoint,closest,distance,nDepths,stats,verbose,metric);
+}
+
+/**
+ * @brief Approximate nearest neighbour of queryPoint by a greedy descent towards the closer child, without
+ * backtracking.
+ *
+ * @param nDepths number of levels descended.
+ * @param stats counters of this query; the child not taken at every level counts as pruned.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> ann_search( node_t<T,N> * root, std::array<T,N> queryPoint, int & nDepths, search_stats & stats, bool verbose = false,
+    Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    query_scope scope( query_kind::ann, stats );
 
     key<T,N> closest = root->m_key;
-    T distance = compare<T,N>(queryPoint,closest.m_value);
+    T distance = std::numeric_limits<T>::max();
+    if( !root->m_deleted ){
+        distance = metric.actual( metric_distance<T,N>(metric, queryPoint, closest.m_value) );
+        stats.m_points_visited += 1;
+    }
     nDepths = 0;
-    depth_search<T,N>(root,queryPoint,closest,distance,nDepths,verbose);
+    depth_search<T,N>(root,queryPoint,closest,distance,nDepths,stats,verbose,metric);
 
     return closest;
 }
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> ann_search( node_t<T,N> * root, std::array<T,N> queryPoint, int & nDepths, bool verbose = false, Metric const& metric = Metric() ){
+    search_stats stats;
+    return ann_search<T,N>(root,queryPoint,nDepths,stats,verbose,metric);
+}
+
+/**
+ * @brief Recursive part of nn_search. Visits the child on the side of the query point first and backtracks into
+ * the other child only if its cell is closer than the best point found so far. distance is the reduced distance
+ * (see metrics.hpp) of the best point, the squared distance for the Euclidean metric.
+ */
+template<typename T, int N, typename Metric>
+void nn_search_node( node_t<T,N> const* node, std::array<T,N> const& queryPoint, search_cell<T,N> & cell,
+    key<T,N> & closest, T & distance, search_stats & stats, Metric const& metric ){
+
+    stats.m_nodes_visited += 1;
+    stats.m_leaves_visited += node->isLeaf();
+
+    if( !node->m_deleted ){
+        T d = metric_distance<T,N>(metric, queryPoint, node->m_key.m_value);
+        stats.m_points_visited += 1;
+        if( d < distance ){
+            distance = d;
+            closest = node->m_key;
+        }
+    }
+
+    // the left subtree holds values < split and the right subtree values >= split.
+    int dim = node->m_split_dim;
+    T split = node->m_key.m_value[dim];
+    bool nearUpper = !( queryPoint[dim] < split );
+    node_t<T,N> const* near = nearUpper ? node->m_right : node->m_left;
+    node_t<T,N> const* far  = nearUpper ? node->m_left : node->m_right;
+
+    if( near && near->size() > 0 ){
+        typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, split, queryPoint, metric);
+        if( cell.m_rd < distance )
+            nn_search_node<T,N>(near, queryPoint, cell, closest, distance, stats, metric);
+        else
+            stats.m_subtrees_pruned += 1;
+        cell.restore(dim, nearUpper, state);
+    }
+    if( far && far->size() > 0 ){
+        typename search_cell<T,N>::saved_state state = cell.narrow(dim, !nearUpper, split, queryPoint, metric);
+        if( cell.m_rd < distance ){
+            stats.m_backtracks += 1;
+            nn_search_node<T,N>(far, queryPoint, cell, closest, distance, stats, metric);
+        } else {
+            stats.m_subtrees_pruned += 1;
+        }
+        cell.restore(dim, !nearUpper, state);
+    }
+}
+
+/**
+ * @brief Exact nearest neighbour of queryPoint. Unlike ann_search it backtracks into every subtree that may still
+ * contain a closer point, pruning the rest by the distance to their cells.
+ *
+ * @param stats counters of this query, see search_stats.
+ * @param metric distance metric policy, see metrics.hpp.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+key<T,N> nn_search( node_t<T,N> const* root, std::array<T,N> const& queryPoint, search_stats & stats, Metric const& metric = Metric() ){
+    stats = search_stats();
+    query_scope scope( query_kind::nn, stats );
+    key<T,N> closest = key<T,N>();
+    if( root == nullptr )
+        return closest;
+
+    T distance = std::numeric_limits<T>::max();
+    search_cell<T,N> cell;
+    nn_search_node<T,N>(root, queryPoint, cell, closest, distance, stats, metric);
+
+    return closest;
+}
+
+template<typename T, int N>
+key<T,N> nn_search( node_t<T,N> const* root, std::array<T,N> const& queryPoint ){
+    search_stats stats;
+    return nn_search<T,N>(root, queryPoint, stats);
+}
+
+/**
+ * @brief Recursive part of knn_query, see nn_search_node. Subtrees are skipped only when their cell is strictly
+ * farther than the current k-th neighbour, so ties are resolved by id exactly as in a brute-force search.
+ */
+template<typename T, int N, typename Metric>
+void knn_query_node( node_t<T,N> const* node, std::array<T,N> const& queryPoint, size_t k, search_cell<T,N> & cell,
+    std::vector<neighbor<T>> & heap, search_stats & stats, Metric const& metric ){
+
+    stats.m_nodes_visited += 1;
+    stats.m_leaves_visited += node->isLeaf();
+
+    if( !node->m_deleted ){
+        push_neighbor( heap, k, node->m_key.m_id, metric_distance<T,N>(metric, queryPoint, node->m_key.m_value) );
+        stats.m_points_visited += 1;
+    }
+
+    int dim = node->m_split_dim;
+    T split = node->m_key.m_value[dim];
+    bool nearUpper = !( queryPoint[dim] < split );
+    node_t<T,N> const* near = nearUpper ? node->m_right : node->m_left;
+    node_t<T,N> const* far  = nearUpper ? node->m_left : node->m_right;
+
+    if( near && near->size() > 0 ){
+        typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, split, queryPoint, metric);
+        if( cell.m_rd <= neighbor_bound(heap, k) )
+            knn_query_node<T,N>(near, queryPoint, k, cell, heap, stats, metric);
+        else
+            stats.m_subtrees_pruned += 1;
+        cell.restore(dim, nearUpper, state);
+    }
+    if( far && far->size() > 0 ){
+        typename search_cell<T,N>::saved_state state = cell.narrow(dim, !nearUpper, split, queryPoint, metric);
+        if( cell.m_rd <= neighbor_bound(heap, k) ){
+            stats.m_backtracks += 1;
+            knn_query_node<T,N>(far, queryPoint, k, cell, heap, stats, metric);
+        } else {
+            stats.m_subtrees_pruned += 1;
+        }
+        cell.restore(dim, !nearUpper, state);
+    }
+}
+
+/**
+ * @brief Exact k nearest neighbours of queryPoint, sorted by increasing distance. The candidates are kept in a
+ * bounded max-heap and subtrees farther than the current k-th neighbour are pruned. result is used as the heap,
+ * so a buffer reused across queries (with capacity >= k) makes the query allocation free.
+ *
+ * @param result ids and distances of the min(k, size of the tree) nearest neighbours.
+ * @param stats counters of this query, see search_stats.
+ * @param metric distance metric policy, see metrics.hpp.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+void knn_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result,
+    search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    query_scope scope( query_kind::knn, stats );
+    result.clear();
+    if( root == nullptr || k == 0 )
+        return;
+
+    search_cell<T,N> cell;
+    knn_query_node<T,N>(root, queryPoint, k, cell, result, stats, metric);
+    finalize_neighbors( result, metric );
+}
+
+template<typename T, int N>
+void knn_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result ){
+    search_stats stats;
+    knn_query<T,N>(root, queryPoint, k, result, stats);
+}
+
+template<typename T, int N>
+std::vector<neighbor<T>> knn_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, size_t k ){
+    std::vector<neighbor<T>> result;
+    result.reserve(k);
+    knn_query<T,N>(root, queryPoint, k, result);
+    return result;
+}
+
+/**
+ * @brief Quality report of approx_knn_query. Every returned distance is at most (1 + m_epsilon) times the exact
+ * distance of the neighbour of the same rank; m_epsilon is 0 when the result is exact and infinite when the visit
+ * budget ran out before k points were found.
+ */
+template<typename T>
+struct approx_knn_info {
+    T      m_epsilon = 0;
+    size_t m_leaves_visited = 0;
+    bool   m_budget_exhausted = false;
+};
+
+/**
+ * @brief A subtree waiting in the priority queue of approx_knn_query, with its cell and the lower bound m_cell.m_rd
+ * of the distance of its points from the query point.
+ */
+template<typename T, int N, typename Node>
+struct pending_subtree {
+    search_cell<T,N> m_cell;
+    Node             m_node;
+
+    bool operator>( pending_subtree const& other ) const { return m_cell.m_rd > other.m_cell.m_rd; }
+};
+
+/**
+ * @brief Achieved approximation factor of a result of approx_knn_query: unexplored is the smallest lower bound
+ * (reduced distance) of the subtrees that were not searched, the maximum value if all of them were.
+ */
+template<typename T, typename Metric>
+T achieved_epsilon( std::vector<neighbor<T>> const& result, size_t k, T unexplored, Metric const& metric ){
+    if( unexplored == std::numeric_limits<T>::max() )
+        return 0;
+    if( result.size() < k )
+        return std::numeric_limits<T>::infinity();
+
+    T kth = result.back().m_distance;
+    T bound = metric.actual( unexplored );
+    if( kth <= bound )
+        return 0;
+    return bound > 0 ? kth / bound - 1 : std::numeric_limits<T>::infinity();
+}
+
+/**
+ * @brief Approximate k nearest neighbours of queryPoint with a quality guarantee, by priority search: subtrees are
+ * searched in order of their distance from the query point, descending from each one to its nearest leaf. The
+ * search stops when the nearest remaining subtree is farther than the current k-th neighbour divided by
+ * (1 + epsilon), which makes the result (1 + epsilon)-approximate, or after max_leaves descents. With epsilon = 0
+ * and no budget the result is the exact one of knn_query.
+ *
+ * @param result ids and distances of the neighbours found, sorted by increasing distance.
+ * @param epsilon allowed relative error of the distances.
+ * @param max_leaves budget of descents, each of them ending at a leaf.
+ * @return the approximation factor actually achieved, which is never worse than epsilon unless the budget ran out.
+ */
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+approx_knn_info<T> approx_knn_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, size_t k,
+    std::vector<neighbor<T>> & result, T epsilon, size_t max_leaves, search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    query_scope scope( query_kind::approx_knn, stats );
+    result.clear();
+    approx_knn_info<T> info;
+    if( root == nullptr || k == 0 )
+        return info;
+
+    using pending = pending_subtree<T,N,node_t<T,N> const*>;
+    std::vector<pending> queue( 1, pending{ search_cell<T,N>(), root } );
+    T unexplored = std::numeric_limits<T>::max();
+
+    while( !queue.empty() ){
+        std::pop_heap( queue.begin(), queue.end(), std::greater<pending>() );
+        pending next = queue.back();
+        queue.pop_back();
+
+        if( metric.actual(next.m_cell.m_rd) * ( 1 + epsilon ) > metric.actual( neighbor_bound(result, k) ) ){
+            unexplored = next.m_cell.m_rd;
+            stats.m_subtrees_pruned += queue.size() + 1;
+            break;
+        }
+        if( info.m_leaves_visited >= max_leaves ){
+            unexplored = next.m_cell.m_rd;
+            info.m_budget_exhausted = true;
+            stats.m_subtrees_pruned += queue.size() + 1;
+            break;
+        }
+        stats.m_backtracks += info.m_leaves_visited > 0;
+
+        // descend to the nearest leaf, queuing the farther child of every node on the way.
+        node_t<T,N> const* node = next.m_node;
+        search_cell<T,N> & cell = next.m_cell;
+        while( node != nullptr ){
+            stats.m_nodes_visited += 1;
+            stats.m_leaves_visited += node->isLeaf();
+
+            if( !node->m_deleted ){
+                push_neighbor( result, k, node->m_key.m_id, metric_distance<T,N>(metric, queryPoint, node->m_key.m_value) );
+                stats.m_points_visited += 1;
+            }
+
+            int dim = node->m_split_dim;
+            T split = node->m_key.m_value[dim];
+            bool nearUpper = !( queryPoint[dim] < split );
+            node_t<T,N> const* near = nearUpper ? node->m_right : node->m_left;
+            node_t<T,N> const* far  = nearUpper ? node->m_left : node->m_right;
+
+            if( far && far->size() > 0 ){
+                pending farSubtree = { cell, far };
+                farSubtree.m_cell.narrow(dim, !nearUpper, split, queryPoint, metric);
+                queue.push_back( farSubtree );
+                std::push_heap( queue.begin(), queue.end(), std::greater<pending>() );
+            }
+
+            cell.narrow(dim, nearUpper, split, queryPoint, metric);
+            node = near && near->size() > 0 ? near : nullptr;
+        }
+        info.m_leaves_visited += 1;
+    }
+
+    finalize_neighbors( result, metric );
+    info.m_epsilon = achieved_epsilon( result, k, unexplored, metric );
+    return info;
+}
+
+template<typename T, int N>
+approx_knn_info<T> approx_knn_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, size_t k,
+    std::vector<neighbor<T>> & result, T epsilon, size_t max_leaves = std::numeric_limits<size_t>::max() ){
+    search_stats stats;
+    return approx_knn_query<T,N>(root, queryPoint, k, result, epsilon, max_leaves, stats);
+}
+
+/**
+ * @brief Calls f(key) for every key in the subtree of node, without any distance test.
+ */
+template<typename T, int N, typename Function>
+void for_each_in_subtree( node_t<T,N> const* node, Function & f ){
+    if( !node->m_deleted )
+        f( node->m_key );
+    if( node->m_left )
+        for_each_in_subtree<T,N>(node->m_left, f);
+    if( node->m_right )
+        for_each_in_subtree<T,N>(node->m_right, f);
+}
+
+/**
+ * @brief Recursive part of the range queries. lo/hi is the cell of node: the region of space its subtree may
+ * hold points in, narrowed at every split (the left subtree holds values < split, the right values >= split).
+ * Cells that do not intersect the range are skipped (pruned) and cells contained in it are reported without
+ * testing; the nodes of the latter are not counted as visited.
+ */
+template<typename T, int N, typename Range, typename Function>
+void range_query_node( node_t<T,N> const* node, Range const& range, std::array<T,N> & lo, std::array<T,N> & hi, Function & f,
+    search_stats & stats ){
+    if( !range.intersects_cell(lo, hi) ){
+        stats.m_subtrees_pruned += 1;
+        return;
+    }
+
+    if( range.contains_cell(lo, hi) ){
+        for_each_in_subtree<T,N>(node, f);
+        return;
+    }
+
+    stats.m_nodes_visited += 1;
+    stats.m_leaves_visited += node->isLeaf();
+    if( !node->m_deleted ){
+        stats.m_points_visited += 1;
+        if( range.contains(node->m_key.m_value) )
+            f( node->m_key );
+    }
+
+    int dim = node->m_split_dim;
+    T split = node->m_key.m_value[dim];
+    if( node->m_left ){
+        T old = hi[dim];
+        hi[dim] = split;
+        range_query_node<T,N>(node->m_left, range, lo, hi, f, stats);
+        hi[dim] = old;
+    }
+    if( node->m_right ){
+        T old = lo[dim];
+        lo[dim] = split;
+        range_query_node<T,N>(node->m_right, range, lo, hi, f, stats);
+        lo[dim] = old;
+    }
+}
+
+/**
+ * @brief Recursive part of the count-only range queries: cells contained in the range add the size of their
+ * subtree without descending any further.
+ */
+template<typename T, int N, typename Range>
+size_t range_count_node( node_t<T,N> const* node, Range const& range, std::array<T,N> & lo, std::array<T,N> & hi,
+    search_stats & stats ){
+    if( !range.intersects_cell(lo, hi) ){
+        stats.m_subtrees_pruned += 1;
+        return 0;
+    }
+
+    if( range.contains_cell(lo, hi) )
+        return node->size();
+
+    stats.m_nodes_visited += 1;
+    stats.m_leaves_visited += node->isLeaf();
+    stats.m_points_visited += !node->m_deleted;
+    size_t count = !node->m_deleted && range.contains(node->m_key.m_value);
+
+    int dim = node->m_split_dim;
+    T split = node->m_key.m_value[dim];
+    if( node->m_left ){
+        T old = hi[dim];
+        hi[dim] = split;
+        count += range_count_node<T,N>(node->m_left, range, lo, hi, stats);
+        hi[dim] = old;
+    }
+    if( node->m_right ){
+        T old = lo[dim];
+        lo[dim] = split;
+        count += range_count_node<T,N>(node->m_right, range, lo, hi, stats);
+        lo[dim] = old;
+    }
+    return count;
+}
+
+/**
+ * @brief Calls f(key) for every key of the tree inside the range (a box_range or a radius_range). Keys are
+ * streamed as they are found, in no particular order. The radius_* and box_* queries below run through it and
+ * range_count.
+ *
+ * @param stats counters of this query, see search_stats and range_query_node.
+ */
+template<typename T, int N, typename Range, typename Function>
+void range_query( node_t<T,N> const* root, Range const& range, Function f, search_stats & stats ){
+    stats = search_stats();
+    query_scope scope( query_kind::range, stats );
+    if( root == nullptr )
+        return;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    range_query_node<T,N>(root, range, lo, hi, f, stats);
+}
+
+template<typename T, int N, typename Range, typename Function>
+void range_query( node_t<T,N> const* root, Range const& range, Function f ){
+    search_stats stats;
+    range_query<T,N>(root, range, f, stats);
+}
+
+template<typename T, int N, typename Range>
+size_t range_count( node_t<T,N> const* root, Range const& range, search_stats & stats ){
+    stats = search_stats();
+    query_scope scope( query_kind::range_count, stats );
+    if( root == nullptr )
+        return 0;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    return range_count_node<T,N>(root, range, lo, hi, stats);
+}
+
+template<typename T, int N, typename Range>
+size_t range_count( node_t<T,N> const* root, Range const& range ){
+    search_stats stats;
+    return range_count<T,N>(root, range, stats);
+}
+
+/**
+ * @brief All keys within distance radius (included) of queryPoint under the metric: f(key) is called for each.
+ */
+template<typename T, int N, typename Function, typename Metric = euclidean_metric<T,N>>
+void radius_for_each( node_t<T,N> const* root, std::array<T,N> const& queryPoint, T radius, Function f, Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    range_query<T,N>(root, range, f);
+}
+
+/**
+ * @brief All keys within distance radius (included) of queryPoint, written to the output iterator out.
+ *
+ * @return the output iterator past the last written key.
+ */
+template<typename T, int N, typename OutputIt, typename Metric = euclidean_metric<T,N>>
+OutputIt radius_query( node_t<T,N> const* root, std::array<T,N> const& queryPoint, T radius, OutputIt out, Metric const& metric = Metric() ){
+    radius_for_each<T,N>(root, queryPoint, radius, [&out]( key<T,N> const& e ){ *out++ = e; }, metric);
+    return out;
+}
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+size_t radius_count( node_t<T,N> const* root, std::array<T,N> const& queryPoint, T radius, Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    return range_count<T,N>(root, range);
+}
+
+/**
+ * @brief All keys inside the axis-aligned box [lo, hi] (bounds included): f(key) is called for each of them.
+ */
+template<typename T, int N, typename Function>
+void box_for_each( node_t<T,N> const* root, std::array<T,N> const& lo, std::array<T,N> const& hi, Function f ){
+    box_range<T,N> range = { lo, hi };
+    range_query<T,N>(root, range, f);
+}
+
+/**
+ * @brief All keys inside the axis-aligned box [lo, hi] (bounds included), written to the output iterator out.
+ *
+ * @return the output iterator past the last written key.
+ */
+template<typename T, int N, typename OutputIt>
+OutputIt box_query( node_t<T,N> const* root, std::array<T,N> const& lo, std::array<T,N> const& hi, OutputIt out ){
+    box_for_each<T,N>(root, lo, hi, [&out]( key<T,N> const& e ){ *out++ = e; });
+    return out;
+}
+
+template<typename T, int N>
+size_t box_count( node_t<T,N> const* root, std::array<T,N> const& lo, std::array<T,N> const& hi ){
+    box_range<T,N> range = { lo, hi };
+    return range_count<T,N>(root, range);
+}
+
+/*************************************************************************************************************
+ * Dynamic updates. Keys are inserted as new leaves at the end of the path their value leads to and removed
+ * lazily: a key with children is only marked as deleted (a tombstone) and skipped by the searches, a leaf is
+ * unlinked. Balance is restored scapegoat style: the topmost subtree on the path of an update that became
+ * unbalanced, or holds more tombstones than keys, is rebuilt from its remaining keys. Rebuilding a subtree of n
+ * keys costs O(n log n) and happens only after O(n) updates below it, so the amortised cost of an update is
+ * O(log^2 n) and the depth stays O(log n).
+ */
+
+// a subtree is unbalanced when one of its children holds more than this fraction of its weight.
+const double kdtree_balance_alpha = 0.75;
+
+// subtrees lighter than this are never rebuilt for balance, they are shallow anyway.
+const size_t kdtree_min_rebuild_weight = 8;
+
+/**
+ * @brief Keys plus tombstones in the subtree of node: the cost of rebuilding it.
+ */
+template<typename T, int N>
+size_t kdtree_weight( node_t<T,N> const* node ){
+    return node ? node->m_size + node->m_num_deleted : 0;
+}
+
+template<typename T, int N>
+bool is_unbalanced( node_t<T,N> const* node ){
+    size_t weight = kdtree_weight<T,N>(node);
+    size_t heaviest = std::max( kdtree_weight<T,N>(node->m_left), kdtree_weight<T,N>(node->m_right) );
+    return weight > kdtree_min_rebuild_weight && heaviest > kdtree_balance_alpha * weight;
+}
+
+/**
+ * @brief Rebuilds the subtree of node in place from its remaining keys, dropping its tombstones. The node object
+ * itself is reused, so the pointer its parent holds stays valid; without remaining keys it becomes a tombstone.
+ */
+template<typename T, int N>
+void rebuild_subtree( node_t<T,N> * node, node_arena<T,N> * arena = nullptr ){
+    std::vector<key<T,N>> keys;
+    keys.reserve( node->m_size );
+    auto collect = [&keys]( key<T,N> const& e ){ keys.push_back(e); };
+    for_each_in_subtree<T,N>(node, collect);
+
+    if( node->m_left )
+        destroy_kdtree(node->m_left, arena);
+    if( node->m_right )
+        destroy_kdtree(node->m_right, arena);
+    node->m_left = nullptr;
+    node->m_right = nullptr;
+
+    key_points<T,N> points = { keys };
+    kdtree_builder<T,N,key_points<T,N>>( points, arena ).build( node );
+}
+
+/**
+ * @brief Unlinks node, a child of parent, and frees its subtree.
+ */
+template<typename T, int N>
+void unlink_subtree( node_t<T,N> * parent, node_t<T,N> * node, node_arena<T,N> * arena ){
+    ( parent->m_left == node ? parent->m_left : parent->m_right ) = nullptr;
+    destroy_kdtree(node, arena);
+}
+
+/**
+ * @brief Rebuilds the topmost node of path (ordered from the root down) that needs it and removes its tombstones
+ * from the counts of its ancestors. A subtree left without keys is unlinked, unless it is the root.
+ */
+template<typename T, int N, typename Predicate>
+void rebuild_topmost( std::vector<node_t<T,N>*> const& path, Predicate needs_rebuild, node_arena<T,N> * arena ){
+    for( size_t i(0); i < path.size(); ++i ){
+        if( !needs_rebuild(path[i]) )
+            continue;
+        size_t tombstones = path[i]->m_num_deleted;
+        rebuild_subtree<T,N>(path[i], arena);
+        if( i > 0 && path[i]->m_size == 0 )
+            unlink_subtree<T,N>(path[i-1], path[i], arena);
+        else
+            tombstones -= path[i]->m_num_deleted;
+        for( size_t j(0); j < i; ++j )
+            path[j]->m_num_deleted -= tombstones;
+        return;
+    }
+}
+
+/**
+ * @brief Inserts the key k, whose id must not be in the tree yet, and rebuilds the topmost subtree on its path
+ * that became unbalanced.
+ *
+ * @param arena the arena the tree was built in, if any; new nodes are allocated from it.
+ * @return the root of the tree, which is a new node if root was nullptr and root otherwise.
+ */
+template<typename T, int N>
+node_t<T,N> * insert_into_kdtree( node_t<T,N> * root, key<T,N> const& k, node_arena<T,N> * arena = nullptr ){
+    if( root == nullptr )
+        return make_new_node<T,N>( k, false, arena );
+
+    std::vector<node_t<T,N>*> path;
+    node_t<T,N> * node = root;
+    while( node != nullptr ){
+        node->m_size += 1;
+        path.push_back(node);
+
+        // the tombstone of an empty tree takes the key.
+        if( node->m_deleted && node->isLeaf() ){
+            node->m_key = k;
+            node->m_deleted = false;
+            for( node_t<T,N> * e : path )
+                e->m_num_deleted -= 1;
+            break;
+        }
+
+        // a leaf gets its first child split along the dimension that separates it the most from its key.
+        if( node->isLeaf() ){
+            T max_spread = 0;
+            node->m_split_dim = 0;
+            for( int dim(0); dim < N; ++dim )
+                if( std::abs( k.m_value[dim] - node->m_key.m_value[dim] ) > max_spread ){
+                    max_spread = std::abs( k.m_value[dim] - node->m_key.m_value[dim] );
+                    node->m_split_dim = dim;
+                }
+        }
+
+        // the left subtree holds values < split and the right subtree values >= split.
+        int dim = node->m_split_dim;
+        node_t<T,N> *& child = k.m_value[dim] < node->m_key.m_value[dim] ? node->m_left : node->m_right;
+        if( child == nullptr ){
+            child = make_new_node<T,N>( k, false, arena );
+            break;
+        }
+        node = child;
+    }
+
+    rebuild_topmost<T,N>( path, is_unbalanced<T,N>, arena );
+    return root;
+}
+
+/**
+ * @brief Removes the key with the id and value of k. A leaf other than the root is unlinked, any other key becomes
+ * a tombstone, and the topmost subtree on its path that holds more tombstones than keys is rebuilt.
+ *
+ * @param arena the arena the tree was built in, if any.
+ * @return whether the key was found.
+ */
+template<typename T, int N>
+bool remove_from_kdtree( node_t<T,N> * root, key<T,N> const& k, node_arena<T,N> * arena = nullptr ){
+    std::vector<node_t<T,N>*> path;
+    node_t<T,N> * node = root;
+    while( node != nullptr ){
+        path.push_back(node);
+        if( !node->m_deleted && node->m_key.m_id == k.m_id && node->m_key.m_value == k.m_value )
+            break;
+
+        int dim = node->m_split_dim;
+        node = k.m_value[dim] < node->m_key.m_value[dim] ? node->m_left : node->m_right;
+    }
+
+    if( node == nullptr )
+        return false;
+
+    if( node->isLeaf() && path.size() > 1 ){
+        path.pop_back();
+        unlink_subtree<T,N>(path.back(), node, arena);
+        for( node_t<T,N> * e : path )
+            e->m_size -= 1;
+        return true;
+    }
+
+    node->m_deleted = true;
+    for( node_t<T,N> * e : path ){
+        e->m_size -= 1;
+        e->m_num_deleted += 1;
+    }
+
+    rebuild_topmost<T,N>( path, []( node_t<T,N> const* e ){ return e->m_num_deleted > e->m_size; }, arena );
+    return true;
+}
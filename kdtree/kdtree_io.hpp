@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_kdtree.hpp"
+
+/*************************************************************************************************************
+ * Binary file format of the flat kd-tree. A file is a 64-byte header followed by the arrays of the tree exactly
+ * as they are laid out in memory, each starting at a multiple of 64 bytes:
+ *
+ *   header | nodes | coordinates of dim 0 | ... | coordinates of dim N-1 | ids
+ *
+ * so that open_flat_kdtree() can memory-map the file and point the tree to it without copying or parsing
+ * anything. All processes that open the same file share one read-only copy of its pages. The file is only
+ * portable between machines with the same byte order and type sizes, which the header records and checks.
+ */
+
+const uint32_t kdtree_file_version = 1;
+const size_t   kdtree_file_alignment = 64;
+
+struct kdtree_file_header {
+    char     m_magic[8];        // "KDTREE" followed by two zero bytes
+    uint32_t m_version;
+    uint32_t m_byte_order;      // 0x01020304 as written by the host
+    uint32_t m_value_kind;      // 0 = floating point, 1 = signed integer, 2 = unsigned integer
+    uint32_t m_value_size;      // sizeof(T)
+    int32_t  m_dims;            // N
+    uint32_t m_node_size;       // sizeof(flat_node_t<T>)
+    uint64_t m_num_points;
+    uint64_t m_num_nodes;
+    uint64_t m_leaf_size;
+    uint64_t m_checksum;        // of everything after the header, see kdtree_checksum
+};
+
+static_assert( sizeof(kdtree_file_header) == kdtree_file_alignment, "the header must fill the first 64 bytes" );
+
+/**
+ * @brief 64-bit FNV-1a over 8-byte words, fed in pieces of any length. The payload of a tree file is a multiple
+ * of 8 bytes long, so the checksum is verified at the speed of a multiply per word.
+ */
+class kdtree_checksum {
+    private:
+        uint64_t      m_hash = 14695981039346656037ull;
+        unsigned char m_pending[8];
+        size_t        m_num_pending = 0;
+
+        void mix( unsigned char const* p ){
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            m_hash = ( m_hash ^ word ) * 1099511628211ull;
+        }
+
+    public:
+        void update( void const* data, size_t bytes ){
+            unsigned char const* p = static_cast<unsigned char const*>(data);
+            for( ; bytes > 0 && m_num_pending > 0; --bytes ){
+                m_pending[m_num_pending++] = *p++;
+                if( m_num_pending == 8 ){
+                    mix(m_pending);
+                    m_num_pending = 0;
+                }
+            }
+            for( ; bytes >= 8; bytes -= 8, p += 8 )
+                mix(p);
+            for( ; bytes > 0; --bytes )
+                m_pending[m_num_pending++] = *p++;
+        }
+
+        uint64_t value() const { return m_hash; }
+};
+
+template<typename T>
+uint32_t kdtree_value_kind(){
+    return std::is_floating_point<T>::value ? 0 : ( std::is_signed<T>::value ? 1 : 2 );
+}
+
+inline size_t kdtree_file_padding( size_t bytes ){
+    return ( kdtree_file_alignment - bytes % kdtree_file_alignment ) % kdtree_file_alignment;
+}
+
+/**
+ * @brief Offsets of the arrays of a tree inside its file, computed from the header.
+ */
+template<typename T, int N>
+struct kdtree_file_layout {
+    size_t m_nodes;
+    size_t m_coords[N];
+    size_t m_ids;
+    size_t m_file_size;
+
+    explicit kdtree_file_layout( kdtree_file_header const& header ){
+        size_t offset = sizeof(kdtree_file_header);
+        m_nodes = offset;
+        offset += header.m_num_nodes * sizeof(flat_node_t<T>);
+        offset += kdtree_file_padding(offset);
+        for( int dim(0); dim < N; ++dim ){
+            m_coords[dim] = offset;
+            offset += header.m_num_points * sizeof(T);
+            offset += kdtree_file_padding(offset);
+        }
+        m_ids = offset;
+        offset += header.m_num_points * sizeof(size_t);
+        offset += kdtree_file_padding(offset);
+        m_file_size = offset;
+    }
+};
+
+template<typename T, int N>
+kdtree_file_header make_kdtree_file_header( flat_kdtree<T,N> const& tree ){
+    kdtree_file_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.m_magic, "KDTREE", 6);
+    header.m_version    = kdtree_file_version;
+    header.m_byte_order = 0x01020304;
+    header.m_value_kind = kdtree_value_kind<T>();
+    header.m_value_size = sizeof(T);
+    header.m_dims       = N;
+    header.m_node_size  = sizeof(flat_node_t<T>);
+    header.m_num_points = tree.size();
+    header.m_num_nodes  = tree.numNodes();
+    header.m_leaf_size  = tree.m_leaf_size;
+    return header;
+}
+
+/**
+ * @brief A uniquely named temporary file next to target, created with mkstemp so that concurrent writers of the same
+ * target never share it. commit() renames it to target; until then the destructor removes it, so a write that
+ * fails or throws leaves nothing behind.
+ *
+ * @throws std::runtime_error if the file cannot be created or renamed.
+ */
+class kdtree_temp_file {
+    private:
+        std::string m_path;
+        std::string m_target;
+        bool        m_committed = false;
+
+    public:
+        explicit kdtree_temp_file( std::string const& target ) : m_target(target) {
+            std::string pattern = target + ".tmp.XXXXXX";
+            std::vector<char> name( pattern.begin(), pattern.end() );
+            name.push_back('\0');
+            int fd = mkstemp( name.data() );
+            if( fd < 0 )
+                throw std::runtime_error("failed to create a temporary file for " + target);
+            // mkstemp creates the file private to the user; give it the permissions of an ordinary new file.
+            fchmod( fd, 0644 );
+            close( fd );
+            m_path = name.data();
+        }
+
+        ~kdtree_temp_file(){
+            if( !m_committed )
+                std::remove( m_path.c_str() );
+        }
+
+        kdtree_temp_file( kdtree_temp_file const& ) = delete;
+        kdtree_temp_file & operator=( kdtree_temp_file const& ) = delete;
+
+        std::string const& path() const { return m_path; }
+
+        void commit(){
+            if( std::rename( m_path.c_str(), m_target.c_str() ) != 0 )
+                throw std::runtime_error("failed to rename " + m_path + " to " + m_target);
+            m_committed = true;
+        }
+};
+
+/**
+ * @brief Writes a built flat kd-tree to path. The file is written under a temporary name and renamed at the end,
+ * so processes opening path concurrently never see a partially written tree.
+ *
+ * @throws std::runtime_error if the file cannot be written.
+ */
+template<typename T, int N>
+void save_flat_kdtree( flat_kdtree<T,N> const& tree, std::string const& path ){
+    static_assert( std::is_trivially_copyable<flat_node_t<T>>::value, "flat_node_t must be trivially copyable" );
+
+    kdtree_file_header header = make_kdtree_file_header(tree);
+    kdtree_temp_file tmp(path);
+    std::string const& tmpPath = tmp.path();
+    std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+    if( !out )
+        throw std::runtime_error("save_flat_kdtree failed to create " + tmpPath);
+
+    // the header is rewritten with the checksum once the payload is known.
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+
+    kdtree_checksum checksum;
+    const char zeros[kdtree_file_alignment] = {};
+    size_t offset = sizeof(header);
+    auto write = [&]( void const* data, size_t bytes ){
+        out.write(static_cast<char const*>(data), bytes);
+        checksum.update(data, bytes);
+        offset += bytes;
+    };
+    auto pad = [&](){
+        size_t bytes = kdtree_file_padding(offset);
+        write(zeros, bytes);
+    };
+
+    // nodes are copied field by field into zeroed records, so that the padding bytes in the file are defined.
+    const size_t chunk = 4096;
+    std::vector<flat_node_t<T>> records(chunk);
+    for( size_t begin(0); begin < tree.numNodes(); begin += chunk ){
+        size_t count = std::min(chunk, tree.numNodes() - begin);
+        std::memset(static_cast<void*>(records.data()), 0, count * sizeof(flat_node_t<T>));
+        for( size_t i(0); i < count; ++i ){
+            flat_node_t<T> const& node = tree.getNode(begin + i);
+            records[i].m_split_value = node.m_split_value;
+            records[i].m_split_dim   = node.m_split_dim;
+            records[i].m_left        = node.m_left;
+            records[i].m_right       = node.m_right;
+            records[i].m_begin       = node.m_begin;
+            records[i].m_end         = node.m_end;
+        }
+        write(records.data(), count * sizeof(flat_node_t<T>));
+    }
+    pad();
+
+    for( int dim(0); dim < N; ++dim ){
+        write(tree.getCoords(dim), tree.size() * sizeof(T));
+        pad();
+    }
+    write(tree.getIDs(), tree.size() * sizeof(size_t));
+    pad();
+
+    header.m_checksum = checksum.value();
+    out.seekp(0);
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    out.close();
+    if( !out )
+        throw std::runtime_error("save_flat_kdtree failed to write " + tmpPath);
+
+    tmp.commit();
+}
+
+/**
+ * @brief Opens a tree file written by save_flat_kdtree by memory-mapping it read-only. Nothing is copied: the
+ * returned tree points into the mapping, which is released when the last copy of the tree is destroyed, and the
+ * pages are loaded on demand by the first queries that touch them.
+ *
+ * @param verify_checksum recompute the checksum of the payload, which reads the whole file once. Processes that
+ * open a file already verified by another one can skip it for a near-instant startup.
+ * @throws std::runtime_error if the file cannot be mapped, was written for another T, N or machine, or is
+ * truncated or corrupted.
+ */
+template<typename T, int N>
+flat_kdtree<T,N> open_flat_kdtree( std::string const& path, bool verify_checksum = true ){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if( fd < 0 )
+        throw std::runtime_error("open_flat_kdtree failed to open " + path);
+
+    struct stat info;
+    if( ::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(kdtree_file_header) ){
+        ::close(fd);
+        throw std::runtime_error("open_flat_kdtree: " + path + " is not a kd-tree file");
+    }
+
+    size_t fileSize = static_cast<size_t>(info.st_size);
+    void *address = ::mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if( address == MAP_FAILED )
+        throw std::runtime_error("open_flat_kdtree failed to map " + path);
+
+    std::shared_ptr<void const> mapping( address, [fileSize]( void const* p ){ ::munmap(const_cast<void*>(p), fileSize); } );
+    char const* base = static_cast<char const*>(address);
+
+    kdtree_file_header header;
+    std::memcpy(&header, base, sizeof(header));
+    kdtree_file_header expected = make_kdtree_file_header( flat_kdtree<T,N>() );
+
+    if( std::memcmp(header.m_magic, expected.m_magic, sizeof(header.m_magic)) != 0 )
+        throw std::runtime_error("open_flat_kdtree: " + path + " is not a kd-tree file");
+    if( header.m_version != kdtree_file_version )
+        throw std::runtime_error("open_flat_kdtree: unsupported version of " + path);
+    if( header.m_value_kind != expected.m_value_kind || header.m_value_size != expected.m_value_size
+        || header.m_dims != expected.m_dims )
+        throw std::runtime_error("open_flat_kdtree: " + path + " holds a tree of another value type or dimension");
+    if( header.m_byte_order != expected.m_byte_order || header.m_node_size != expected.m_node_size )
+        throw std::runtime_error("open_flat_kdtree: " + path + " was written on an incompatible machine");
+
+    kdtree_file_layout<T,N> layout(header);
+    if( layout.m_file_size != fileSize )
+        throw std::runtime_error("open_flat_kdtree: " + path + " is truncated");
+
+    if( verify_checksum ){
+        kdtree_checksum checksum;
+        checksum.update(base + sizeof(header), fileSize - sizeof(header));
+        if( checksum.value() != header.m_checksum )
+            throw std::runtime_error("open_flat_kdtree: checksum mismatch in " + path);
+    }
+
+    flat_kdtree<T,N> tree;
+    tree.m_leaf_size  = header.m_leaf_size;
+    tree.m_num_nodes  = header.m_num_nodes;
+    tree.m_num_points = header.m_num_points;
+    tree.m_node_data  = reinterpret_cast<flat_node_t<T> const*>(base + layout.m_nodes);
+    for( int dim(0); dim < N; ++dim )
+        tree.m_coord_data[dim] = reinterpret_cast<T const*>(base + layout.m_coords[dim]);
+    tree.m_id_data    = reinterpret_cast<size_t const*>(base + layout.m_ids);
+    tree.m_mapping    = mapping;
+
+    return tree;
+}
@@ -0,0 +1,627 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "kdtree_io.hpp"
+#include "timer.hpp"
+
+/*************************************************************************************************************
+ * Out-of-core build of a flat kd-tree from a point file larger than the memory, written directly in the format of
+ * kdtree_io.hpp so that the result is opened with open_flat_kdtree.
+ *
+ * The point file is a raw array of std::array<T,N> (no header); the id of a point is its index in the file. Large
+ * subtrees are split by streaming their points: a pass for the spread of every dimension, an external selection
+ * of the median (a pass to sample, a pass to count and collect the points between two sampled pivots) and a pass
+ * that partitions the points into two temporary files, one per child. Subtrees that fit in the memory budget are
+ * loaded and built in memory. Since the shape of the flat tree only depends on the number of points, the offset of
+ * every node and point in the output file is known in advance and each subtree writes its part in place.
+ *
+ * The split rules are those of build_flat_kdtree, so the file holds exactly the tree build_flat_kdtree would build
+ * from the same points with the same leaf size. Temporary files need up to twice the size of the points on disk.
+ *************************************************************************************************************/
+
+struct stream_build_params {
+    size_t      m_memory_budget = size_t(256) << 20;   // bytes of point data, samples and I/O buffers in memory
+    size_t      m_leaf_size     = 16;
+    std::string m_temp_prefix;                         // prefix of the temporary files, the output path if empty
+};
+
+struct stream_build_stats {
+    size_t m_num_points    = 0;
+    size_t m_bytes_read    = 0;
+    size_t m_bytes_written = 0;   // temporary files and the tree file
+    size_t m_peak_memory   = 0;   // largest amount of buffer memory held at once
+    size_t m_external_splits = 0; // nodes split by streaming instead of in memory
+    double m_seconds       = 0;
+};
+
+/**
+ * @brief Number of nodes of a flat kd-tree of n points, which only depends on n and the leaf size.
+ */
+inline size_t flat_kdtree_num_nodes( size_t n, size_t leaf_size, std::map<size_t,size_t> & memo ){
+    if( n <= leaf_size )
+        return 1;
+    auto it = memo.find(n);
+    if( it != memo.end() )
+        return it->second;
+    size_t count = 1 + flat_kdtree_num_nodes(n / 2, leaf_size, memo) + flat_kdtree_num_nodes(n - n / 2, leaf_size, memo);
+    memo[n] = count;
+    return count;
+}
+
+/**
+ * @brief Writes points to a raw point file, the input of build_flat_kdtree_file.
+ *
+ * @throws std::runtime_error if the file cannot be written.
+ */
+template<typename T, int N>
+void save_point_file( std::vector<std::array<T,N>> const& data, std::string const& path ){
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    if( !file )
+        throw std::runtime_error("save_point_file failed to create " + path);
+    size_t written = std::fwrite(data.data(), sizeof(std::array<T,N>), data.size(), file);
+    if( std::fclose(file) != 0 || written != data.size() )
+        throw std::runtime_error("save_point_file failed to write " + path);
+}
+
+/**
+ * @brief Builder behind build_flat_kdtree_file. Points travel between passes as key<T,N> records, and a segment is
+ * the file holding the points of one subtree together with their count and bounding box.
+ */
+template<typename T, int N>
+class stream_kdtree_builder {
+    private:
+        using record = key<T,N>;
+
+        struct segment {
+            std::string     m_path;
+            bool            m_raw;       // the input point file: values only, ids are positions
+            bool            m_temporary;
+            size_t          m_size;
+            std::array<T,N> m_lo;
+            std::array<T,N> m_hi;
+        };
+
+        // (value in dim, id) order of build_flat_kdtree.
+        struct record_less {
+            int m_dim;
+            bool operator()( record const& a, record const& b ) const {
+                return a.m_value[m_dim] < b.m_value[m_dim] || ( a.m_value[m_dim] == b.m_value[m_dim] && a.m_id < b.m_id );
+            }
+        };
+
+        /**
+         * @brief Buffered sequential reader of the records of a segment.
+         */
+        class reader {
+            private:
+                std::FILE *                       m_file;
+                bool                              m_raw;
+                size_t                            m_next_id = 0;
+                std::vector<record>               m_records;
+                std::vector<std::array<T,N>>      m_values;
+                size_t                            m_count = 0;
+                size_t                            m_pos = 0;
+                stream_build_stats &              m_stats;
+
+            public:
+                reader( segment const& s, size_t buffer_records, stream_build_stats & stats )
+                    : m_file( std::fopen(s.m_path.c_str(), "rb") ), m_raw(s.m_raw), m_stats(stats) {
+                    if( !m_file )
+                        throw std::runtime_error("build_flat_kdtree_file failed to open " + s.m_path);
+                    m_records.resize(buffer_records);
+                    if( m_raw )
+                        m_values.resize(buffer_records);
+                }
+                ~reader(){ std::fclose(m_file); }
+
+                reader( reader const& ) = delete;
+                reader & operator=( reader const& ) = delete;
+
+                // the next record, or nullptr at the end of the segment.
+                record const* next(){
+                    if( m_pos == m_count ){
+                        if( m_raw ){
+                            m_count = std::fread(m_values.data(), sizeof(std::array<T,N>), m_values.size(), m_file);
+                            for( size_t i(0); i < m_count; ++i ){
+                                m_records[i].m_id = m_next_id++;
+                                m_records[i].m_value = m_values[i];
+                            }
+                            m_stats.m_bytes_read += m_count * sizeof(std::array<T,N>);
+                        } else {
+                            m_count = std::fread(m_records.data(), sizeof(record), m_records.size(), m_file);
+                            m_stats.m_bytes_read += m_count * sizeof(record);
+                        }
+                        m_pos = 0;
+                        if( m_count == 0 )
+                            return nullptr;
+                    }
+                    return &m_records[m_pos++];
+                }
+        };
+
+        /**
+         * @brief Buffered writer of a temporary segment that keeps track of its count and bounding box.
+         */
+        class writer {
+            private:
+                std::FILE *          m_file;
+                std::vector<record>  m_records;
+                stream_build_stats & m_stats;
+
+                void flush(){
+                    if( std::fwrite(m_records.data(), sizeof(record), m_records.size(), m_file) != m_records.size() )
+                        throw std::runtime_error("build_flat_kdtree_file failed to write " + m_segment.m_path);
+                    m_stats.m_bytes_written += m_records.size() * sizeof(record);
+                    m_records.clear();
+                }
+
+            public:
+                segment m_segment;
+
+                writer( std::string const& path, size_t buffer_records, stream_build_stats & stats )
+                    : m_file( std::fopen(path.c_str(), "wb") ), m_stats(stats) {
+                    if( !m_file )
+                        throw std::runtime_error("build_flat_kdtree_file failed to create " + path);
+                    m_records.reserve(buffer_records);
+                    m_segment.m_path = path;
+                    m_segment.m_raw = false;
+                    m_segment.m_temporary = true;
+                    m_segment.m_size = 0;
+                    m_segment.m_lo.fill( std::numeric_limits<T>::max() );
+                    m_segment.m_hi.fill( std::numeric_limits<T>::lowest() );
+                }
+                ~writer(){ if( m_file ) std::fclose(m_file); }
+
+                writer( writer const& ) = delete;
+                writer & operator=( writer const& ) = delete;
+
+                void push( record const& r ){
+                    m_records.push_back(r);
+                    for( int dim(0); dim < N; ++dim ){
+                        m_segment.m_lo[dim] = std::min(m_segment.m_lo[dim], r.m_value[dim]);
+                        m_segment.m_hi[dim] = std::max(m_segment.m_hi[dim], r.m_value[dim]);
+                    }
+                    m_segment.m_size += 1;
+                    if( m_records.size() == m_records.capacity() )
+                        flush();
+                }
+
+                segment close(){
+                    flush();
+                    int status = std::fclose(m_file);
+                    m_file = nullptr;
+                    if( status != 0 )
+                        throw std::runtime_error("build_flat_kdtree_file failed to write " + m_segment.m_path);
+                    return m_segment;
+                }
+        };
+
+        std::FILE *                m_out;
+        std::string                m_out_path;
+        kdtree_file_layout<T,N>    m_layout;
+        size_t                     m_leaf_size;
+        size_t                     m_budget;
+        size_t                     m_buffer_records;   // records per I/O buffer
+        std::string                m_temp_prefix;
+        size_t                     m_num_temp = 0;
+        std::set<std::string>      m_live_temp;        // temporary segments created and not yet removed
+        std::map<size_t,size_t>    m_num_nodes;
+        size_t                     m_memory = 0;
+        stream_build_stats &       m_stats;
+
+        size_t num_nodes( size_t n ){
+            return flat_kdtree_num_nodes(n, m_leaf_size, m_num_nodes);
+        }
+
+        // accounts for buffer memory acquired (positive) or released (negative).
+        void hold( long bytes ){
+            m_memory += bytes;
+            m_stats.m_peak_memory = std::max(m_stats.m_peak_memory, m_memory);
+        }
+
+        void write_at( size_t offset, void const* data, size_t bytes ){
+            if( std::fseek(m_out, static_cast<long>(offset), SEEK_SET) != 0
+                || std::fwrite(data, 1, bytes, m_out) != bytes )
+                throw std::runtime_error("build_flat_kdtree_file failed to write " + m_out_path);
+            m_stats.m_bytes_written += bytes;
+        }
+
+        // the nodes must have been zeroed before their fields were set, so that their padding bytes are defined.
+        void write_nodes( size_t index, flat_node_t<T> const* nodes, size_t count ){
+            write_at( m_layout.m_nodes + index * sizeof(flat_node_t<T>), nodes, count * sizeof(flat_node_t<T>) );
+        }
+
+        static int dim_with_highest_spread( std::array<T,N> const& lo, std::array<T,N> const& hi ){
+            T max_spread = 0;
+            int max_dim = 0;
+            for( int dim(0); dim < N; ++dim )
+                if ( hi[dim] - lo[dim] > max_spread ){
+                    max_spread = hi[dim] - lo[dim];
+                    max_dim = dim;
+                }
+            return max_dim;
+        }
+
+        // builds the subtree of records[begin,end) in memory like flat_kdtree_builder::split.
+        void split_in_memory( std::vector<record> & records, size_t begin, size_t end, size_t index, size_t first,
+            size_t offset, std::vector<flat_node_t<T>> & nodes ){
+
+            flat_node_t<T> & node = nodes[index - first];
+            node.m_begin = offset + begin;
+            node.m_end = offset + end;
+            node.m_split_dim = -1;
+            node.m_split_value = 0;
+            node.m_left = 0;
+            node.m_right = 0;
+
+            if( end - begin <= m_leaf_size ){
+                std::sort(records.begin() + begin, records.begin() + end,
+                    []( record const& a, record const& b ){ return a.m_id < b.m_id; });
+                return;
+            }
+
+            std::array<T,N> lo = records[begin].m_value, hi = lo;
+            for( size_t i(begin+1); i < end; ++i )
+                for( int dim(0); dim < N; ++dim ){
+                    lo[dim] = std::min(lo[dim], records[i].m_value[dim]);
+                    hi[dim] = std::max(hi[dim], records[i].m_value[dim]);
+                }
+            int dim = dim_with_highest_spread(lo, hi);
+            size_t mid = begin + (end - begin) / 2;
+            record_less less = { dim };
+            std::nth_element(records.begin() + begin, records.begin() + mid, records.begin() + end, less);
+
+            node.m_split_dim = dim;
+            node.m_split_value = records[mid].m_value[dim];
+            node.m_left = index + 1;
+            node.m_right = index + 1 + num_nodes(mid - begin);
+            size_t right = node.m_right;
+
+            split_in_memory(records, begin, mid, index + 1, first, offset, nodes);
+            split_in_memory(records, mid, end, right, first, offset, nodes);
+        }
+
+        // loads a segment that fits in the budget, builds its subtree and writes nodes and points in place.
+        void build_in_memory( segment const& s, size_t index, size_t offset ){
+            std::vector<record> records;
+            records.reserve(s.m_size);
+            hold( s.m_size * sizeof(record) );
+            {
+                // the reader of the input file also has a buffer for the values without ids.
+                size_t buffers = ( s.m_raw ? 2 : 1 ) * m_buffer_records * sizeof(record);
+                hold( buffers );
+                reader in( s, m_buffer_records, m_stats );
+                for( record const* r = in.next(); r; r = in.next() )
+                    records.push_back(*r);
+                hold( -long(buffers) );
+            }
+
+            size_t count = num_nodes(s.m_size);
+            std::vector<flat_node_t<T>> nodes(count);
+            std::memset(static_cast<void*>(nodes.data()), 0, count * sizeof(flat_node_t<T>));
+            hold( count * sizeof(flat_node_t<T>) );
+            split_in_memory(records, 0, records.size(), index, index, offset, nodes);
+            write_nodes(index, nodes.data(), count);
+            hold( -long(count * sizeof(flat_node_t<T>)) );
+
+            // coordinates and ids go out through one I/O buffer.
+            std::vector<T> values(m_buffer_records);
+            hold( m_buffer_records * sizeof(T) );
+            for( int dim(0); dim < N; ++dim )
+                for( size_t begin(0); begin < records.size(); begin += values.size() ){
+                    size_t n = std::min(values.size(), records.size() - begin);
+                    for( size_t i(0); i < n; ++i )
+                        values[i] = records[begin + i].m_value[dim];
+                    write_at( m_layout.m_coords[dim] + (offset + begin) * sizeof(T), values.data(), n * sizeof(T) );
+                }
+            hold( -long(m_buffer_records * sizeof(T)) );
+
+            std::vector<size_t> ids(m_buffer_records);
+            hold( m_buffer_records * sizeof(size_t) );
+            for( size_t begin(0); begin < records.size(); begin += ids.size() ){
+                size_t n = std::min(ids.size(), records.size() - begin);
+                for( size_t i(0); i < n; ++i )
+                    ids[i] = records[begin + i].m_id;
+                write_at( m_layout.m_ids + (offset + begin) * sizeof(size_t), ids.data(), n * sizeof(size_t) );
+            }
+            hold( -long(m_buffer_records * sizeof(size_t)) );
+            hold( -long(s.m_size * sizeof(record)) );
+        }
+
+        /**
+         * @brief The record of rank nth in (value in dim, id) order among the points of a segment too large for the
+         * memory. Each round samples the candidates (the points between the bounds lo and hi) with a fixed stride,
+         * takes two sampled pivots around the expected position of the target and counts the candidates below and
+         * between them, collecting the latter while they fit in the budget. The target is then either among the
+         * collected points, found with nth_element, or the bounds are narrowed to the pivots for the next round.
+         */
+        record select_external( segment const& s, size_t nth, int dim ){
+            record_less less = { dim };
+            record lo, hi;
+            bool hasLo = false, hasHi = false;
+            size_t candidates = s.m_size;
+            const size_t capacity = m_budget / 2 / sizeof(record);
+
+            auto inRange = [&]( record const& r ){
+                return ( !hasLo || less(lo, r) ) && ( !hasHi || !less(hi, r) );
+            };
+
+            hold( m_buffer_records * sizeof(record) );
+            for( ;; ){
+                record newLo, newHi;
+                bool hasNewLo = hasLo, hasNewHi = hasHi;
+                newLo = lo;
+                newHi = hi;
+
+                if( candidates > capacity ){
+                    std::vector<record> sample;
+                    size_t stride = ( candidates + capacity - 1 ) / capacity;
+                    sample.reserve( candidates / stride + 1 );
+                    hold( sample.capacity() * sizeof(record) );
+                    size_t seen = 0;
+                    reader in( s, m_buffer_records, m_stats );
+                    for( record const* r = in.next(); r; r = in.next() )
+                        if( inRange(*r) && seen++ % stride == 0 )
+                            sample.push_back(*r);
+                    std::sort(sample.begin(), sample.end(), less);
+
+                    // pivots a few standard deviations of the sampling error around the expected position.
+                    double position = double(nth) * sample.size() / candidates;
+                    double delta = 3 * std::sqrt( double(sample.size()) ) + 1;
+                    if( position - delta >= 0 ){
+                        newLo = sample[ static_cast<size_t>(position - delta) ];
+                        hasNewLo = true;
+                    }
+                    if( position + delta < sample.size() ){
+                        newHi = sample[ static_cast<size_t>(position + delta) ];
+                        hasNewHi = true;
+                    }
+                    hold( -long(sample.capacity() * sizeof(record)) );
+                }
+
+                // counts the candidates up to newLo and in (newLo, newHi], collecting the latter while they fit.
+                std::vector<record> collected;
+                size_t below = 0, between = 0;
+                {
+                    reader in( s, m_buffer_records, m_stats );
+                    for( record const* r = in.next(); r; r = in.next() ){
+                        if( !inRange(*r) )
+                            continue;
+                        if( hasNewLo && !less(newLo, *r) )
+                            below += 1;
+                        else if( !hasNewHi || !less(newHi, *r) ){
+                            between += 1;
+                            if( between <= capacity ){
+                                if( collected.empty() ){
+                                    collected.reserve( std::min(capacity, candidates) );
+                                    hold( collected.capacity() * sizeof(record) );
+                                }
+                                collected.push_back(*r);
+                            }
+                        }
+                    }
+                }
+                size_t held = collected.capacity() * sizeof(record);
+
+                if( nth < below ){
+                    hi = newLo;
+                    hasHi = true;
+                    candidates = below;
+                } else if( nth >= below + between ){
+                    lo = newHi;
+                    hasLo = true;
+                    nth -= below + between;
+                    candidates -= below + between;
+                } else {
+                    nth -= below;
+                    if( between <= capacity ){
+                        std::nth_element(collected.begin(), collected.begin() + nth, collected.end(), less);
+                        record result = collected[nth];
+                        hold( -long(held) );
+                        hold( -long(m_buffer_records * sizeof(record)) );
+                        return result;
+                    }
+                    lo = newLo;
+                    hi = newHi;
+                    hasLo = hasNewLo;
+                    hasHi = hasNewHi;
+                    candidates = between;
+                }
+                hold( -long(held) );
+            }
+        }
+
+        std::string temp_path(){
+            return m_temp_prefix + ".part" + std::to_string(m_num_temp++);
+        }
+
+        void remove_segment( segment const& s ){
+            if( s.m_temporary ){
+                std::remove(s.m_path.c_str());
+                m_live_temp.erase(s.m_path);
+            }
+        }
+
+        bool fits_in_memory( size_t n ){
+            return n * sizeof(record) + num_nodes(n) * sizeof(flat_node_t<T>) + 2 * m_buffer_records * sizeof(record) <= m_budget;
+        }
+
+        // builds the subtree of the points of s, whose root is node index and whose first point is at offset.
+        void split_external( segment const& s, size_t index, size_t offset ){
+            if( s.m_size <= m_leaf_size || fits_in_memory(s.m_size) ){
+                build_in_memory(s, index, offset);
+                remove_segment(s);
+                return;
+            }
+
+            m_stats.m_external_splits += 1;
+            int dim = dim_with_highest_spread(s.m_lo, s.m_hi);
+            size_t mid = s.m_size / 2;
+            record median = select_external(s, mid, dim);
+            record_less less = { dim };
+
+            flat_node_t<T> node;
+            std::memset(static_cast<void*>(&node), 0, sizeof(node));
+            node.m_begin = offset;
+            node.m_end = offset + s.m_size;
+            node.m_split_dim = dim;
+            node.m_split_value = median.m_value[dim];
+            node.m_left = index + 1;
+            node.m_right = index + 1 + num_nodes(mid);
+            write_nodes(index, &node, 1);
+
+            segment left, right;
+            {
+                hold( 3 * m_buffer_records * sizeof(record) );
+                reader in( s, m_buffer_records, m_stats );
+                writer l( temp_path(), m_buffer_records, m_stats );
+                m_live_temp.insert( l.m_segment.m_path );
+                writer r( temp_path(), m_buffer_records, m_stats );
+                m_live_temp.insert( r.m_segment.m_path );
+                for( record const* e = in.next(); e; e = in.next() )
+                    ( less(*e, median) ? l : r ).push(*e);
+                left = l.close();
+                right = r.close();
+                hold( -long(3 * m_buffer_records * sizeof(record)) );
+            }
+            remove_segment(s);
+
+            split_external(left, node.m_left, offset);
+            split_external(right, node.m_right, offset + mid);
+        }
+
+    public:
+        // smaller budgets are raised to this, so that the samples of the external selection are large enough.
+        static const size_t min_budget = size_t(1) << 20;
+
+        stream_kdtree_builder( std::FILE * out, std::string const& out_path, kdtree_file_header const& header,
+            stream_build_params const& params, stream_build_stats & stats )
+            : m_out(out), m_out_path(out_path), m_layout(header), m_leaf_size(header.m_leaf_size),
+              m_budget( std::max(params.m_memory_budget, min_budget) ), m_stats(stats) {
+            // three I/O buffers are open at once while partitioning, a sixteenth of the budget in total.
+            m_buffer_records = m_budget / 48 / sizeof(record);
+            m_temp_prefix = params.m_temp_prefix.empty() ? out_path : params.m_temp_prefix;
+        }
+
+        // a build that throws leaves its temporary segments behind; they are removed here.
+        ~stream_kdtree_builder(){
+            for( std::string const& path : m_live_temp )
+                std::remove(path.c_str());
+        }
+
+        stream_kdtree_builder( stream_kdtree_builder const& ) = delete;
+        stream_kdtree_builder & operator=( stream_kdtree_builder const& ) = delete;
+
+        void build( std::string const& points_path, size_t num_points ){
+            if( num_points == 0 )
+                return;
+
+            segment input;
+            input.m_path = points_path;
+            input.m_raw = true;
+            input.m_temporary = false;
+            input.m_size = num_points;
+            input.m_lo.fill( std::numeric_limits<T>::max() );
+            input.m_hi.fill( std::numeric_limits<T>::lowest() );
+
+            // the bounding box of the input, for the split dimension of the root.
+            if( !fits_in_memory(num_points) ){
+                hold( 2 * m_buffer_records * sizeof(record) );
+                reader in( input, m_buffer_records, m_stats );
+                for( record const* r = in.next(); r; r = in.next() )
+                    for( int dim(0); dim < N; ++dim ){
+                        input.m_lo[dim] = std::min(input.m_lo[dim], r->m_value[dim]);
+                        input.m_hi[dim] = std::max(input.m_hi[dim], r->m_value[dim]);
+                    }
+                hold( -long(2 * m_buffer_records * sizeof(record)) );
+            }
+
+            split_external(input, 0, 0);
+        }
+
+        // checksum of the payload, read back from the file in buffer-sized pieces.
+        uint64_t checksum(){
+            kdtree_checksum checksum;
+            std::vector<char> buffer( m_buffer_records * sizeof(record) );
+            hold( buffer.size() );
+            if( std::fseek(m_out, static_cast<long>(sizeof(kdtree_file_header)), SEEK_SET) != 0 )
+                throw std::runtime_error("build_flat_kdtree_file failed to read back " + m_out_path);
+            for( size_t remaining = m_layout.m_file_size - sizeof(kdtree_file_header); remaining > 0; ){
+                size_t n = std::min(buffer.size(), remaining);
+                if( std::fread(buffer.data(), 1, n, m_out) != n )
+                    throw std::runtime_error("build_flat_kdtree_file failed to read back " + m_out_path);
+                checksum.update(buffer.data(), n);
+                m_stats.m_bytes_read += n;
+                remaining -= n;
+            }
+            hold( -long(buffer.size()) );
+            return checksum.value();
+        }
+};
+
+/**
+ * @brief Builds a flat kd-tree from the raw point file points_path (see save_point_file) without loading it,
+ * keeping the point data, samples and I/O buffers in memory within params.m_memory_budget (at least 1 MiB), and writes it to
+ * tree_path in the format of save_flat_kdtree. Like save_flat_kdtree the file is written under a unique temporary
+ * name and renamed at the end; if the build fails, the temporary file and all temporary segments are removed.
+ *
+ * @throws std::runtime_error if a file cannot be read or written, or the point file is not a whole number of
+ * points.
+ */
+template<typename T, int N>
+stream_build_stats build_flat_kdtree_file( std::string const& points_path, std::string const& tree_path,
+    stream_build_params const& params = stream_build_params() ){
+
+    static_assert( std::is_trivially_copyable<key<T,N>>::value, "key must be trivially copyable" );
+    stream_build_stats stats;
+    timer t;
+
+    struct stat info;
+    if( ::stat(points_path.c_str(), &info) != 0 )
+        throw std::runtime_error("build_flat_kdtree_file failed to open " + points_path);
+    size_t bytes = static_cast<size_t>(info.st_size);
+    if( bytes % sizeof(std::array<T,N>) != 0 )
+        throw std::runtime_error("build_flat_kdtree_file: " + points_path + " is not a file of points");
+    stats.m_num_points = bytes / sizeof(std::array<T,N>);
+
+    flat_kdtree<T,N> empty;
+    empty.m_leaf_size = std::max<size_t>(params.m_leaf_size, 1);
+    kdtree_file_header header = make_kdtree_file_header(empty);
+    header.m_num_points = stats.m_num_points;
+
+    kdtree_temp_file tmp(tree_path);
+    std::string const& tmpPath = tmp.path();
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> out( std::fopen(tmpPath.c_str(), "w+b"), std::fclose );
+    if( !out )
+        throw std::runtime_error("build_flat_kdtree_file failed to create " + tmpPath);
+
+    std::map<size_t,size_t> memo;
+    header.m_num_nodes = stats.m_num_points == 0 ? 0 : flat_kdtree_num_nodes( stats.m_num_points, header.m_leaf_size, memo );
+
+    // the payload is written in place, so the file gets its final size first; the padding stays zero.
+    kdtree_file_layout<T,N> layout(header);
+    if( ::ftruncate(::fileno(out.get()), static_cast<off_t>(layout.m_file_size)) != 0 )
+        throw std::runtime_error("build_flat_kdtree_file failed to write " + tmpPath);
+
+    stream_kdtree_builder<T,N> builder( out.get(), tmpPath, header, params, stats );
+    builder.build( points_path, stats.m_num_points );
+    header.m_checksum = builder.checksum();
+
+    if( std::fseek(out.get(), 0, SEEK_SET) != 0
+        || std::fwrite(&header, sizeof(header), 1, out.get()) != 1 || std::fclose(out.release()) != 0 )
+        throw std::runtime_error("build_flat_kdtree_file failed to write " + tmpPath);
+
+    tmp.commit();
+
+    stats.m_seconds = t.seconds();
+    return stats;
+}
@@ -0,0 +1,440 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <array>
+
+#include "kdtree.hpp"
+#include "parallel.hpp"
+#include "timer.hpp"
+
+/*************************************************************************************************************
+ * All-pairs k-nearest-neighbour join between two trees from build_kdtree: for every point of the query tree, its
+ * k nearest points of the reference tree, found by one simultaneous traversal of both trees (a dual-tree search)
+ * instead of one descent of the reference tree per query point. A pair of query and reference subtrees is pruned
+ * as a whole when the distance between their bounding boxes exceeds the current k-th neighbour distance of every
+ * query point in the query subtree, so neighbouring query points share the traversal work.
+ *************************************************************************************************************/
+
+/**
+ * @brief Node of a join_tree: the bounding box of the points of its subtree, which are points [m_begin, m_end) of
+ * the join_tree, and its children (-1 if absent). Leaves have no children.
+ */
+template<typename T, int N>
+struct join_node {
+    std::array<T,N> m_lo;
+    std::array<T,N> m_hi;
+    size_t          m_begin;
+    size_t          m_end;
+    long            m_left  = -1;
+    long            m_right = -1;
+
+    bool   isLeaf() const { return m_left < 0 && m_right < 0; }
+    size_t size()   const { return m_end - m_begin; }
+};
+
+/**
+ * @brief Copy of a node_t tree prepared for the dual-tree join: the tree structure down to subtrees of at most
+ * leaf_size points, tight bounding boxes of every subtree (node_t stores none) and the coordinates of the points
+ * in structure-of-arrays form in the order of the leaves, so that the leaf-against-leaf distances use the SIMD
+ * distance kernels. The key held by an internal node_t is routed down the split planes like an insertion, to the
+ * leaf whose cell contains it. Tombstones of remove_from_kdtree are left out.
+ */
+template<typename T, int N>
+class join_tree {
+    private:
+        std::vector<join_node<T,N>>  m_nodes;
+        std::array<std::vector<T>,N> m_coords;
+        std::vector<size_t>          m_ids;
+        size_t                       m_leaf_size;
+        size_t                       m_max_leaf = 0;     // points of the largest leaf, routed keys included
+
+        void append_point( key<T,N> const& e ){
+            for( int dim(0); dim < N; ++dim )
+                m_coords[dim].push_back( e.m_value[dim] );
+            m_ids.push_back( e.m_id );
+        }
+
+        void fit_box( join_node<T,N> & node ) const {
+            for( int dim(0); dim < N; ++dim ){
+                auto range = std::minmax_element( m_coords[dim].begin() + node.m_begin, m_coords[dim].begin() + node.m_end );
+                node.m_lo[dim] = *range.first;
+                node.m_hi[dim] = *range.second;
+            }
+        }
+
+        // builds the copy of the subtree of node plus the keys routed to it from its ancestors; returns its index.
+        long build( node_t<T,N> const* node, std::vector<key<T,N> const*> const& routed ){
+            size_t count = ( node ? node->size() : 0 ) + routed.size();
+            if( count == 0 )
+                return -1;
+
+            long index = static_cast<long>( m_nodes.size() );
+            m_nodes.push_back( join_node<T,N>() );
+            m_nodes[index].m_begin = m_ids.size();
+
+            if( node == nullptr || node->isLeaf() || count <= m_leaf_size ){
+                for( key<T,N> const* e : routed )
+                    append_point( *e );
+                if( node ){
+                    auto append = [this]( key<T,N> const& e ){ append_point( e ); };
+                    for_each_in_subtree<T,N>(node, append);
+                }
+                m_nodes[index].m_end = m_ids.size();
+                m_max_leaf = std::max( m_max_leaf, m_nodes[index].size() );
+                fit_box( m_nodes[index] );
+                return index;
+            }
+
+            int dim = node->m_split_dim;
+            T split = node->m_key.m_value[dim];
+            std::vector<key<T,N> const*> left, right;
+            for( key<T,N> const* e : routed )
+                ( e->m_value[dim] < split ? left : right ).push_back( e );
+            if( !node->m_deleted )
+                right.push_back( &node->m_key );
+
+            long l = build( node->m_left, left );
+            long r = build( node->m_right, right );
+            join_node<T,N> & self = m_nodes[index];
+            self.m_left = l;
+            self.m_right = r;
+            self.m_end = m_ids.size();
+            if( l >= 0 && r >= 0 )
+                for( int dim(0); dim < N; ++dim ){
+                    self.m_lo[dim] = std::min( m_nodes[l].m_lo[dim], m_nodes[r].m_lo[dim] );
+                    self.m_hi[dim] = std::max( m_nodes[l].m_hi[dim], m_nodes[r].m_hi[dim] );
+                }
+            else {
+                self.m_lo = m_nodes[ l >= 0 ? l : r ].m_lo;
+                self.m_hi = m_nodes[ l >= 0 ? l : r ].m_hi;
+            }
+            return index;
+        }
+
+    public:
+        explicit join_tree( node_t<T,N> const* root, size_t leaf_size = 16 ) : m_leaf_size( std::max<size_t>(leaf_size, 1) ) {
+            size_t size = root ? root->size() : 0;
+            m_ids.reserve( size );
+            for( int dim(0); dim < N; ++dim )
+                m_coords[dim].reserve( size );
+            build( root, std::vector<key<T,N> const*>() );
+        }
+
+        size_t size()        const { return m_ids.size(); }
+        bool   empty()       const { return m_ids.empty(); }
+        size_t numNodes()    const { return m_nodes.size(); }
+        size_t maxLeafSize() const { return m_max_leaf; }
+
+        join_node<T,N> const& getNode( size_t i ) const { return m_nodes[i]; }
+        size_t                getID( size_t i )   const { return m_ids[i]; }
+
+        T getValue( size_t i, int dim ) const { return m_coords[dim][i]; }
+
+        std::array<T,N> getPoint( size_t i ) const {
+            std::array<T,N> p;
+            for( int dim(0); dim < N; ++dim )
+                p[dim] = m_coords[dim][i];
+            return p;
+        }
+
+        // coordinates of points [begin, end) in the layout of squared_distances.
+        std::array<T const*,N> getCoords( size_t begin ) const {
+            std::array<T const*,N> coords;
+            for( int dim(0); dim < N; ++dim )
+                coords[dim] = m_coords[dim].data() + begin;
+            return coords;
+        }
+};
+
+/**
+ * @brief Squared distance between two axis-aligned boxes, zero if they intersect. Like the cell distances of the
+ * single-tree searches it is computed with the same floating point operations as the point distances, so it never
+ * exceeds the computed distance of two points inside the boxes.
+ */
+template<typename T, int N>
+T box_squared_distance( std::array<T,N> const& alo, std::array<T,N> const& ahi, std::array<T,N> const& blo, std::array<T,N> const& bhi ){
+    T s = 0;
+    for( int dim(0); dim < N; ++dim ){
+        T gap = std::max( std::max( blo[dim] - ahi[dim], alo[dim] - bhi[dim] ), T(0) );
+        s += gap * gap;
+    }
+    return s;
+}
+
+/**
+ * @brief Result of knn_join in compressed sparse row form: the neighbours of query point i (by its id) are entries
+ * [m_offsets[i], m_offsets[i+1]) of m_ids and m_distances, sorted by increasing distance and then by id. A row
+ * holds fewer than k neighbours only if the reference tree has fewer than k points (minus the point itself for a
+ * self join); rows of ids that are not in the query tree are empty.
+ */
+template<typename T>
+struct knn_join_result {
+    std::vector<size_t> m_offsets;
+    std::vector<size_t> m_ids;
+    std::vector<T>      m_distances;
+    search_stats        m_stats;      // node pairs visited and point pairs whose distance was computed
+    double              m_seconds = 0;
+
+    size_t numRows()                            const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+    size_t rowSize( size_t row )                const { return m_offsets[row+1] - m_offsets[row]; }
+    size_t getID( size_t row, size_t j )        const { return m_ids[m_offsets[row] + j]; }
+    T      getDistance( size_t row, size_t j )  const { return m_distances[m_offsets[row] + j]; }
+};
+
+/**
+ * @brief State of one knn_join: the two trees, a bounded max-heap of k squared distances per query point (stored
+ * in one array, in the order of the query join_tree) and the bound of every query node, the largest k-th neighbour
+ * distance of its points. The threads work on disjoint query subtrees, so they share it without synchronisation.
+ */
+template<typename T, int N>
+class knn_join_state {
+    private:
+        join_tree<T,N> const&    m_queries;
+        join_tree<T,N> const&    m_references;
+        size_t                   m_k;
+        bool                     m_exclude_self;
+        std::vector<neighbor<T>> m_heaps;
+        std::vector<size_t>      m_heap_sizes;
+        std::vector<T>           m_bounds;
+        std::vector<long>        m_seed_leaves;   // reference leaf joined with each query leaf by seed()
+
+        T point_bound( size_t q ) const {
+            return m_heap_sizes[q] < m_k ? std::numeric_limits<T>::max() : m_heaps[q * m_k].m_distance;
+        }
+
+        void push( size_t q, size_t id, T distance ){
+            neighbor<T> * heap = &m_heaps[q * m_k];
+            size_t & size = m_heap_sizes[q];
+            neighbor<T> candidate = { id, distance };
+            if( size < m_k ){
+                heap[size++] = candidate;
+                std::push_heap( heap, heap + size );
+            } else if( candidate < heap[0] ){
+                std::pop_heap( heap, heap + size );
+                heap[size-1] = candidate;
+                std::push_heap( heap, heap + size );
+            }
+        }
+
+        void base_case( long q_index, join_node<T,N> const& qnode, join_node<T,N> const& rnode, std::vector<T> & distances, search_stats & stats ){
+            std::array<T const*,N> coords = m_references.getCoords( rnode.m_begin );
+            T bound = 0;
+            for( size_t q(qnode.m_begin); q < qnode.m_end; ++q ){
+                std::array<T,N> point = m_queries.getPoint( q );
+                if( box_squared_distance<T,N>(point, point, rnode.m_lo, rnode.m_hi) <= point_bound(q) ){
+                    squared_distances<T,N>(coords, rnode.size(), point, distances.data());
+                    stats.m_points_visited += rnode.size();
+                    size_t id = m_queries.getID( q );
+                    for( size_t r(0); r < rnode.size(); ++r ){
+                        size_t rid = m_references.getID( rnode.m_begin + r );
+                        if( !( m_exclude_self && rid == id ) )
+                            push( q, rid, distances[r] );
+                    }
+                }
+                bound = std::max( bound, point_bound(q) );
+            }
+            m_bounds[q_index] = bound;
+        }
+
+    public:
+        knn_join_state( join_tree<T,N> const& queries, join_tree<T,N> const& references, size_t k, bool exclude_self )
+            : m_queries(queries), m_references(references), m_k(k), m_exclude_self(exclude_self),
+              m_heaps(queries.size() * k), m_heap_sizes(queries.size(), 0),
+              m_bounds(queries.numNodes(), std::numeric_limits<T>::max()), m_seed_leaves(queries.numNodes(), -1) {}
+
+        /**
+         * @brief Joins every query leaf of the subtree q with the reference leaf closest to the centre of its box,
+         * found by a greedy descent, before the traversal. The traversal starts with no bound at all and would
+         * otherwise fill the heaps with the points of whichever leaves it reaches first; the seeded bounds are
+         * close to the final ones and prune most pairs from the start.
+         */
+        void seed( long q, std::vector<T> & distances, search_stats & stats ){
+            join_node<T,N> const& qnode = m_queries.getNode(q);
+            if( qnode.isLeaf() ){
+                std::array<T,N> center;
+                for( int dim(0); dim < N; ++dim )
+                    center[dim] = qnode.m_lo[dim] + ( qnode.m_hi[dim] - qnode.m_lo[dim] ) / 2;
+                long r = 0;
+                while( !m_references.getNode(r).isLeaf() ){
+                    join_node<T,N> const& rnode = m_references.getNode(r);
+                    if( rnode.m_left < 0 || rnode.m_right < 0 )
+                        r = rnode.m_left >= 0 ? rnode.m_left : rnode.m_right;
+                    else {
+                        join_node<T,N> const& a = m_references.getNode(rnode.m_left);
+                        join_node<T,N> const& b = m_references.getNode(rnode.m_right);
+                        r = box_squared_distance<T,N>(center, center, b.m_lo, b.m_hi) <
+                            box_squared_distance<T,N>(center, center, a.m_lo, a.m_hi) ? rnode.m_right : rnode.m_left;
+                    }
+                }
+                m_seed_leaves[q] = r;
+                base_case( q, qnode, m_references.getNode(r), distances, stats );
+                return;
+            }
+
+            T bound = 0;
+            for( long child : { qnode.m_left, qnode.m_right } )
+                if( child >= 0 ){
+                    seed( child, distances, stats );
+                    bound = std::max( bound, m_bounds[child] );
+                }
+            m_bounds[q] = bound;
+        }
+
+        // recurses into the pairs of q with the children of the reference node, the closest child first.
+        void traverse_references( long q, join_node<T,N> const& rnode, std::vector<T> & distances, search_stats & stats ){
+            join_node<T,N> const& qnode = m_queries.getNode(q);
+            long first = rnode.m_left, second = rnode.m_right;
+            if( first >= 0 && second >= 0 ){
+                join_node<T,N> const& a = m_references.getNode(first);
+                join_node<T,N> const& b = m_references.getNode(second);
+                if( box_squared_distance<T,N>(qnode.m_lo, qnode.m_hi, b.m_lo, b.m_hi) <
+                    box_squared_distance<T,N>(qnode.m_lo, qnode.m_hi, a.m_lo, a.m_hi) )
+                    std::swap( first, second );
+            }
+            if( first >= 0 )
+                traverse( q, first, distances, stats );
+            if( second >= 0 )
+                traverse( q, second, distances, stats );
+        }
+
+        /**
+         * @brief Dual-tree recursion on the query subtree q and the reference subtree r. Both nodes are split and
+         * every query child visits the reference children closest first, so that the bounds shrink early and the
+         * far pairs are pruned.
+         */
+        void traverse( long q, long r, std::vector<T> & distances, search_stats & stats ){
+            join_node<T,N> const& qnode = m_queries.getNode(q);
+            join_node<T,N> const& rnode = m_references.getNode(r);
+            stats.m_nodes_visited += 1;
+
+            if( box_squared_distance<T,N>(qnode.m_lo, qnode.m_hi, rnode.m_lo, rnode.m_hi) > m_bounds[q] )
+                return;
+
+            if( qnode.isLeaf() ){
+                if( rnode.isLeaf() ){
+                    if( r != m_seed_leaves[q] )
+                        base_case( q, qnode, rnode, distances, stats );
+                }
+                else
+                    traverse_references( q, rnode, distances, stats );
+                return;
+            }
+
+            T bound = 0;
+            for( long child : { qnode.m_left, qnode.m_right } )
+                if( child >= 0 ){
+                    if( rnode.isLeaf() )
+                        traverse( child, r, distances, stats );
+                    else
+                        traverse_references( child, rnode, distances, stats );
+                    bound = std::max( bound, m_bounds[child] );
+                }
+            m_bounds[q] = bound;
+        }
+
+        /**
+         * @brief Query subtrees of the work queue of the threads: the topmost nodes with at most maxSize points.
+         */
+        void collect_tasks( long q, size_t maxSize, std::vector<long> & tasks ) const {
+            join_node<T,N> const& node = m_queries.getNode(q);
+            if( node.isLeaf() || node.size() <= maxSize ){
+                tasks.push_back( q );
+                return;
+            }
+            for( long child : { node.m_left, node.m_right } )
+                if( child >= 0 )
+                    collect_tasks( child, maxSize, tasks );
+        }
+
+        // sorts the heaps and writes them to result, rows indexed by the ids of the query points.
+        void finalize( knn_join_result<T> & result ){
+            size_t numRows = 0;
+            for( size_t q(0); q < m_queries.size(); ++q )
+                numRows = std::max( numRows, m_queries.getID(q) + 1 );
+
+            result.m_offsets.assign( numRows + 1, 0 );
+            for( size_t q(0); q < m_queries.size(); ++q )
+                result.m_offsets[ m_queries.getID(q) + 1 ] = m_heap_sizes[q];
+            for( size_t row(0); row < numRows; ++row )
+                result.m_offsets[row+1] += result.m_offsets[row];
+
+            result.m_ids.resize( result.m_offsets.back() );
+            result.m_distances.resize( result.m_offsets.back() );
+            for( size_t q(0); q < m_queries.size(); ++q ){
+                neighbor<T> * heap = &m_heaps[q * m_k];
+                std::sort_heap( heap, heap + m_heap_sizes[q] );
+                size_t offset = result.m_offsets[ m_queries.getID(q) ];
+                for( size_t j(0); j < m_heap_sizes[q]; ++j ){
+                    result.m_ids[offset + j] = heap[j].m_id;
+                    result.m_distances[offset + j] = std::sqrt( heap[j].m_distance );
+                }
+            }
+        }
+};
+
+/**
+ * @brief k nearest neighbours in references of every point in queries, with the Euclidean distance, on
+ * num_threads threads (0 = all cores). The query tree is cut into subtrees that are handed out to the threads
+ * through an atomic counter; each of them is joined with the whole reference tree. The neighbours, and their
+ * order for equal distances, are exactly those of knn_query for every query point.
+ *
+ * @param exclude_self skip reference points with the id of the query point, for a self join of a tree with itself.
+ */
+template<typename T, int N>
+knn_join_result<T> knn_join( join_tree<T,N> const& queries, join_tree<T,N> const& references, size_t k,
+    int num_threads = 0, bool exclude_self = false ){
+
+    knn_join_result<T> result;
+    timer t;
+
+    knn_join_state<T,N> state( queries, references, k, exclude_self );
+    std::vector<long> tasks;
+    num_threads = resolve_num_threads(num_threads);
+
+    if( k > 0 && !queries.empty() && !references.empty() ){
+        // a few tasks per thread for load balance, but large enough to share most of the traversal.
+        state.collect_tasks( 0, std::max<size_t>( 1, queries.size() / ( 16 * num_threads ) ), tasks );
+
+        std::atomic<size_t> next(0);
+        std::vector<search_stats> stats( num_threads );
+        parallel_for_chunks( 0, size_t(num_threads), num_threads, [&]( size_t thread, size_t, size_t ){
+            std::vector<T> distances( references.maxLeafSize() );
+            for( size_t task = next.fetch_add(1); task < tasks.size(); task = next.fetch_add(1) ){
+                state.seed( tasks[task], distances, stats[thread] );
+                state.traverse( tasks[task], 0, distances, stats[thread] );
+            }
+        });
+        for( search_stats const& s : stats ){
+            result.m_stats.m_nodes_visited += s.m_nodes_visited;
+            result.m_stats.m_points_visited += s.m_points_visited;
+        }
+    }
+
+    state.finalize( result );
+    result.m_seconds = t.seconds();
+    return result;
+}
+
+/**
+ * @brief knn_join of two trees from build_kdtree, with leaves of at most leaf_size points.
+ */
+template<typename T, int N>
+knn_join_result<T> knn_join( node_t<T,N> const* queries, node_t<T,N> const* references, size_t k,
+    int num_threads = 0, size_t leaf_size = 16 ){
+    join_tree<T,N> q( queries, leaf_size );
+    join_tree<T,N> r( references, leaf_size );
+    return knn_join<T,N>(q, r, k, num_threads);
+}
+
+/**
+ * @brief k nearest neighbours of every point of the tree among the other points of the tree: the k-nearest-
+ * neighbour graph of the dataset, each point excluding itself.
+ */
+template<typename T, int N>
+knn_join_result<T> knn_self_join( node_t<T,N> const* root, size_t k, int num_threads = 0, size_t leaf_size = 16 ){
+    join_tree<T,N> tree( root, leaf_size );
+    return knn_join<T,N>(tree, tree, k, num_threads, true);
+}
@@ -1,9 +1,18 @@
 #pragma once
 
-// C++ program to find groups of unknown Points using K nearest neighbour algorithm.
-#include <bits/stdc++.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 #include <vector>
 
+#include "kdtree.hpp"
+#include "distance_kernels.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
+#include "batch_search.hpp"
+#include "timer.hpp"
+
 template<typename T, int N>
 struct Point{
     std::array<T,N> coord;  // Co-ordinate of point
@@ -11,43 +20,159 @@ struct Point{
     Point( std::array<T,N> p ) : coord(p), distance(0) {}
 };
 
-// Used to sort an array of points by increasing
-// order of distance
-// bool comparison(Point<float,1> a, Point<float,1> b){ return (a.distance < b.distance); }
-bool comparison(Point<float,2> a, Point<float,2> b){ return (a.distance < b.distance); }
-// bool comparison(Point<float,3> a, Point<float,3> b){ return (a.distance < b.distance); }
-// bool comparison(Point<float,4> a, Point<float,4> b){ return (a.distance < b.distance); }
-// bool comparison(Point<float,5> a, Point<float,5> b){ return (a.distance < b.distance); }
+// Used to sort an array of points by increasing order of distance.
+template<typename T, int N>
+bool comparison( Point<T,N> const& a, Point<T,N> const& b ){ return a.distance < b.distance; }
 
+/**
+ * @brief Points of a vector of Point (see knn_search) as seen by knn_brute_force: the id of a point is its index.
+ */
 template<typename T, int N>
-std::vector<Point<T,N>> knn_search( Point<T,N> queryPoint, int k, std::vector<Point<T,N>> vec ) {
-
-    // Fill distances of all points from queryPoint.
-    for ( size_t i = 0; i < vec.size(); ++i ){
-        vec[i].distance = 0;
-        for ( size_t dim = 0; dim < N; ++dim )
-            vec[i].distance += std::pow(vec[i].coord[dim] - queryPoint.coord[dim],2);
-        vec[i].distance = std::sqrt(vec[i].distance);
-    }
+struct point_coords {
+    std::vector<Point<T,N>> const& m_data;
 
-    // Sort the Points by distance from queryPoint.
-    std::sort(vec.begin(), vec.end(), comparison);
+    size_t size()                               const { return m_data.size(); }
+    std::array<T,N> const& value( size_t i )    const { return m_data[i].coord; }
+    size_t id( size_t i )                       const { return i; }
+};
 
-    // Select and return the k nearest-neighbors.
-    std::vector<Point<T,N>> knn;
-    for( int i(0); i < k; ++i )
-        knn.push_back(vec[i]);
+// bytes of one block of points in structure-of-arrays form, sized to stay in the L1 cache while a tile of
+// queries is compared against it.
+constexpr size_t brute_force_block_bytes = 16384;
+// queries that share the blocks of points.
+constexpr size_t brute_force_query_tile  = 64;
+
+/**
+ * @brief Exact k nearest neighbours of a batch of queries by comparing every query with every point, for any T,
+ * N and metric (see metrics.hpp). Points is a read-only view with size(), value(i) and id(i), e.g. indexed_points
+ * or key_points; the dataset is neither copied nor modified.
+ *
+ * The computation is tiled like a matrix product: a tile of brute_force_query_tile queries is compared against
+ * one block of points at a time, transposed into structure-of-arrays form and small enough for the L1 cache, so
+ * every point is loaded from memory once per tile of queries instead of once per query. The distances of a
+ * block are computed by metric_distances (the SIMD kernels for the Euclidean metric) and every query keeps its
+ * candidates in a bounded max-heap, whose bound rejects most points with a single comparison. The tiles of
+ * queries are split over num_threads threads (0 = all cores).
+ *
+ * Ties are broken by the smaller id, so the result equals that of knn_batch on a kd-tree of the same points and
+ * does not depend on the number of threads. Rows of queries with fewer than k points are padded as in knn_batch.
+ */
+template<typename T, int N, typename Points, typename Metric = euclidean_metric<T,N>>
+knn_batch_result<T> knn_brute_force( Points const& points, std::array<T,N> const* queries, size_t numQueries, size_t k,
+    int num_threads = 0, Metric const& metric = Metric() ){
+
+    knn_batch_result<T> result;
+    result.m_num_queries = numQueries;
+    result.m_k = k;
+    result.m_ids.assign(numQueries * k, std::numeric_limits<size_t>::max());
+    result.m_distances.assign(numQueries * k, std::numeric_limits<T>::infinity());
+    if( numQueries == 0 || k == 0 )
+        return result;
+
+    timer t;
+
+    const size_t numPoints = points.size();
+    const size_t block = std::max<size_t>( 64, brute_force_block_bytes / ( N * sizeof(T) ) / 64 * 64 );
+    const size_t tile = std::min( brute_force_query_tile, numQueries );
+    const size_t numTiles = ( numQueries + tile - 1 ) / tile;
+
+    parallel_for_chunks( 0, numTiles, resolve_num_threads(num_threads), [&]( size_t, size_t tileBegin, size_t tileEnd ){
+        std::array<std::vector<T>,N> soa;
+        std::array<T const*,N> coords;
+        for( int dim(0); dim < N; ++dim ){
+            soa[dim].resize(block);
+            coords[dim] = soa[dim].data();
+        }
+        std::vector<T> distances(block);
+        std::vector<std::vector<neighbor<T>>> heaps(tile);
+        std::vector<T> bounds(tile);
+        for( std::vector<neighbor<T>> & heap : heaps )
+            heap.reserve(k);
+
+        for( size_t tileIndex(tileBegin); tileIndex < tileEnd; ++tileIndex ){
+            size_t queryBegin = tileIndex * tile;
+            size_t count = std::min( tile, numQueries - queryBegin );
+            for( size_t j(0); j < count; ++j ){
+                heaps[j].clear();
+                bounds[j] = neighbor_bound( heaps[j], k );
+            }
+
+            for( size_t begin(0); begin < numPoints; begin += block ){
+                size_t blockSize = std::min( block, numPoints - begin );
+                for( size_t i(0); i < blockSize; ++i ){
+                    std::array<T,N> const& p = points.value(begin + i);
+                    for( int dim(0); dim < N; ++dim )
+                        soa[dim][i] = p[dim];
+                }
+
+                for( size_t j(0); j < count; ++j ){
+                    metric_distances<T,N>(metric, coords, blockSize, queries[queryBegin + j], distances.data());
+                    std::vector<neighbor<T>> & heap = heaps[j];
+                    T bound = bounds[j];
+                    // once the heap is full, few points of a block enter it: a branch-free count skips the others.
+                    size_t candidates = 0;
+                    for( size_t i(0); i < blockSize; ++i )
+                        candidates += distances[i] <= bound;
+                    for( size_t i(0); i < blockSize && candidates > 0; ++i ){
+                        if( distances[i] <= bound ){
+                            push_neighbor( heap, k, points.id(begin + i), distances[i] );
+                            bound = neighbor_bound( heap, k );
+                        }
+                    }
+                    bounds[j] = bound;
+                }
+            }
 
+            for( size_t j(0); j < count; ++j ){
+                size_t query = queryBegin + j;
+                finalize_neighbors( heaps[j], metric );
+                for( size_t n(0); n < heaps[j].size(); ++n ){
+                    result.m_ids[query * k + n] = heaps[j][n].m_id;
+                    result.m_distances[query * k + n] = heaps[j][n].m_distance;
+                }
+            }
+        }
+    });
+
+    result.m_seconds = t.seconds();
+    return result;
+}
+
+template<typename T, int N, typename Metric = euclidean_metric<T,N>>
+knn_batch_result<T> knn_brute_force( std::vector<std::array<T,N>> const& data, std::vector<std::array<T,N>> const& queries,
+    size_t k, int num_threads = 0, Metric const& metric = Metric() ){
+    indexed_points<T,N,std::vector<std::array<T,N>>> points{ data };
+    return knn_brute_force<T,N>(points, queries.data(), queries.size(), k, num_threads, metric);
+}
+
+// the k nearest neighbours of one query as Points, on the calling thread.
+template<typename T, int N, typename Points>
+std::vector<Point<T,N>> knn_search_points( Points const& points, std::array<T,N> const& coord, int k ){
+    knn_batch_result<T> nearest = knn_brute_force<T,N>(points, &coord, 1, k > 0 ? static_cast<size_t>(k) : 0, 1);
+
+    std::vector<Point<T,N>> knn;
+    knn.reserve(nearest.m_k);
+    for( size_t j(0); j < nearest.m_k && nearest.getID(0, j) < points.size(); ++j ){
+        knn.push_back( Point<T,N>( points.value(nearest.getID(0, j)) ) );
+        knn.back().distance = nearest.getDistance(0, j);
+    }
     return knn;
 }
 
+/**
+ * @brief Brute-force k nearest neighbours of queryPoint among the Points of vec, sorted by increasing distance.
+ * The Points are only read; see knn_brute_force.
+ */
 template<typename T, int N>
-std::vector<Point<T,N>> knn_search( std::array<T,N> const& coord, int k, std::vector<std::array<T,N>> const& data ) {
-    std::vector<Point<T,N>> vec;
-    for( size_t i(0); i < data.size(); ++i )
-        vec.push_back( Point<T,N>(data[i]) );
-    
-    Point<T,N> queryPoint = Point<T,N>( coord );
+std::vector<Point<T,N>> knn_search( Point<T,N> const& queryPoint, int k, std::vector<Point<T,N>> const& vec ) {
+    return knn_search_points<T,N>( point_coords<T,N>{ vec }, queryPoint.coord, k );
+}
 
-    return knn_search( queryPoint, k, vec );
+/**
+ * @brief Brute-force k nearest neighbours of coord, sorted by increasing distance; see knn_brute_force. Use
+ * knn_brute_force directly for many queries, which shares every block of points between a tile of queries.
+ */
+template<typename T, int N>
+std::vector<Point<T,N>> knn_search( std::array<T,N> const& coord, int k, std::vector<std::array<T,N>> const& data ) {
+    return knn_search_points<T,N>( indexed_points<T,N,std::vector<std::array<T,N>>>{ data }, coord, k );
 }
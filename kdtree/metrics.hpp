@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "distance_kernels.hpp"
+
+/*************************************************************************************************************
+ * Distance metrics of the kd-tree searches, passed to them as policy types so that every metric gets its own
+ * fully inlined search without any runtime dispatch. The default everywhere is euclidean_metric.
+ *
+ * A metric works with a reduced distance, which is monotonic in the actual distance (e.g. the squared distance
+ * for Euclidean), accumulated dimension by dimension in the order of the dimensions:
+ *   component( diff, dim )                contribution of the coordinate difference diff along dim
+ *   interval_component( q, lo, hi, dim )  lower bound of the contribution of any coordinate in [lo, hi]
+ *   farthest_component( q, lo, hi, dim )  upper bound of the contribution of any coordinate in [lo, hi]
+ *   combine( acc, c )                     accumulation of the contributions, starting from zero
+ *   reduced( d ) / actual( rd )           conversion between actual and reduced distances
+ *
+ * The interval bounds give the distance of a query point to the cell of a tree node that is used for pruning.
+ * They are computed with the same floating point operations as the point distances, so a cell is never closer
+ * than the computed distance of any point inside it and pruning does not change the results.
+ */
+
+// distance of q from the interval [lo, hi] along one dimension, zero if q is inside.
+template<typename T>
+T interval_gap( T q, T lo, T hi ){
+    return std::max( std::max( lo - q, q - hi ), T(0) );
+}
+
+// largest distance of q from any coordinate in the interval [lo, hi] along one dimension.
+template<typename T>
+T interval_span( T q, T lo, T hi ){
+    return std::max( q - lo, hi - q );
+}
+
+template<typename T, int N>
+struct euclidean_metric {
+    T component( T diff, int ) const                   { return diff * diff; }
+    T interval_component( T q, T lo, T hi, int ) const { T g = interval_gap(q, lo, hi); return g * g; }
+    T farthest_component( T q, T lo, T hi, int ) const { T g = interval_span(q, lo, hi); return g * g; }
+    T combine( T acc, T c ) const                      { return acc + c; }
+    T reduced( T d ) const                             { return d * d; }
+    T actual( T rd ) const                             { return std::sqrt(rd); }
+};
+
+template<typename T, int N>
+struct manhattan_metric {
+    T component( T diff, int ) const                   { return std::abs(diff); }
+    T interval_component( T q, T lo, T hi, int ) const { return interval_gap(q, lo, hi); }
+    T farthest_component( T q, T lo, T hi, int ) const { return interval_span(q, lo, hi); }
+    T combine( T acc, T c ) const                      { return acc + c; }
+    T reduced( T d ) const                             { return d; }
+    T actual( T rd ) const                             { return rd; }
+};
+
+template<typename T, int N>
+struct chebyshev_metric {
+    T component( T diff, int ) const                   { return std::abs(diff); }
+    T interval_component( T q, T lo, T hi, int ) const { return interval_gap(q, lo, hi); }
+    T farthest_component( T q, T lo, T hi, int ) const { return interval_span(q, lo, hi); }
+    T combine( T acc, T c ) const                      { return std::max(acc, c); }
+    T reduced( T d ) const                             { return d; }
+    T actual( T rd ) const                             { return rd; }
+};
+
+/**
+ * @brief Euclidean distance with a weight per dimension: sqrt( sum w[dim] * diff^2 ). Weights must be positive.
+ */
+template<typename T, int N>
+struct weighted_euclidean_metric {
+    std::array<T,N> m_weights;
+
+    T component( T diff, int dim ) const                   { return m_weights[dim] * ( diff * diff ); }
+    T interval_component( T q, T lo, T hi, int dim ) const { T g = interval_gap(q, lo, hi); return m_weights[dim] * ( g * g ); }
+    T farthest_component( T q, T lo, T hi, int dim ) const { T g = interval_span(q, lo, hi); return m_weights[dim] * ( g * g ); }
+    T combine( T acc, T c ) const                          { return acc + c; }
+    T reduced( T d ) const                                 { return d * d; }
+    T actual( T rd ) const                                 { return std::sqrt(rd); }
+};
+
+/**
+ * @brief Euclidean distance in a periodic (wrap-around) box [0, m_box[dim]) per dimension, using the minimum
+ * image convention. All points, and the query points, must lie inside the box.
+ */
+template<typename T, int N>
+struct periodic_euclidean_metric {
+    std::array<T,N> m_box;
+
+    T component( T diff, int dim ) const {
+        T a = std::abs(diff);
+        a = std::min( a, m_box[dim] - a );
+        return a * a;
+    }
+
+    T interval_component( T q, T lo, T hi, int dim ) const {
+        lo = std::max( lo, T(0) );
+        hi = std::min( hi, m_box[dim] );
+        T g = T(0);
+        if( q < lo )
+            g = std::min( lo - q, m_box[dim] - ( hi - q ) );
+        else if( q > hi )
+            g = std::min( q - hi, m_box[dim] - ( q - lo ) );
+        g = std::max( g, T(0) );
+        return g * g;
+    }
+
+    T farthest_component( T q, T lo, T hi, int dim ) const {
+        T g = std::min( interval_span(q, lo, hi), m_box[dim] / 2 );
+        return g * g;
+    }
+
+    T combine( T acc, T c ) const { return acc + c; }
+    T reduced( T d ) const        { return d * d; }
+    T actual( T rd ) const        { return std::sqrt(rd); }
+};
+
+/**
+ * @brief Reduced distance between two points under the given metric.
+ */
+template<typename T, int N, typename Metric>
+T metric_distance( Metric const& metric, std::array<T,N> const& a, std::array<T,N> const& b ){
+    T rd = 0;
+    for( int dim(0); dim < N; ++dim )
+        rd = metric.combine( rd, metric.component( a[dim] - b[dim], dim ) );
+    return rd;
+}
+
+/**
+ * @brief Reduced distances between q and a block of count points in structure-of-arrays form (see
+ * squared_distances). The Euclidean metric uses the SIMD distance kernels.
+ */
+template<typename T, int N, typename Metric>
+struct metric_distances_dispatch {
+    static void run( Metric const& metric, std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out ){
+        for( size_t i(0); i < count; ++i ){
+            T rd = 0;
+            for( int dim(0); dim < N; ++dim )
+                rd = metric.combine( rd, metric.component( coords[dim][i] - q[dim], dim ) );
+            out[i] = rd;
+        }
+    }
+};
+
+template<typename T, int N>
+struct metric_distances_dispatch<T, N, euclidean_metric<T,N>> {
+    static void run( euclidean_metric<T,N> const&, std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out ){
+        squared_distances<T,N>(coords, count, q, out);
+    }
+};
+
+template<typename T, int N, typename Metric>
+void metric_distances( Metric const& metric, std::array<T const*,N> const& coords, size_t count, std::array<T,N> const& q, T *out ){
+    metric_distances_dispatch<T,N,Metric>::run(metric, coords, count, q, out);
+}
+
+/**
+ * @brief Cell of a tree node during a search: the box [m_lo, m_hi] that holds the points of its subtree, the
+ * contribution of every dimension to the distance of the query point from the box and the resulting reduced
+ * distance m_rd, which is a lower bound of the distance of the query point from any point in the cell.
+ */
+template<typename T, int N>
+struct search_cell {
+    std::array<T,N> m_lo;
+    std::array<T,N> m_hi;
+    std::array<T,N> m_components;
+    T               m_rd;
+
+    search_cell(){
+        m_lo.fill( std::numeric_limits<T>::lowest() );
+        m_hi.fill( std::numeric_limits<T>::max() );
+        m_components.fill( 0 );
+        m_rd = 0;
+    }
+
+    // state of the cell before narrow(), to restore it when the search returns from the child.
+    struct saved_state {
+        T m_bound;
+        T m_component;
+        T m_rd;
+    };
+
+    // narrows the cell to the child above (upper) or below the split value along dim.
+    template<typename Metric>
+    saved_state narrow( int dim, bool upper, T value, std::array<T,N> const& q, Metric const& metric ){
+        T & bound = upper ? m_lo[dim] : m_hi[dim];
+        saved_state state = { bound, m_components[dim], m_rd };
+        bound = value;
+        update( dim, q, metric );
+        return state;
+    }
+
+    void restore( int dim, bool upper, saved_state const& state ){
+        ( upper ? m_lo[dim] : m_hi[dim] ) = state.m_bound;
+        m_components[dim] = state.m_component;
+        m_rd = state.m_rd;
+    }
+
+    template<typename Metric>
+    void update( int dim, std::array<T,N> const& q, Metric const& metric ){
+        m_components[dim] = metric.interval_component( q[dim], m_lo[dim], m_hi[dim], dim );
+        m_rd = 0;
+        for( int d(0); d < N; ++d )
+            m_rd = metric.combine( m_rd, m_components[d] );
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<typename T, int N>
+struct node_t;
+
+/**
+ * @brief Arena for the nodes of a kd-tree. Nodes are carved out of large chunks by bumping an index instead of
+ * being allocated one by one with new, and clear() destroys all of them with a linear sweep over the chunks and
+ * frees the memory in a handful of calls, instead of the recursive destroy_kdtree which frees every node
+ * separately. Nodes released individually, by the rebuilds of the dynamic updates, are recycled through a free
+ * list.
+ *
+ * A tree built in an arena belongs to it: it is freed by clear() or by the destructor of the arena, never with
+ * the single-argument destroy_kdtree. Subtrees can be handed back to the arena one by one with
+ * destroy_kdtree(node, arena), which releases their nodes to the free list. Like MemoryPool, the arena is not
+ * thread-safe.
+ *
+ * @tparam T type of data.
+ * @tparam N number of dimensions.
+ */
+template<typename T, int N>
+class node_arena {
+    private:
+        using node_type = node_t<T,N>;
+
+        struct slot {
+            typename std::aligned_storage<sizeof(node_type), alignof(node_type)>::type m_storage;
+            slot * m_next_free;
+            bool   m_live;
+        };
+
+        std::vector<std::unique_ptr<slot[]>> m_chunks;
+        std::vector<size_t>                  m_chunk_sizes;
+        size_t                               m_used = 0;         // slots handed out from the last chunk
+        size_t                               m_num_live = 0;
+        size_t                               m_chunk_size;
+        slot *                               m_free = nullptr;
+
+        slot * next_slot(){
+            if( m_free ){
+                slot * s = m_free;
+                m_free = s->m_next_free;
+                return s;
+            }
+            if( m_chunks.empty() || m_used == m_chunk_sizes.back() ){
+                // chunks grow geometrically, so large trees need only a few of them.
+                size_t size = m_chunks.empty() ? m_chunk_size : 2 * m_chunk_sizes.back();
+                m_chunks.emplace_back( new slot[size] );
+                m_chunk_sizes.push_back( size );
+                m_used = 0;
+            }
+            return &m_chunks.back()[m_used++];
+        }
+
+    public:
+        explicit node_arena( size_t chunk_size = 1024 ) : m_chunk_size( chunk_size > 0 ? chunk_size : 1 ) {}
+        ~node_arena(){ clear(); }
+
+        node_arena( node_arena const& ) = delete;
+        node_arena & operator=( node_arena const& ) = delete;
+
+        template<typename... Args>
+        node_type * create( Args && ... args ){
+            slot * s = next_slot();
+            node_type * node = new (&s->m_storage) node_type( std::forward<Args>(args)... );
+            s->m_live = true;
+            m_num_live += 1;
+            return node;
+        }
+
+        // destroys one node of the arena; its slot is reused by the next create().
+        void release( node_type * node ){
+            slot * s = reinterpret_cast<slot*>(node);
+            node->~node_type();
+            s->m_live = false;
+            s->m_next_free = m_free;
+            m_free = s;
+            m_num_live -= 1;
+        }
+
+        // destroys all the nodes of the arena and frees its memory.
+        void clear(){
+            for( size_t c(0); c < m_chunks.size(); ++c ){
+                size_t used = c + 1 == m_chunks.size() ? m_used : m_chunk_sizes[c];
+                for( size_t i(0); i < used; ++i )
+                    if( m_chunks[c][i].m_live )
+                        reinterpret_cast<node_type*>(&m_chunks[c][i].m_storage)->~node_type();
+            }
+            m_chunks.clear();
+            m_chunk_sizes.clear();
+            m_used = 0;
+            m_num_live = 0;
+            m_free = nullptr;
+        }
+
+        size_t size() const { return m_num_live; }
+
+        size_t memory_footprint() const {
+            size_t slots = 0;
+            for( size_t size : m_chunk_sizes )
+                slots += size;
+            return slots * sizeof(slot);
+        }
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Translates a requested number of threads into an actual one: values below one select all the
+ * hardware threads of the machine.
+ */
+inline int resolve_num_threads( int num_threads ){
+    if( num_threads > 0 )
+        return num_threads;
+    int hw = static_cast<int>( std::thread::hardware_concurrency() );
+    return hw > 0 ? hw : 1;
+}
+
+/**
+ * @brief Splits [begin,end) into num_threads contiguous chunks and calls f(chunk, chunk_begin, chunk_end) for
+ * each of them on its own thread; chunk 0 runs on the calling thread. The chunk boundaries only depend on the
+ * range and num_threads, so per-chunk partial results can be reduced deterministically.
+ */
+template<typename Function>
+void parallel_for_chunks( size_t begin, size_t end, int num_threads, Function f ){
+    size_t n = end - begin;
+    size_t chunks = std::max<size_t>( 1, std::min<size_t>( static_cast<size_t>(num_threads), n ) );
+
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for( size_t c(1); c < chunks; ++c )
+        threads.emplace_back( f, c, begin + c * n / chunks, begin + (c+1) * n / chunks );
+
+    f( size_t(0), begin, begin + n / chunks );
+
+    for( std::thread & t : threads )
+        t.join();
+}
@@ -0,0 +1,791 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <array>
+
+#include "kdtree.hpp"
+#include "flat_kdtree.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
+
+/**
+ * @brief A node of the quantized kd-tree: a flat_node_t with 32-bit links. The left child of an inner node is
+ * the next node, m_link is the index of its right child; for a leaf m_link is the number of the leaf, the index
+ * of its box in quantized_kdtree::m_boxes.
+ *
+ * @tparam T type of data.
+ */
+template<typename T>
+struct quantized_node_t {
+    T        m_split_value;
+    int32_t  m_split_dim;   // -1 for leaf nodes
+    uint32_t m_link;
+    uint32_t m_begin;
+    uint32_t m_end;
+
+    bool   isLeaf() const { return m_split_dim < 0; }
+    size_t size()   const { return m_end - m_begin; }
+};
+
+/**
+ * @brief Quantization grid of one leaf: code c along dim stands for the interval [lower(dim, c), upper(dim, c)],
+ * computed the same way by the build and the queries. m_step is rounded up such that the intervals of all codes
+ * cover the bounding box of the leaf.
+ *
+ * The searches bound distances by code differences: a point with code c is at least (|c - qc| - m_slack) steps
+ * and at most (|c - qc| + m_slack) steps away from a query with code qc along dim. m_slack is one step for the
+ * width of the intervals plus the steps that cover the rounding of lower and upper, see make_quantized_box.
+ */
+template<typename T, int N>
+struct quantized_box {
+    std::array<T,N>       m_lo;
+    std::array<T,N>       m_step;
+    std::array<int32_t,N> m_slack;
+
+    // codes are converted through int, which unlike size_t converts to floating point in SIMD registers.
+    T lower( int dim, int c ) const { return m_lo[dim] + T(c) * m_step[dim]; }
+    T upper( int dim, int c ) const { return m_lo[dim] + T(c + 1) * m_step[dim]; }
+};
+
+/*************************************************************************************************************
+ * @brief Kd-tree with quantized leaf coordinates, for indexes whose size is dominated by the points. The index
+ * holds the nodes, one box per leaf and every coordinate as a Code (uint16_t or uint8_t) relative to the box of
+ * its leaf, in structure-of-arrays form in the order of the flat kd-tree it was made from: 2N bytes per point
+ * with 16-bit codes and N with 8-bit ones, against 8 + 4N for a flat kd-tree.
+ *
+ * The searches filter the points of a leaf by bounds computed from integer code differences (see
+ * quantized_box), which are never below the computed distance of the point, and refine the few points that pass
+ * with their exact coordinates. Those are read from m_exact, the flat kd-tree the codes were made from, at the
+ * same positions. The index shares the ownership of it, so the flat tree lives as long as any index made from it;
+ * it may be a tree mapped from a file with open_flat_kdtree, whose pages are then only read for the points
+ * refined. The results are identical to those of the flat kd-tree.
+ *
+ * @tparam T type of data.
+ * @tparam N number of dimensions.
+ * @tparam Code unsigned integer type of the quantized coordinates.
+ */
+template<typename T, int N, typename Code = uint16_t>
+struct quantized_kdtree {
+    static_assert( std::is_integral<Code>::value && std::is_unsigned<Code>::value, "Code must be an unsigned integer type" );
+    static_assert( sizeof(Code) <= 2, "Code must have at most 16 bits" );
+
+    using key_type   = key<T,N>;
+    using node_type  = quantized_node_t<T>;
+    using box_type   = quantized_box<T,N>;
+    using exact_type = flat_kdtree<T,N>;
+
+    // number of codes per dimension.
+    static constexpr int num_levels = int(std::numeric_limits<Code>::max()) + 1;
+
+    // codes past the last point, so that the bound kernels can read whole SIMD blocks at the end of every leaf.
+    static constexpr size_t code_padding = 8;
+
+    std::vector<node_type>            m_nodes;
+    std::vector<box_type>             m_boxes;
+    std::array<std::vector<Code>,N>   m_codes;
+    std::shared_ptr<exact_type const> m_exact;
+    size_t                            m_leaf_size = 32;
+
+    size_t size()      const { return m_exact ? m_exact->size() : 0; }
+    bool   empty()     const { return size() == 0; }
+    size_t numNodes()  const { return m_nodes.size(); }
+    size_t numLeaves() const { return m_boxes.size(); }
+
+    node_type const& getNode( size_t i )    const { return m_nodes[i]; }
+    box_type const&  getBox( size_t leaf )  const { return m_boxes[leaf]; }
+    Code             getCode( size_t i, int dim ) const { return m_codes[dim][i]; }
+    Code const*      getCodes( int dim )    const { return m_codes[dim].data(); }
+
+    // the exact coordinates and ids, read from m_exact.
+    exact_type const& getExact()            const { return *m_exact; }
+    size_t           getID( size_t i )      const { return m_exact->getID(i); }
+    T                getValue( size_t i, int dim ) const { return m_exact->getValue(i, dim); }
+    key_type         getKey( size_t i )     const { return m_exact->getKey(i); }
+
+    std::array<T,N> getPoint( size_t i ) const {
+        std::array<T,N> p;
+        for( int dim(0); dim < N; ++dim )
+            p[dim] = m_exact->getValue(i, dim);
+        return p;
+    }
+
+    // heap memory of the index; the flat tree m_exact is shared and counted by its own memory_footprint.
+    size_t memory_footprint() const {
+        return sizeof(*this) + m_nodes.capacity() * sizeof(node_type) + m_boxes.capacity() * sizeof(box_type)
+            + N * m_codes[0].capacity() * sizeof(Code);
+    }
+};
+
+/**
+ * @brief Quantization grid of the box [lo, hi] with num_levels codes per dimension.
+ */
+template<typename T, int N>
+quantized_box<T,N> make_quantized_box( std::array<T,N> const& lo, std::array<T,N> const& hi, int num_levels ){
+    quantized_box<T,N> box;
+    box.m_lo = lo;
+    for( int dim(0); dim < N; ++dim ){
+        T step = ( hi[dim] - lo[dim] ) / T(num_levels);
+        box.m_step[dim] = step;
+        while( box.upper(dim, num_levels - 1) < hi[dim] )
+            box.m_step[dim] = step = std::nextafter( step, std::numeric_limits<T>::max() );
+
+        // lower(c) and upper(c) are off by at most eps * (|lo| + 2 * num_levels * step) from their exact values,
+        // two such errors apart from the code of the query and of the point, which the slack rounds up to steps.
+        box.m_slack[dim] = 1;
+        if( step > 0 ){
+            double error = 2 * double(std::numeric_limits<T>::epsilon())
+                * ( std::abs(double(lo[dim])) / double(step) + 2.01 * num_levels );
+            box.m_slack[dim] += static_cast<int32_t>( std::min( std::ceil(error), double(num_levels) ) );
+        }
+    }
+    return box;
+}
+
+/**
+ * @brief Code of the coordinate value along dim: the code whose interval contains value, or the first or last
+ * code for a value below or above the box.
+ */
+template<typename T, int N>
+int quantize_value( quantized_box<T,N> const& box, int dim, T value, int num_levels ){
+    if( !( box.m_step[dim] > 0 ) )
+        return 0;
+    T guess = std::floor( ( value - box.m_lo[dim] ) / box.m_step[dim] );
+    int c = guess > 0 ? static_cast<int>( std::min( guess, T(num_levels - 1) ) ) : 0;
+    while( c > 0 && box.lower(dim, c) > value )
+        --c;
+    while( c < num_levels - 1 && box.upper(dim, c) < value )
+        ++c;
+    return c;
+}
+
+/**
+ * @brief Compresses the flat kd-tree exact into a quantized kd-tree with the same nodes and the same order of
+ * points, which refines its searches from exact and keeps it alive. Leaves are quantized in parallel on
+ * num_threads threads (0 = all cores).
+ *
+ * @throws std::invalid_argument if exact is null.
+ * @throws std::length_error if the tree has more points or nodes than 32-bit links can address.
+ */
+template<typename T, int N, typename Code = uint16_t>
+quantized_kdtree<T,N,Code> quantize_kdtree( std::shared_ptr<flat_kdtree<T,N> const> exact, int num_threads = 1 ){
+    using tree_type = quantized_kdtree<T,N,Code>;
+
+    if( !exact )
+        throw std::invalid_argument("quantize_kdtree: no flat kd-tree to quantize");
+    flat_kdtree<T,N> const& flat = *exact;
+    if( flat.size() > std::numeric_limits<uint32_t>::max() || flat.numNodes() > std::numeric_limits<uint32_t>::max() )
+        throw std::length_error("quantize_kdtree: the tree is too large for 32-bit ids");
+
+    tree_type tree;
+    tree.m_leaf_size = flat.m_leaf_size;
+    tree.m_exact = exact;
+    if( flat.empty() )
+        return tree;
+
+    tree.m_nodes.resize( flat.numNodes() );
+    for( size_t i(0); i < flat.numNodes(); ++i ){
+        flat_node_t<T> const& node = flat.getNode(i);
+        quantized_node_t<T> & q = tree.m_nodes[i];
+        q.m_split_value = node.m_split_value;
+        q.m_split_dim = node.isLeaf() ? -1 : node.m_split_dim;
+        q.m_begin = static_cast<uint32_t>(node.m_begin);
+        q.m_end = static_cast<uint32_t>(node.m_end);
+        q.m_link = static_cast<uint32_t>( node.isLeaf() ? tree.m_boxes.size() : node.m_right );
+        if( node.isLeaf() )
+            tree.m_boxes.push_back( quantized_box<T,N>() );
+    }
+
+    for( int dim(0); dim < N; ++dim )
+        tree.m_codes[dim].resize(flat.size() + tree_type::code_padding);
+
+    parallel_for_chunks( 0, tree.m_nodes.size(), resolve_num_threads(num_threads), [&]( size_t, size_t b, size_t e ){
+        for( size_t n(b); n < e; ++n ){
+            quantized_node_t<T> const& node = tree.m_nodes[n];
+            if( !node.isLeaf() )
+                continue;
+
+            std::array<T,N> lo, hi;
+            for( int dim(0); dim < N; ++dim ){
+                lo[dim] = hi[dim] = flat.getValue(node.m_begin, dim);
+                for( size_t i(node.m_begin + 1); i < node.m_end; ++i ){
+                    lo[dim] = std::min( lo[dim], flat.getValue(i, dim) );
+                    hi[dim] = std::max( hi[dim], flat.getValue(i, dim) );
+                }
+            }
+
+            quantized_box<T,N> & box = tree.m_boxes[node.m_link];
+            box = make_quantized_box<T,N>( lo, hi, tree_type::num_levels );
+            for( size_t i(node.m_begin); i < node.m_end; ++i )
+                for( int dim(0); dim < N; ++dim )
+                    tree.m_codes[dim][i] = static_cast<Code>( quantize_value<T,N>( box, dim, flat.getValue(i, dim), tree_type::num_levels ) );
+        }
+    });
+
+    return tree;
+}
+
+/**
+ * @brief Builds a quantized kd-tree with leaf buckets of up to leaf_size points from data, refined from a flat
+ * kd-tree of data (see build_flat_kdtree) that only the quantized tree holds.
+ */
+template<typename T, int N, typename Code = uint16_t>
+quantized_kdtree<T,N,Code> build_quantized_kdtree( std::vector<std::array<T,N>> const& data, size_t leaf_size = 32, int num_threads = 1 ){
+    std::shared_ptr<flat_kdtree<T,N> const> exact = std::make_shared<flat_kdtree<T,N>>( build_flat_kdtree<T,N>( data, leaf_size, num_threads ) );
+    return quantize_kdtree<T,N,Code>( exact, num_threads );
+}
+
+/**
+ * @brief Codes of queryPoint in the box of a leaf, the reference of the code differences of its points.
+ */
+template<typename T, int N, typename Code>
+std::array<int32_t,N> quantize_query( quantized_box<T,N> const& box, std::array<T,N> const& queryPoint ){
+    std::array<int32_t,N> qc;
+    for( int dim(0); dim < N; ++dim )
+        qc[dim] = quantize_value<T,N>( box, dim, queryPoint[dim], quantized_kdtree<T,N,Code>::num_levels );
+    return qc;
+}
+
+/**
+ * @brief Lower bounds of the reduced distances between a query with codes qc and the points [begin, begin+count)
+ * of a leaf with box box, from the differences of their codes. Along every dimension the point lies at least
+ * (|d| - slack) steps from the query, for the code difference d, which is passed to the metric as an interval
+ * relative to the query; the metric must therefore only depend on the differences of the coordinates (all of
+ * metrics.hpp but periodic_euclidean_metric, see its specialization). The bounds are accumulated in the order of
+ * the dimensions like the exact distances, so no bound is above the computed distance of its point.
+ */
+template<typename T, int N, typename Code, typename Metric>
+void quantized_bounds_scalar( quantized_kdtree<T,N,Code> const& tree, quantized_box<T,N> const& box,
+    std::array<int32_t,N> const& qc, std::array<T,N> const&, size_t begin, size_t count, T *out, Metric const& metric ){
+
+    for( size_t i(0); i < count; ++i )
+        out[i] = 0;
+    for( int dim(0); dim < N; ++dim ){
+        Code const* codes = tree.getCodes(dim) + begin;
+        int32_t slack = box.m_slack[dim];
+        T step = box.m_step[dim];
+        for( size_t i(0); i < count; ++i ){
+            int32_t d = int32_t(codes[i]) - qc[dim];
+            out[i] = metric.combine( out[i], metric.interval_component( T(0), T(d - slack) * step, T(d + slack) * step, dim ) );
+        }
+    }
+}
+
+/**
+ * @brief quantized_bounds_scalar for periodic_euclidean_metric, whose distances depend on the positions in the
+ * periodic box: the bounds are computed from the interval [lower, upper] of every code instead.
+ */
+template<typename T, int N, typename Code>
+void quantized_bounds_scalar( quantized_kdtree<T,N,Code> const& tree, quantized_box<T,N> const& box,
+    std::array<int32_t,N> const&, std::array<T,N> const& queryPoint, size_t begin, size_t count, T *out,
+    periodic_euclidean_metric<T,N> const& metric ){
+
+    for( size_t i(0); i < count; ++i )
+        out[i] = 0;
+    for( int dim(0); dim < N; ++dim ){
+        Code const* codes = tree.getCodes(dim) + begin;
+        for( size_t i(0); i < count; ++i ){
+            out[i] = metric.combine( out[i], metric.interval_component( queryPoint[dim], box.lower(dim, codes[i]),
+                box.upper(dim, codes[i]), dim ) );
+        }
+    }
+}
+
+#if KDTREE_X86_SIMD
+
+// eight codes widened to 32-bit integers.
+__attribute__((target("avx2")))
+inline __m256i load_codes_avx2( uint16_t const* codes ){
+    return _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<__m128i const*>(codes) ) );
+}
+
+__attribute__((target("avx2")))
+inline __m256i load_codes_avx2( uint8_t const* codes ){
+    return _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<__m128i const*>(codes) ) );
+}
+
+/**
+ * @brief quantized_bounds_scalar for the Euclidean metric and float, eight points at a time: the step counts
+ * max(|d| - slack, 0) stay integers up to the one conversion per dimension, and are scaled and
+ * squared with the same operations as in the scalar loop, so the bounds are bitwise identical. The last block is
+ * computed whole, with the codes of the padding or of the next leaf, so out must have room for count rounded up
+ * to a multiple of eight; the mask of the bounds at most limit is cut to count points.
+ */
+template<int N, typename Code>
+__attribute__((target("avx2")))
+uint64_t quantized_squared_bounds_avx2( quantized_kdtree<float,N,Code> const& tree, quantized_box<float,N> const& box,
+    std::array<int32_t,N> const& qc, size_t begin, size_t count, float limit, float *out ){
+
+    __m256 bound = _mm256_set1_ps(limit);
+    uint64_t mask = 0;
+    __m256i q[N], slack[N];
+    __m256 step[N];
+    for( int dim(0); dim < N; ++dim ){
+        q[dim] = _mm256_set1_epi32(qc[dim]);
+        slack[dim] = _mm256_set1_epi32(box.m_slack[dim]);
+        step[dim] = _mm256_set1_ps(box.m_step[dim]);
+    }
+    for( size_t i(0); i < count; i += 8 ){
+        __m256 acc = _mm256_setzero_ps();
+        for( int dim(0); dim < N; ++dim ){
+            __m256i d = _mm256_abs_epi32( _mm256_sub_epi32( load_codes_avx2( tree.getCodes(dim) + begin + i ), q[dim] ) );
+            d = _mm256_max_epi32( _mm256_sub_epi32( d, slack[dim] ), _mm256_setzero_si256() );
+            __m256 g = _mm256_mul_ps( _mm256_cvtepi32_ps(d), step[dim] );
+            acc = _mm256_add_ps( acc, _mm256_mul_ps(g, g) );
+        }
+        _mm256_storeu_ps(out + i, acc);
+        mask |= uint64_t( _mm256_movemask_ps( _mm256_cmp_ps(acc, bound, _CMP_LE_OQ) ) ) << i;
+    }
+    return count < 64 ? mask & ( ( uint64_t(1) << count ) - 1 ) : mask;
+}
+
+#endif
+
+// the mask of the first count bounds that are at most limit, bit i for bounds[i].
+template<typename T>
+uint64_t bounds_mask( T const* bounds, size_t count, T limit ){
+    uint64_t mask = 0;
+    for( size_t i(0); i < count; ++i )
+        mask |= uint64_t( bounds[i] <= limit ) << i;
+    return mask;
+}
+
+/**
+ * @brief Dispatches quantized_lower_bounds to the AVX2 kernel for the Euclidean metric and float where the CPU
+ * supports it, and to the scalar loop otherwise.
+ */
+template<typename T, int N, typename Code, typename Metric>
+struct quantized_bounds_dispatch {
+    static uint64_t run( quantized_kdtree<T,N,Code> const& tree, quantized_box<T,N> const& box, std::array<int32_t,N> const& qc,
+        std::array<T,N> const& queryPoint, size_t begin, size_t count, T limit, T *out, Metric const& metric ){
+        quantized_bounds_scalar<T,N,Code>(tree, box, qc, queryPoint, begin, count, out, metric);
+        return bounds_mask<T>(out, count, limit);
+    }
+};
+
+#if KDTREE_X86_SIMD
+
+template<int N, typename Code>
+struct quantized_bounds_dispatch<float, N, Code, euclidean_metric<float,N>> {
+    static uint64_t run( quantized_kdtree<float,N,Code> const& tree, quantized_box<float,N> const& box, std::array<int32_t,N> const& qc,
+        std::array<float,N> const& queryPoint, size_t begin, size_t count, float limit, float *out, euclidean_metric<float,N> const& metric ){
+        if( active_simd_level() != simd_level::scalar )
+            return quantized_squared_bounds_avx2<N,Code>(tree, box, qc, begin, count, limit, out);
+        quantized_bounds_scalar<float,N,Code>(tree, box, qc, queryPoint, begin, count, out, metric);
+        return bounds_mask<float>(out, count, limit);
+    }
+};
+
+#endif
+
+/**
+ * @brief Writes the lower bounds of the points [begin, begin+count) of a leaf to out, see quantized_bounds_scalar,
+ * and returns the mask of those at most limit, bit i for point begin+i. out must have room for count rounded up
+ * to a multiple of eight, see quantized_squared_bounds_avx2.
+ */
+template<typename T, int N, typename Code, typename Metric>
+uint64_t quantized_lower_bounds( quantized_kdtree<T,N,Code> const& tree, quantized_box<T,N> const& box, std::array<int32_t,N> const& qc,
+    std::array<T,N> const& queryPoint, size_t begin, size_t count, T limit, T *out, Metric const& metric ){
+    static_assert( leaf_block_size <= 64, "the points of a block must fit into the bits of the mask" );
+    return quantized_bounds_dispatch<T,N,Code,Metric>::run(tree, box, qc, queryPoint, begin, count, limit, out, metric);
+}
+
+/**
+ * @brief Calls f(position, reduced distance) for the points of a leaf whose lower bound is at most limit(), with
+ * their exact distance from queryPoint, in the order of the leaf. limit is asked again for every point, so a limit
+ * that shrinks during the scan filters the remaining points of the leaf. While limit() is open, at the start of a
+ * search, nothing can be filtered and the block is scanned with the distance kernels on the exact coordinates,
+ * like a leaf of the flat kd-tree.
+ */
+template<typename T, int N, typename Code, typename Metric, typename Limit, typename Function>
+void scan_quantized_leaf( quantized_kdtree<T,N,Code> const& tree, quantized_node_t<T> const& node,
+    std::array<T,N> const& queryPoint, search_stats & stats, Metric const& metric, Limit limit, Function f ){
+
+    // the bounding box of the leaf, which is usually smaller than the cell of the node, may reject it as a whole.
+    quantized_box<T,N> const& box = tree.getBox(node.m_link);
+    T rd = 0;
+    for( int dim(0); dim < N; ++dim )
+        rd = metric.combine( rd, metric.interval_component( queryPoint[dim], box.m_lo[dim],
+            box.upper(dim, quantized_kdtree<T,N,Code>::num_levels - 1), dim ) );
+    if( rd > limit() )
+        return;
+
+    std::array<int32_t,N> qc = quantize_query<T,N,Code>( box, queryPoint );
+    T bounds[leaf_block_size];
+    for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+        size_t count = std::min<size_t>(leaf_block_size, node.m_end - begin);
+        if( limit() == std::numeric_limits<T>::max() ){
+            metric_distances<T,N>(metric, tree.getExact().getBlock(begin), count, queryPoint, bounds);
+            stats.m_points_visited += count;
+            for( size_t i(0); i < count; ++i )
+                f( begin + i, bounds[i] );
+            continue;
+        }
+
+        // the exact distances of the points that pass, in the order of the mask.
+        uint64_t candidates = quantized_lower_bounds<T,N,Code>(tree, box, qc, queryPoint, begin, count, limit(), bounds, metric);
+        while( candidates ){
+            size_t i = static_cast<size_t>( __builtin_ctzll(candidates) );
+            candidates &= candidates - 1;
+            if( bounds[i] > limit() )
+                continue;
+            stats.m_points_visited += 1;
+            f( begin + i, metric_distance<T,N>(metric, tree.getPoint(begin + i), queryPoint) );
+        }
+    }
+}
+
+/**
+ * @brief Recursive part of nn_search on the quantized kd-tree, see nn_search_node for the flat kd-tree.
+ */
+template<typename T, int N, typename Code, typename Metric>
+void nn_search_node( quantized_kdtree<T,N,Code> const& tree, size_t index, std::array<T,N> const& queryPoint,
+    search_cell<T,N> & cell, size_t & closest, T & distance, search_stats & stats, Metric const& metric ){
+
+    quantized_node_t<T> const& node = tree.getNode(index);
+    stats.m_nodes_visited += 1;
+
+    if( node.isLeaf() ){
+        scan_quantized_leaf<T,N,Code>( tree, node, queryPoint, stats, metric,
+            [&](){ return distance; },
+            [&]( size_t i, T d ){
+                if( d < distance ){
+                    distance = d;
+                    closest = i;
+                }
+            });
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    bool nearUpper = !( queryPoint[dim] < node.m_split_value );
+    size_t near = nearUpper ? node.m_link : index + 1;
+    size_t far  = nearUpper ? index + 1 : node.m_link;
+
+    typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd < distance )
+        nn_search_node<T,N,Code>(tree, near, queryPoint, cell, closest, distance, stats, metric);
+    cell.restore(dim, nearUpper, state);
+
+    state = cell.narrow(dim, !nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd < distance )
+        nn_search_node<T,N,Code>(tree, far, queryPoint, cell, closest, distance, stats, metric);
+    cell.restore(dim, !nearUpper, state);
+}
+
+/**
+ * @brief Exact nearest neighbour of queryPoint in the quantized kd-tree, in the same key<T,N> form as for node_t
+ * trees.
+ *
+ * @param stats number of nodes visited and of points whose exact distance was computed.
+ * @param metric distance metric policy, see metrics.hpp.
+ */
+template<typename T, int N, typename Code, typename Metric = euclidean_metric<T,N>>
+key<T,N> nn_search( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, search_stats & stats,
+    Metric const& metric = Metric() ){
+    stats = search_stats();
+    if( tree.empty() )
+        return key<T,N>();
+
+    size_t closest = 0;
+    T distance = std::numeric_limits<T>::max();
+    search_cell<T,N> cell;
+    nn_search_node<T,N,Code>(tree, 0, queryPoint, cell, closest, distance, stats, metric);
+
+    return tree.getKey(closest);
+}
+
+template<typename T, int N, typename Code>
+key<T,N> nn_search( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint ){
+    search_stats stats;
+    return nn_search<T,N,Code>(tree, queryPoint, stats);
+}
+
+/**
+ * @brief Recursive part of knn_query on the quantized kd-tree, see knn_query_node for the flat kd-tree.
+ */
+template<typename T, int N, typename Code, typename Metric>
+void knn_query_node( quantized_kdtree<T,N,Code> const& tree, size_t index, std::array<T,N> const& queryPoint, size_t k,
+    search_cell<T,N> & cell, std::vector<neighbor<T>> & heap, search_stats & stats, Metric const& metric ){
+
+    quantized_node_t<T> const& node = tree.getNode(index);
+    stats.m_nodes_visited += 1;
+
+    if( node.isLeaf() ){
+        // the id is only read for points that enter the heap.
+        size_t const* ids = tree.getExact().getIDs();
+        scan_quantized_leaf<T,N,Code>( tree, node, queryPoint, stats, metric,
+            [&](){ return neighbor_bound(heap, k); },
+            [&heap, k, ids]( size_t i, T d ){
+                if( d <= neighbor_bound(heap, k) )
+                    push_neighbor( heap, k, ids[i], d );
+            });
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    bool nearUpper = !( queryPoint[dim] < node.m_split_value );
+    size_t near = nearUpper ? node.m_link : index + 1;
+    size_t far  = nearUpper ? index + 1 : node.m_link;
+
+    typename search_cell<T,N>::saved_state state = cell.narrow(dim, nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd <= neighbor_bound(heap, k) )
+        knn_query_node<T,N,Code>(tree, near, queryPoint, k, cell, heap, stats, metric);
+    cell.restore(dim, nearUpper, state);
+
+    state = cell.narrow(dim, !nearUpper, node.m_split_value, queryPoint, metric);
+    if( cell.m_rd <= neighbor_bound(heap, k) )
+        knn_query_node<T,N,Code>(tree, far, queryPoint, k, cell, heap, stats, metric);
+    cell.restore(dim, !nearUpper, state);
+}
+
+/**
+ * @brief Exact k nearest neighbours of queryPoint in the quantized kd-tree, sorted by increasing distance; the
+ * same neighbours as for the flat kd-tree. Reusing result across queries makes the query allocation free.
+ */
+template<typename T, int N, typename Code, typename Metric = euclidean_metric<T,N>>
+void knn_query( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, size_t k,
+    std::vector<neighbor<T>> & result, search_stats & stats, Metric const& metric = Metric() ){
+
+    stats = search_stats();
+    result.clear();
+    if( tree.empty() || k == 0 )
+        return;
+
+    search_cell<T,N> cell;
+    knn_query_node<T,N,Code>(tree, 0, queryPoint, k, cell, result, stats, metric);
+    finalize_neighbors( result, metric );
+}
+
+template<typename T, int N, typename Code>
+void knn_query( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, size_t k, std::vector<neighbor<T>> & result ){
+    search_stats stats;
+    knn_query<T,N,Code>(tree, queryPoint, k, result, stats);
+}
+
+template<typename T, int N, typename Code>
+std::vector<neighbor<T>> knn_query( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, size_t k ){
+    std::vector<neighbor<T>> result;
+    result.reserve(k);
+    knn_query<T,N,Code>(tree, queryPoint, k, result);
+    return result;
+}
+
+/**
+ * @brief Receivers of the points found by the range queries on the quantized kd-tree: report(begin, end) takes a
+ * range of positions whose points are all inside the range, report(begin, inside, count) the positions
+ * [begin, begin+count) of which those with inside[i] set are.
+ */
+struct quantized_range_counter {
+    size_t m_count = 0;
+
+    void operator()( size_t begin, size_t end ){ m_count += end - begin; }
+
+    void operator()( size_t, bool const* inside, size_t count ){
+        for( size_t i(0); i < count; ++i )
+            m_count += inside[i];
+    }
+};
+
+template<typename T, int N, typename Code, typename Function>
+struct quantized_range_reporter {
+    quantized_kdtree<T,N,Code> const& m_tree;
+    Function                        & m_f;
+
+    void operator()( size_t begin, size_t end ){
+        for( size_t i(begin); i < end; ++i )
+            m_f( m_tree.getKey(i) );
+    }
+
+    void operator()( size_t begin, bool const* inside, size_t count ){
+        for( size_t i(0); i < count; ++i )
+            if( inside[i] )
+                m_f( m_tree.getKey(begin + i) );
+    }
+};
+
+/**
+ * @brief Points of a leaf inside range, for balls and the other ranges without a test on the codes: every point
+ * is tested with its exact coordinates, in a loop the compiler vectorizes, which is cheaper than bounding the
+ * distances from the codes first.
+ */
+template<typename T, int N, typename Code, typename Range, typename Report>
+void range_query_leaf( quantized_kdtree<T,N,Code> const& tree, quantized_node_t<T> const& node, Range const& range,
+    Report & report ){
+
+    bool inside[leaf_block_size];
+    for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+        size_t count = std::min<size_t>(leaf_block_size, node.m_end - begin);
+        for( size_t i(0); i < count; ++i )
+            inside[i] = range.contains( tree.getPoint(begin + i) );
+        report( begin, inside, count );
+    }
+}
+
+/**
+ * @brief range_query_leaf for boxes, decided on the codes: the sides of the box are turned into code windows of
+ * the leaf once, from the codes of the sides and the slack of quantized_box, and the points are accepted or
+ * rejected by integer comparisons of their codes. Only the points whose codes lie within the slack of a side are
+ * tested with their exact coordinates.
+ */
+template<typename T, int N, typename Code, typename Report>
+void range_query_leaf( quantized_kdtree<T,N,Code> const& tree, quantized_node_t<T> const& node, box_range<T,N> const& range,
+    Report & report ){
+
+    const int32_t levels = quantized_kdtree<T,N,Code>::num_levels;
+    quantized_box<T,N> const& box = tree.getBox(node.m_link);
+    std::array<int32_t,N> qlo = quantize_query<T,N,Code>( box, range.m_lo ), qhi = quantize_query<T,N,Code>( box, range.m_hi );
+
+    // codes in [inLo, inHi] are inside the box along dim, codes outside [outLo, outHi] outside of it.
+    std::array<int32_t,N> inLo, inHi, outLo, outHi;
+    for( int dim(0); dim < N; ++dim ){
+        int32_t slack = box.m_slack[dim];
+        inLo[dim] = range.m_lo[dim] <= box.m_lo[dim] ? 0 : qlo[dim] + slack;
+        inHi[dim] = range.m_hi[dim] >= box.upper(dim, levels - 1) ? levels - 1 : qhi[dim] - slack;
+        outLo[dim] = qlo[dim] - slack;
+        outHi[dim] = qhi[dim] + slack;
+    }
+
+    bool inside[leaf_block_size], undecided[leaf_block_size];
+    for( size_t begin(node.m_begin); begin < node.m_end; begin += leaf_block_size ){
+        size_t count = std::min<size_t>(leaf_block_size, node.m_end - begin);
+        for( size_t i(0); i < count; ++i ){
+            inside[i] = true;
+            undecided[i] = true;
+        }
+        for( int dim(0); dim < N; ++dim ){
+            Code const* codes = tree.getCodes(dim) + begin;
+            for( size_t i(0); i < count; ++i ){
+                int32_t c = codes[i];
+                inside[i] = inside[i] && c >= inLo[dim] && c <= inHi[dim];
+                undecided[i] = undecided[i] && c >= outLo[dim] && c <= outHi[dim];
+            }
+        }
+        for( size_t i(0); i < count; ++i )
+            if( undecided[i] && !inside[i] )
+                inside[i] = range.contains( tree.getPoint(begin + i) );
+        report( begin, inside, count );
+    }
+}
+
+/**
+ * @brief Recursive part of the range queries on the quantized kd-tree, see quantized_range_counter for report.
+ */
+template<typename T, int N, typename Code, typename Range, typename Report>
+void range_query_node( quantized_kdtree<T,N,Code> const& tree, size_t index, Range const& range, std::array<T,N> & lo,
+    std::array<T,N> & hi, Report & report ){
+
+    if( !range.intersects_cell(lo, hi) )
+        return;
+
+    quantized_node_t<T> const& node = tree.getNode(index);
+
+    if( range.contains_cell(lo, hi) ){
+        report( node.m_begin, node.m_end );
+        return;
+    }
+
+    if( node.isLeaf() ){
+        // the bounding box of the leaf first, then the points of the leaf.
+        quantized_box<T,N> const& box = tree.getBox(node.m_link);
+        std::array<T,N> leafLo, leafHi;
+        for( int dim(0); dim < N; ++dim ){
+            leafLo[dim] = box.m_lo[dim];
+            leafHi[dim] = box.upper(dim, quantized_kdtree<T,N,Code>::num_levels - 1);
+        }
+        if( !range.intersects_cell(leafLo, leafHi) )
+            return;
+        if( range.contains_cell(leafLo, leafHi) ){
+            report( node.m_begin, node.m_end );
+            return;
+        }
+
+        range_query_leaf<T,N,Code>(tree, node, range, report);
+        return;
+    }
+
+    int dim = node.m_split_dim;
+    T old = hi[dim];
+    hi[dim] = node.m_split_value;
+    range_query_node<T,N,Code>(tree, index + 1, range, lo, hi, report);
+    hi[dim] = old;
+
+    old = lo[dim];
+    lo[dim] = node.m_split_value;
+    range_query_node<T,N,Code>(tree, node.m_link, range, lo, hi, report);
+    lo[dim] = old;
+}
+
+/**
+ * @brief Calls f(key) for every point of the quantized kd-tree inside range, in the order of the tree.
+ */
+template<typename T, int N, typename Code, typename Range, typename Function>
+void range_query( quantized_kdtree<T,N,Code> const& tree, Range const& range, Function f ){
+    if( tree.empty() )
+        return;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    quantized_range_reporter<T,N,Code,Function> report = { tree, f };
+    range_query_node<T,N,Code>(tree, 0, range, lo, hi, report);
+}
+
+template<typename T, int N, typename Code, typename Range>
+size_t range_count( quantized_kdtree<T,N,Code> const& tree, Range const& range ){
+    if( tree.empty() )
+        return 0;
+
+    std::array<T,N> lo, hi;
+    lo.fill( std::numeric_limits<T>::lowest() );
+    hi.fill( std::numeric_limits<T>::max() );
+    quantized_range_counter report;
+    range_query_node<T,N,Code>(tree, 0, range, lo, hi, report);
+    return report.m_count;
+}
+
+template<typename T, int N, typename Code, typename Function, typename Metric = euclidean_metric<T,N>>
+void radius_for_each( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, T radius, Function f,
+    Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    range_query<T,N,Code>(tree, range, f);
+}
+
+template<typename T, int N, typename Code, typename OutputIt, typename Metric = euclidean_metric<T,N>>
+OutputIt radius_query( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, T radius, OutputIt out,
+    Metric const& metric = Metric() ){
+    radius_for_each<T,N,Code>(tree, queryPoint, radius, [&out]( key<T,N> const& e ){ *out++ = e; }, metric);
+    return out;
+}
+
+template<typename T, int N, typename Code, typename Metric = euclidean_metric<T,N>>
+size_t radius_count( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& queryPoint, T radius,
+    Metric const& metric = Metric() ){
+    radius_range<T,N,Metric> range = { queryPoint, radius, metric };
+    return range_count<T,N,Code>(tree, range);
+}
+
+template<typename T, int N, typename Code, typename Function>
+void box_for_each( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi, Function f ){
+    box_range<T,N> range = { lo, hi };
+    range_query<T,N,Code>(tree, range, f);
+}
+
+template<typename T, int N, typename Code, typename OutputIt>
+OutputIt box_query( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi, OutputIt out ){
+    box_for_each<T,N,Code>(tree, lo, hi, [&out]( key<T,N> const& e ){ *out++ = e; });
+    return out;
+}
+
+template<typename T, int N, typename Code>
+size_t box_count( quantized_kdtree<T,N,Code> const& tree, std::array<T,N> const& lo, std::array<T,N> const& hi ){
+    box_range<T,N> range = { lo, hi };
+    return range_count<T,N,Code>(tree, range);
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// collect every query of the kd-tree searches into a per-thread query_profile; 0 compiles the recording out.
+#ifndef KDTREE_QUERY_STATS
+#define KDTREE_QUERY_STATS 0
+#endif
+
+/**
+ * @brief Counters of one search, reported by the exact searches: how many tree nodes were visited (leaves among
+ * them) and against how many points the distance to the query point was computed; how many subtrees were pruned
+ * by their distance or range test without being entered, and how many were entered only after the search had
+ * reached a leaf (backtracks). m_seconds is the duration of the query when KDTREE_QUERY_STATS is on, 0 otherwise.
+ * The searches of node_t trees fill all counters, those of the other indexes the nodes and points visited.
+ */
+struct search_stats {
+    size_t m_nodes_visited   = 0;
+    size_t m_points_visited  = 0;
+    size_t m_leaves_visited  = 0;
+    size_t m_subtrees_pruned = 0;
+    size_t m_backtracks      = 0;
+    double m_seconds         = 0;
+};
+
+/**
+ * @brief Kinds of search kept apart by query_profile: range for the range queries that report the points,
+ * range_count for those that count them. num_kinds is the number of kinds, not a kind.
+ */
+enum class query_kind { ann, nn, knn, approx_knn, range, range_count, num_kinds };
+
+inline const char * query_kind_name( query_kind kind ){
+    static const char * names[] = { "ann", "nn", "knn", "approx_knn", "range", "range_count" };
+    return names[ static_cast<int>(kind) ];
+}
+
+/**
+ * @brief Histogram of a counter over many queries in power-of-two buckets: bucket 0 counts the value 0 and bucket
+ * b > 0 the values in [2^(b-1), 2^b). Adding a value costs a count of leading zeros and an increment.
+ */
+struct query_histogram {
+    std::array<uint64_t,65> m_buckets;
+    uint64_t                m_total = 0;
+    uint64_t                m_max   = 0;
+
+    query_histogram(){ m_buckets.fill(0); }
+
+    static int bucket( uint64_t value ){ return value == 0 ? 0 : 64 - __builtin_clzll(value); }
+    static uint64_t lower( int b ){ return b == 0 ? 0 : uint64_t(1) << (b - 1); }
+
+    void add( uint64_t value ){
+        m_buckets[ bucket(value) ] += 1;
+        m_total += value;
+        m_max = value > m_max ? value : m_max;
+    }
+
+    void merge( query_histogram const& other ){
+        for( size_t b(0); b < m_buckets.size(); ++b )
+            m_buckets[b] += other.m_buckets[b];
+        m_total += other.m_total;
+        m_max = other.m_max > m_max ? other.m_max : m_max;
+    }
+};
+
+/**
+ * @brief Distribution of the search_stats counters over the queries of each query_kind, the time in nanoseconds.
+ * See thread_query_profile and collect_query_profile.
+ */
+class query_profile {
+    public:
+        static constexpr int num_counters = 6;
+
+        static const char * counter_name( int c ){
+            static const char * names[] = { "nodes_visited", "points_visited", "leaves_visited", "subtrees_pruned",
+                                            "backtracks", "time_ns" };
+            return names[c];
+        }
+
+    private:
+        struct kind_profile {
+            uint64_t                                   m_queries = 0;
+            std::array<query_histogram,num_counters>   m_counters;
+        };
+        std::array<kind_profile, static_cast<int>(query_kind::num_kinds)> m_kinds;
+
+    public:
+        void record( query_kind kind, search_stats const& stats ){
+            kind_profile & p = m_kinds[ static_cast<int>(kind) ];
+            p.m_queries += 1;
+            p.m_counters[0].add( stats.m_nodes_visited );
+            p.m_counters[1].add( stats.m_points_visited );
+            p.m_counters[2].add( stats.m_leaves_visited );
+            p.m_counters[3].add( stats.m_subtrees_pruned );
+            p.m_counters[4].add( stats.m_backtracks );
+            p.m_counters[5].add( static_cast<uint64_t>( stats.m_seconds * 1e9 ) );
+        }
+
+        void merge( query_profile const& other ){
+            for( size_t k(0); k < m_kinds.size(); ++k ){
+                m_kinds[k].m_queries += other.m_kinds[k].m_queries;
+                for( int c(0); c < num_counters; ++c )
+                    m_kinds[k].m_counters[c].merge( other.m_kinds[k].m_counters[c] );
+            }
+        }
+
+        void clear(){ *this = query_profile(); }
+
+        uint64_t queries( query_kind kind )                     const { return m_kinds[ static_cast<int>(kind) ].m_queries; }
+        query_histogram const& histogram( query_kind kind, int c ) const { return m_kinds[ static_cast<int>(kind) ].m_counters[c]; }
+
+        /**
+         * @brief Writes the profile as JSON: for every kind of query that occurred, the number of queries and per
+         * counter its total, maximum and the non-empty buckets as [lower bound, count] pairs.
+         */
+        void write_json( std::ostream & o ) const {
+            o << "{";
+            bool firstKind = true;
+            for( int k(0); k < static_cast<int>(query_kind::num_kinds); ++k ){
+                if( m_kinds[k].m_queries == 0 )
+                    continue;
+                o << ( firstKind ? "" : "," ) << "\n  \"" << query_kind_name( static_cast<query_kind>(k) ) << "\": {\"queries\": "
+                  << m_kinds[k].m_queries;
+                firstKind = false;
+                for( int c(0); c < num_counters; ++c ){
+                    query_histogram const& h = m_kinds[k].m_counters[c];
+                    o << ",\n    \"" << counter_name(c) << "\": {\"total\": " << h.m_total << ", \"max\": " << h.m_max << ", \"buckets\": [";
+                    bool firstBucket = true;
+                    for( int b(0); b < static_cast<int>(h.m_buckets.size()); ++b ){
+                        if( h.m_buckets[b] == 0 )
+                            continue;
+                        o << ( firstBucket ? "" : ", " ) << "[" << query_histogram::lower(b) << ", " << h.m_buckets[b] << "]";
+                        firstBucket = false;
+                    }
+                    o << "]}";
+                }
+                o << "}";
+            }
+            o << "\n}\n";
+        }
+
+        /**
+         * @brief Writes the profile as text: per kind of query and counter the mean, the maximum and the share of
+         * the queries in every non-empty bucket.
+         */
+        void print( std::ostream & o ) const {
+            for( int k(0); k < static_cast<int>(query_kind::num_kinds); ++k ){
+                uint64_t n = m_kinds[k].m_queries;
+                if( n == 0 )
+                    continue;
+                o << query_kind_name( static_cast<query_kind>(k) ) << ": " << n << " queries" << std::endl;
+                for( int c(0); c < num_counters; ++c ){
+                    query_histogram const& h = m_kinds[k].m_counters[c];
+                    o << "  " << counter_name(c) << ": mean " << double(h.m_total) / n << ", max " << h.m_max << ", buckets";
+                    for( int b(0); b < static_cast<int>(h.m_buckets.size()); ++b )
+                        if( h.m_buckets[b] > 0 )
+                            o << " [" << query_histogram::lower(b) << ",) " << 100.0 * h.m_buckets[b] / n << "%";
+                    o << std::endl;
+                }
+            }
+        }
+};
+
+/**
+ * @brief The profiles of all threads: each thread records into its own (no synchronisation per query), which is
+ * merged into the retired profile when the thread ends.
+ */
+class query_profile_registry {
+    private:
+        std::mutex                          m_mutex;
+        std::vector<query_profile const*>   m_live;
+        query_profile                       m_retired;
+
+    public:
+        static query_profile_registry & get(){
+            static query_profile_registry registry;
+            return registry;
+        }
+
+        void add( query_profile const* profile ){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_live.push_back(profile);
+        }
+
+        void retire( query_profile const* profile ){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_retired.merge(*profile);
+            for( size_t i(0); i < m_live.size(); ++i )
+                if( m_live[i] == profile ){
+                    m_live.erase( m_live.begin() + i );
+                    break;
+                }
+        }
+
+        query_profile collect(){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            query_profile total = m_retired;
+            for( query_profile const* p : m_live )
+                total.merge(*p);
+            return total;
+        }
+
+        void reset(){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_retired.clear();
+            for( query_profile const* p : m_live )
+                const_cast<query_profile*>(p)->clear();
+        }
+};
+
+// the profile of the calling thread, registered on first use.
+inline query_profile & thread_query_profile(){
+    struct holder {
+        query_profile m_profile;
+        holder()  { query_profile_registry::get().add(&m_profile); }
+        ~holder() { query_profile_registry::get().retire(&m_profile); }
+    };
+    static thread_local holder h;
+    return h.m_profile;
+}
+
+/**
+ * @brief The profiles of all threads merged, with KDTREE_QUERY_STATS on. Call it while no other thread is
+ * searching, e.g. after joining the workers of knn_batch (whose profiles are retired by then anyway).
+ */
+inline query_profile collect_query_profile(){
+    return query_profile_registry::get().collect();
+}
+
+// clears the profiles of all threads; the same restriction as for collect_query_profile applies.
+inline void reset_query_profiles(){
+    query_profile_registry::get().reset();
+}
+
+/**
+ * @brief Placed at the top of a search entry point, after its stats are reset: with KDTREE_QUERY_STATS on it
+ * times the query and records its stats in the profile of the thread when the search returns; otherwise it is
+ * empty and compiles to nothing.
+ */
+class query_scope {
+#if KDTREE_QUERY_STATS
+    private:
+        query_kind                              m_kind;
+        search_stats &                          m_stats;
+        std::chrono::steady_clock::time_point   m_start;
+
+    public:
+        query_scope( query_kind kind, search_stats & stats )
+            : m_kind(kind), m_stats(stats), m_start( std::chrono::steady_clock::now() ) {}
+
+        ~query_scope(){
+            m_stats.m_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - m_start ).count();
+            thread_query_profile().record( m_kind, m_stats );
+        }
+#else
+    public:
+        query_scope( query_kind, search_stats & ) {}
+#endif
+
+        query_scope( query_scope const& ) = delete;
+        query_scope & operator=( query_scope const& ) = delete;
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+/**
+ * @brief Number of bits per dimension that fit in a 64-bit space-filling-curve key of an N-dimensional point.
+ */
+template<int N>
+constexpr int curve_bits_per_dim(){
+    return 64 / N > 32 ? 32 : 64 / N;
+}
+
+/**
+ * @brief Axis-aligned bounding box of a set of points, used to quantize coordinates to integer grid cells.
+ */
+template<typename T, int N>
+struct curve_bounds {
+    std::array<T,N> m_min;
+    std::array<T,N> m_max;
+
+    uint64_t quantize( T value, int dim ) const {
+        const uint64_t cells = ( uint64_t(1) << curve_bits_per_dim<N>() ) - 1;
+        T extent = m_max[dim] - m_min[dim];
+        if( !( extent > 0 ) )
+            return 0;
+        double x = double( value - m_min[dim] ) / double( extent );
+        x = std::min( std::max( x, 0.0 ), 1.0 );
+        return static_cast<uint64_t>( x * cells );
+    }
+};
+
+template<typename T, int N>
+curve_bounds<T,N> compute_curve_bounds( std::array<T,N> const* points, size_t numPoints ){
+    curve_bounds<T,N> bounds;
+    bounds.m_min.fill(0);
+    bounds.m_max.fill(0);
+    if( numPoints == 0 )
+        return bounds;
+
+    bounds.m_min = points[0];
+    bounds.m_max = points[0];
+    for( size_t i(1); i < numPoints; ++i )
+        for( int dim(0); dim < N; ++dim ){
+            bounds.m_min[dim] = std::min(bounds.m_min[dim], points[i][dim]);
+            bounds.m_max[dim] = std::max(bounds.m_max[dim], points[i][dim]);
+        }
+    return bounds;
+}
+
+/**
+ * @brief Orders of the points along a space-filling curve: none keeps the input order, morton is the Z-order of
+ * the interleaved bits and hilbert the Hilbert curve, which never jumps between distant cells.
+ */
+enum class curve_type { none, morton, hilbert };
+
+/**
+ * @brief Spreads the low 64 / N bits of x apart, bit b moving to bit b * N, with shifts and masks only so that
+ * loops over many values vectorise.
+ */
+template<int N>
+struct bit_spreader {
+    static uint64_t apply( uint64_t x ){
+        uint64_t r = 0;
+        for( int b(0); b < curve_bits_per_dim<N>(); ++b )
+            r |= ( ( x >> b ) & 1 ) << ( b * N );
+        return r;
+    }
+};
+
+template<>
+struct bit_spreader<1> {
+    static uint64_t apply( uint64_t x ){ return x; }
+};
+
+template<>
+struct bit_spreader<2> {
+    static uint64_t apply( uint64_t x ){
+        x &= 0x00000000ffffffffull;
+        x = ( x | ( x << 16 ) ) & 0x0000ffff0000ffffull;
+        x = ( x | ( x << 8 ) )  & 0x00ff00ff00ff00ffull;
+        x = ( x | ( x << 4 ) )  & 0x0f0f0f0f0f0f0f0full;
+        x = ( x | ( x << 2 ) )  & 0x3333333333333333ull;
+        x = ( x | ( x << 1 ) )  & 0x5555555555555555ull;
+        return x;
+    }
+};
+
+template<>
+struct bit_spreader<3> {
+    static uint64_t apply( uint64_t x ){
+        x &= 0x1fffffull;
+        x = ( x | ( x << 32 ) ) & 0x001f00000000ffffull;
+        x = ( x | ( x << 16 ) ) & 0x001f0000ff0000ffull;
+        x = ( x | ( x << 8 ) )  & 0x100f00f00f00f00full;
+        x = ( x | ( x << 4 ) )  & 0x10c30c30c30c30c3ull;
+        x = ( x | ( x << 2 ) )  & 0x1249249249249249ull;
+        return x;
+    }
+};
+
+/**
+ * @brief Turns the quantized coordinates of count points, x[dim][j] for point j, into the transposed form of their
+ * Hilbert indices (Skilling's algorithm): interleaving the bits of the result, as for a Morton key, gives the
+ * index. Both branches of every step are computed with masks and the points are the innermost loop, so that the
+ * transform of a block of points vectorises.
+ */
+template<int N, size_t Block>
+void hilbert_transpose( std::array<std::array<uint64_t,Block>,N> & x, size_t count ){
+    for( int bit(curve_bits_per_dim<N>() - 1); bit > 0; --bit ){
+        uint64_t p = ( uint64_t(1) << bit ) - 1;
+        for( size_t j(0); j < count; ++j )
+            x[0][j] ^= p & ( uint64_t(0) - ( ( x[0][j] >> bit ) & 1 ) );
+        for( int dim(1); dim < N; ++dim )
+            for( size_t j(0); j < count; ++j ){
+                uint64_t set = uint64_t(0) - ( ( x[dim][j] >> bit ) & 1 );
+                uint64_t x0 = x[0][j] ^ ( p & set );
+                uint64_t t = ( x0 ^ x[dim][j] ) & p & ~set;
+                x[0][j] = x0 ^ t;
+                x[dim][j] ^= t;
+            }
+    }
+
+    // Gray encoding, then every bit of the last coordinate above bit 0 flips all the bits below it in every
+    // coordinate: bit i of the flips is the parity of the bits of x[N-1] above i, a prefix xor.
+    for( int dim(1); dim < N; ++dim )
+        for( size_t j(0); j < count; ++j )
+            x[dim][j] ^= x[dim-1][j];
+    for( size_t j(0); j < count; ++j ){
+        uint64_t t = x[N-1][j] >> 1;
+        for( int shift(1); shift < 64; shift *= 2 )
+            t ^= t >> shift;
+        for( int dim(0); dim < N; ++dim )
+            x[dim][j] ^= t;
+    }
+}
+
+/**
+ * @brief Interleaves the bits of the cell coordinates, most significant bits first and dim 0 first within each
+ * bit, into one key.
+ */
+template<int N>
+uint64_t interleave_bits( std::array<uint64_t,N> const& cell ){
+    // beyond 64 dimensions no bit is left per dimension and all keys are 0.
+    uint64_t code = 0;
+    for( int dim(0); dim < N && curve_bits_per_dim<N>() > 0; ++dim )
+        code |= bit_spreader<N>::apply( cell[dim] ) << ( N - 1 - dim );
+    return code;
+}
+
+/**
+ * @brief Morton (Z-order) key of a point: the bits of its quantized coordinates interleaved, most significant
+ * bits first, so that points close in the key are (mostly) close in space.
+ */
+template<typename T, int N>
+uint64_t morton_code( std::array<T,N> const& point, curve_bounds<T,N> const& bounds ){
+    std::array<uint64_t,N> cell;
+    for( int dim(0); dim < N; ++dim )
+        cell[dim] = bounds.quantize(point[dim], dim);
+    return interleave_bits<N>( cell );
+}
+
+/**
+ * @brief Hilbert key of a point, with the same resolution as its Morton key.
+ */
+template<typename T, int N>
+uint64_t hilbert_code( std::array<T,N> const& point, curve_bounds<T,N> const& bounds ){
+    std::array<std::array<uint64_t,1>,N> transposed;
+    for( int dim(0); dim < N; ++dim )
+        transposed[dim][0] = bounds.quantize(point[dim], dim);
+    hilbert_transpose<N,1>( transposed, 1 );
+
+    std::array<uint64_t,N> cell;
+    for( int dim(0); dim < N; ++dim )
+        cell[dim] = transposed[dim][0];
+    return interleave_bits<N>( cell );
+}
+
+/**
+ * @brief Keys of numPoints points along the curve (morton or hilbert), written to codes. The points are processed
+ * in blocks, one dimension at a time, so that quantization, the Hilbert transform and the bit interleaving are
+ * loops over the block that the compiler vectorises.
+ */
+template<typename T, int N>
+void curve_codes( std::array<T,N> const* points, size_t numPoints, curve_bounds<T,N> const& bounds, curve_type curve,
+    uint64_t * codes ){
+
+    const size_t block = 64;
+    std::array<std::array<uint64_t,block>,N> cells;
+    for( size_t begin(0); begin < numPoints; begin += block ){
+        size_t count = std::min(block, numPoints - begin);
+        for( int dim(0); dim < N; ++dim )
+            for( size_t j(0); j < count; ++j )
+                cells[dim][j] = bounds.quantize(points[begin + j][dim], dim);
+
+        if( curve == curve_type::hilbert )
+            hilbert_transpose<N,block>( cells, count );
+
+        for( size_t j(0); j < count; ++j )
+            codes[begin + j] = 0;
+        for( int dim(0); dim < N && curve_bits_per_dim<N>() > 0; ++dim )
+            for( size_t j(0); j < count; ++j )
+                codes[begin + j] |= bit_spreader<N>::apply( cells[dim][j] ) << ( N - 1 - dim );
+    }
+}
+
+/**
+ * @brief Sorts keys in increasing order and applies the same permutation to values, with a stable least
+ * significant digit radix sort on num_threads threads: every pass histograms one digit of the keys chunk by chunk,
+ * turns the histograms into the first output position of every (chunk, digit) and scatters each chunk in order.
+ * Large inputs use 16-bit digits (four passes for 64-bit keys), small ones 8-bit digits whose histograms are
+ * cheaper to clear and scan. Passes over digits that are equal in all keys are skipped, so the number of passes
+ * follows the range of the keys rather than their width. The result does not depend on num_threads.
+ */
+inline void radix_sort_by_key( std::vector<uint64_t> & keys, std::vector<size_t> & values, int num_threads = 1 ){
+    const size_t n = keys.size();
+    const int digit_bits = n >= ( size_t(1) << 18 ) ? 16 : 8;
+    const uint64_t digit_mask = ( uint64_t(1) << digit_bits ) - 1;
+    num_threads = std::max<int>( 1, std::min<size_t>( static_cast<size_t>(resolve_num_threads(num_threads)), n / 4096 + 1 ) );
+
+    uint64_t all_or = 0, all_and = ~uint64_t(0);
+    for( uint64_t k : keys ){
+        all_or |= k;
+        all_and &= k;
+    }
+    uint64_t varying = all_or ^ all_and;
+
+    std::vector<uint64_t> keysOut(n);
+    std::vector<size_t>   valuesOut(n);
+    std::vector<std::vector<size_t>> offsets( num_threads, std::vector<size_t>( size_t(1) << digit_bits ) );
+
+    for( int shift(0); shift < 64; shift += digit_bits ){
+        if( ( ( varying >> shift ) & digit_mask ) == 0 )
+            continue;
+
+        parallel_for_chunks( 0, n, num_threads, [&]( size_t chunk, size_t b, size_t e ){
+            std::vector<size_t> & count = offsets[chunk];
+            std::fill( count.begin(), count.end(), 0 );
+            for( size_t i(b); i < e; ++i )
+                count[ ( keys[i] >> shift ) & digit_mask ] += 1;
+        });
+
+        size_t position = 0;
+        for( size_t digit(0); digit <= digit_mask; ++digit )
+            for( int chunk(0); chunk < num_threads; ++chunk ){
+                size_t count = offsets[chunk][digit];
+                offsets[chunk][digit] = position;
+                position += count;
+            }
+
+        parallel_for_chunks( 0, n, num_threads, [&]( size_t chunk, size_t b, size_t e ){
+            std::vector<size_t> & next = offsets[chunk];
+            for( size_t i(b); i < e; ++i ){
+                size_t to = next[ ( keys[i] >> shift ) & digit_mask ]++;
+                keysOut[to] = keys[i];
+                valuesOut[to] = values[i];
+            }
+        });
+
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
+
+/**
+ * @brief Permutation that visits the points in the order of the curve; equal keys keep their input order. The
+ * keys are computed and radix sorted on num_threads threads (0 = all cores). With curve_type::none it is the
+ * identity.
+ */
+template<typename T, int N>
+std::vector<size_t> curve_order( std::array<T,N> const* points, size_t numPoints, curve_type curve, int num_threads = 1 ){
+    std::vector<size_t> order(numPoints);
+    std::iota(order.begin(), order.end(), 0);
+    if( curve == curve_type::none || numPoints == 0 )
+        return order;
+
+    curve_bounds<T,N> bounds = compute_curve_bounds<T,N>(points, numPoints);
+    std::vector<uint64_t> codes(numPoints);
+    parallel_for_chunks( 0, numPoints, resolve_num_threads(num_threads), [&]( size_t, size_t b, size_t e ){
+        curve_codes<T,N>( points + b, e - b, bounds, curve, codes.data() + b );
+    });
+
+    radix_sort_by_key( codes, order, num_threads );
+    return order;
+}
+
+template<typename T, int N>
+std::vector<size_t> curve_order( std::vector<std::array<T,N>> const& points, curve_type curve, int num_threads = 1 ){
+    return curve_order<T,N>( points.data(), points.size(), curve, num_threads );
+}
+
+/**
+ * @brief Permutation that visits the points in Morton order.
+ */
+template<typename T, int N>
+std::vector<size_t> morton_order( std::array<T,N> const* points, size_t numPoints ){
+    return curve_order<T,N>( points, numPoints, curve_type::morton );
+}
+
+/**
+ * @brief Copy of the points in the given order (see curve_order): laying a dataset out along a curve before a
+ * structure that indexes it (a kd-forest, a tree grown by insertions) is built makes neighbouring points, and
+ * thus the points of a leaf, neighbours in memory. The id of point i of the copy is order[i].
+ */
+template<typename T, int N>
+std::vector<std::array<T,N>> reorder_points( std::array<T,N> const* points, std::vector<size_t> const& order ){
+    std::vector<std::array<T,N>> reordered( order.size() );
+    for( size_t i(0); i < order.size(); ++i )
+        reordered[i] = points[ order[i] ];
+    return reordered;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <chrono>
+
+/**
+ * @brief Minimal wall-clock timer, used by the searches that report their duration and by the benchmark programs.
+ */
+class timer {
+    private:
+        std::chrono::steady_clock::time_point m_start;
+
+    public:
+        timer() : m_start( std::chrono::steady_clock::now() ) {}
+        void   reset()         { m_start = std::chrono::steady_clock::now(); }
+        double seconds() const { return std::chrono::duration<double>( std::chrono::steady_clock::now() - m_start ).count(); }
+};
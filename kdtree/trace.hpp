@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// deliver the diagnostics of the kd-trees to the sink of set_trace_sink; 0 leaves only the verbose output to stdout.
+#ifndef KDTREE_TRACE
+#define KDTREE_TRACE 0
+#endif
+
+/**
+ * @brief Diagnostics reported by the kd-trees.
+ */
+enum class trace_kind { build, node_created, node_destroyed, descend_left, descend_right, leaf_reached };
+
+/**
+ * @brief One diagnostic: its kind, a static description and its payload, integral in m_integer (the number of
+ * points of a build, the id of a node created or destroyed) or real-valued in m_value (the distance to the child
+ * descended into, the first coordinate of a leaf); the other field is 0. Events own no memory, so recording one
+ * never allocates.
+ */
+struct trace_event {
+    trace_kind   m_kind;
+    const char * m_what;
+    double       m_value;
+    uint64_t     m_integer;
+};
+
+// receives every event while installed with set_trace_sink; it runs on the thread that emitted the event.
+typedef void (*trace_sink)( trace_event const& event, void * user );
+
+struct trace_hook {
+    std::atomic<trace_sink> m_sink;
+    std::atomic<void*>      m_user;
+
+    static trace_hook & get(){
+        static trace_hook hook = { { nullptr }, { nullptr } };
+        return hook;
+    }
+};
+
+/**
+ * @brief Installs sink for the events of all threads; nullptr removes it. Set it while no tree is built or
+ * searched, the hook is read without synchronisation beyond the atomic load. Without KDTREE_TRACE the sink is
+ * never called.
+ */
+inline void set_trace_sink( trace_sink sink, void * user = nullptr ){
+    trace_hook::get().m_user.store( user, std::memory_order_relaxed );
+    trace_hook::get().m_sink.store( sink, std::memory_order_release );
+}
+
+// the line of an event as the kd-trees printed it to std::cout before the hook.
+inline void print_trace_event( std::ostream & o, trace_event const& event ){
+    switch( event.m_kind ){
+        case trace_kind::build:          o << "Called " << event.m_what << std::endl; break;
+        case trace_kind::node_created:   o << "Called " << event.m_what << std::endl; break;
+        case trace_kind::node_destroyed: o << "destroying node " << event.m_integer << std::endl; break;
+        case trace_kind::descend_left:   o << "going left\n"; break;
+        case trace_kind::descend_right:  o << "going right\n"; break;
+        case trace_kind::leaf_reached:   o << "reached leaf node: " << event.m_value << std::endl; break;
+    }
+}
+
+// delivers event to the installed sink, or prints it with verbose when there is none; see kdtree_trace.
+inline void emit_trace_event( trace_event const& event, bool verbose ){
+#if KDTREE_TRACE
+    trace_sink sink = trace_hook::get().m_sink.load( std::memory_order_acquire );
+    if( sink != nullptr ){
+        sink( event, trace_hook::get().m_user.load( std::memory_order_relaxed ) );
+        return;
+    }
+#endif
+    if( verbose )
+        print_trace_event( std::cout, event );
+}
+
+/**
+ * @brief Emits an event with a real-valued payload. The kd-trees emit all of their events unconditionally, so an
+ * installed sink sees the whole stream; verbose only decides whether the event is printed to std::cout when no
+ * sink is installed, so nothing is written unless requested. With KDTREE_TRACE 0 (the default) there is no sink,
+ * and the call reduces to the test of verbose: the query path does no I/O and no atomic load.
+ */
+inline void kdtree_trace( trace_kind kind, const char * what, double value, bool verbose = false ){
+    emit_trace_event( trace_event{ kind, what, value, 0 }, verbose );
+}
+
+// emits an event with an integral payload, which unlike a double keeps ids and counts above 2^53 exact.
+inline void kdtree_trace( trace_kind kind, const char * what, uint64_t value, bool verbose = false ){
+    emit_trace_event( trace_event{ kind, what, 0, value }, verbose );
+}
+
+/**
+ * @brief Fixed-size ring of the most recent events of one thread; older events are overwritten. See
+ * trace_to_thread_buffer.
+ */
+class trace_ring_buffer {
+    public:
+        static constexpr size_t capacity = 4096;
+
+    private:
+        std::array<trace_event,capacity> m_events;
+        size_t                           m_count = 0;
+
+    public:
+        void push( trace_event const& event ){ m_events[ m_count++ % capacity ] = event; }
+        void clear()                         { m_count = 0; }
+
+        // number of events pushed since the last clear, including the overwritten ones.
+        size_t pushed() const { return m_count; }
+
+        // the events still held, oldest first.
+        std::vector<trace_event> events() const {
+            std::vector<trace_event> result;
+            size_t held = m_count < capacity ? m_count : capacity;
+            result.reserve(held);
+            for( size_t i(m_count - held); i < m_count; ++i )
+                result.push_back( m_events[ i % capacity ] );
+            return result;
+        }
+};
+
+// the ring buffer of the calling thread.
+inline trace_ring_buffer & thread_trace_buffer(){
+    static thread_local trace_ring_buffer buffer;
+    return buffer;
+}
+
+// sink that captures the events of every thread in its own thread_trace_buffer, without locks or I/O.
+inline void trace_to_thread_buffer( trace_event const& event, void * ){
+    thread_trace_buffer().push( event );
+}
+
+// sink that prints the events to the std::ostream passed as user pointer.
+inline void trace_to_stream( trace_event const& event, void * user ){
+    print_trace_event( *static_cast<std::ostream*>(user), event );
+}